@@ -66,7 +66,7 @@ Identifier::Identifier(const Token& t, const std::string& v) : token(t) {
     token.Literal = v;
 }
 
-std::string Identifier::Value() const {
+const std::string& Identifier::Value() const {
     return token.Literal;
 }
 
@@ -142,11 +142,20 @@ std::string FunctionLiteral::String() const {
     for (const auto& param : Parameters) {
         params.push_back(param->String());
     }
-    result += join(params, ", ") + ") " + Body->String();
+    result += join(params, ", ") + ") " + GetBody()->String();
     //result += join(params, ", ") + ") { " + Body->String() + " }";
     return result;
 }
 
+const std::shared_ptr<BlockStatement>& FunctionLiteral::GetBody() const {
+    if (DeferredBody) {
+        std::call_once(bodyParsed, [this] {
+            Body = DeferredBody(BodyErrors);
+        });
+    }
+    return Body;
+}
+
 CallExpression::CallExpression (const Token& t, std::shared_ptr<Expression> f) : token(t), Function(f){}
 
 std::string CallExpression::TokenLiteral() const {
@@ -216,6 +225,49 @@ std::string HashLiteral::String() const {
 
 }
 
+std::string ConstantValue::String() const {
+    switch (Kind) {
+        case TokenType::INT: return std::to_string(Int);
+        case TokenType::STRING: return Str;
+        case TokenType::TRUE: return "true";
+        default: return "false";
+    }
+}
+
+std::shared_ptr<Expression> ConstantValue::ToExpression() const {
+    switch (Kind) {
+        case TokenType::INT: return std::make_shared<IntegerLiteral>(Token(Kind, String()), Int);
+        case TokenType::STRING: return std::make_shared<StringLiteral>(Token(Kind, Str), Str);
+        case TokenType::TRUE: return std::make_shared<Boolean>(Token(Kind, "true"), true);
+        default: return std::make_shared<Boolean>(Token(Kind, "false"), false);
+    }
+}
+
+std::string IntegerArrayLiteral::TokenLiteral() const {
+    return token.Literal;
+}
+
+std::string IntegerArrayLiteral::String() const {
+    std::vector<std::string> elems;
+    elems.reserve(Values.size());
+    for(auto v : Values){
+        elems.push_back(std::to_string(v));
+    }
+    return "[" + join(elems, ", ") + "]";
+}
+
+std::string ConstantHashLiteral::TokenLiteral() const {
+    return token.Literal;
+}
+
+std::string ConstantHashLiteral::String() const {
+    std::vector<std::string> pairs;
+    for(const auto& pair : Pairs){
+        pairs.push_back(pair.first.String() + ":" + pair.second.String());
+    }
+    return "{" + join(pairs, ", ") + "}";
+}
+
 std::string join(const std::vector<std::string>& elements, const std::string& delimiter) {
     switch (elements.size()) {
         case 0:
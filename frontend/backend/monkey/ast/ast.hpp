@@ -7,8 +7,15 @@
 #include <memory>
 #include <iterator>
 #include <map>
+#include <functional>
+#include <mutex>
 #include "../token/token.hpp"
 
+namespace YOXS_OBJECT {
+class Object;
+class FunctionPrototype;
+}
+
 namespace YOXS_AST {
 // Forward declarations of all the classes we're going to use.
 class Statement; 
@@ -35,10 +42,20 @@ public:
     virtual void expressionNode() = 0;
 };
 
+// Byte range of a top-level statement in the source. End is where the
+// next statement starts, so the spans of a program cover all of it.
+struct SourceSpan {
+    std::string::size_type Begin = 0;
+    std::string::size_type End = 0;
+};
+
 // The root node of every AST our parser produces
 class Program : public Node {
 public:
     std::vector<std::shared_ptr<Statement>> Statements;
+    // One span per statement, filled in by a sequential parse that had no
+    // errors and empty otherwise. Incremental reparsing needs them.
+    std::vector<SourceSpan> Spans;
     std::string TokenLiteral() const override;
     std::string String() const override;
 };
@@ -93,7 +110,7 @@ public:
     Identifier(const Token& t, const std::string& v);
 
     Token token; // The IDENT token
-    std::string Value() const;
+    const std::string& Value() const;
     std::string TokenLiteral() const override;
     std::string String() const override;
     void expressionNode() override {}
@@ -162,16 +179,31 @@ public:
     void expressionNode() override {}
 };
 
-class FunctionLiteral : public Expression {
+class FunctionLiteral : public Expression, public std::enable_shared_from_this<FunctionLiteral> {
 public:
     FunctionLiteral(const Token& t);
     Token token; // The 'fn' token
     std::vector<std::shared_ptr<Identifier>> Parameters;
-    std::shared_ptr<BlockStatement> Body;
+    mutable std::shared_ptr<BlockStatement> Body;
+
+    // When the parser only skimmed the body, Body stays empty and this
+    // parses it instead, reporting any syntax errors through the vector
+    std::function<std::shared_ptr<BlockStatement>(std::vector<std::string>& errors)> DeferredBody;
+    mutable std::vector<std::string> BodyErrors;
+
+    // shared by the function values made from this literal, built on first
+    // use (see Evaluator::prototypeOf)
+    mutable std::shared_ptr<const YOXS_OBJECT::FunctionPrototype> Prototype;
+
+    // The body, parsed on first use if it was deferred
+    const std::shared_ptr<BlockStatement>& GetBody() const;
 
     std::string TokenLiteral() const override;
     std::string String() const override;
     void expressionNode() override {}
+
+private:
+    mutable std::once_flag bodyParsed;
 };
 
 class CallExpression : public Expression {
@@ -232,6 +264,53 @@ public:
     std::string String() const override;
 };
 
+// Literals with at least this many elements, all of them constants, are
+// stored packed instead of as one node per element
+const size_t PACKED_LITERAL_MIN_ELEMENTS = 16;
+
+// A scalar known at parse time: an integer, string or boolean literal
+struct ConstantValue {
+    TokenType Kind; // INT, STRING, TRUE or FALSE
+    int64_t Int;
+    std::string Str;
+
+    std::string String() const;
+    std::shared_ptr<Expression> ToExpression() const;
+};
+
+// Array and hash literals made only of constants. Each evaluation still
+// makes a new array or hash, but from parts that are ready: an array from
+// the packed values, a hash from a template whose pairs the evaluator
+// builds once and keeps here. Access goes through std::atomic_load/store.
+class PackedLiteral : public Expression {
+public:
+    mutable std::shared_ptr<YOXS_OBJECT::Object> Materialized;
+};
+
+// [1, 2, 3, ...] with only integer elements
+class IntegerArrayLiteral : public PackedLiteral {
+public:
+    IntegerArrayLiteral(const Token& t, std::vector<int64_t> values) : token(t), Values(std::move(values)) {}
+    Token token; // the [ token
+    std::vector<int64_t> Values;
+
+    void expressionNode() override {}
+    std::string TokenLiteral() const override;
+    std::string String() const override;
+};
+
+// {"a": 1, 2: true, ...} with only constant keys and values, in source order
+class ConstantHashLiteral : public PackedLiteral {
+public:
+    ConstantHashLiteral(const Token& t, std::vector<std::pair<ConstantValue, ConstantValue>> pairs) : token(t), Pairs(std::move(pairs)) {}
+    Token token; // the { token
+    std::vector<std::pair<ConstantValue, ConstantValue>> Pairs;
+
+    void expressionNode() override {}
+    std::string TokenLiteral() const override;
+    std::string String() const override;
+};
+
 std::string join(const std::vector<std::string>&, const std::string&);
 
 } // namespace YOXS_AST
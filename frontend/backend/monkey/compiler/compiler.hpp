@@ -8,7 +8,7 @@
 
 class Compiler {
 public:
-    std::vector<std::shared_ptr<YOXS_OBJECT::Object>> constants;
+    std::vector<YOXS_OBJECT::ObjectRef> constants;
     std::unique_ptr<SymbolTable> symbolTable;
 
     struct EmittedInstruction {
@@ -38,7 +38,7 @@ public:
         scopes.push_back(mainScope);
     }
 
-    Compiler(std::unique_ptr<SymbolTable> s, std::vector<std::shared_ptr<Object>> consts) : Compiler() {
+    Compiler(std::unique_ptr<SymbolTable> s, std::vector<ObjectRef> consts) : Compiler() {
         symbolTable = std::move(s);
         constants = consts;
     }
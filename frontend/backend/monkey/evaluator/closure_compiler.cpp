@@ -0,0 +1,379 @@
+#include "closure_compiler.hpp"
+
+//closure_compiler.cpp
+
+namespace {
+
+ObjectRef unwrap(ObjectRef obj) {
+    if (obj && obj->Type() == RETURN_VALUE_OBJ) {
+        return StaticRefCast<ReturnValue>(obj)->Value;
+    }
+    return obj;
+}
+
+CompiledCode constant(ObjectRef obj) {
+    return [obj](const std::shared_ptr<Frame>&) { return obj; };
+}
+
+// Integer operands take intOp, anything else goes through
+// Evaluator::evalInfixExpression. Like Evaluator, integers are computed
+// as int.
+template <typename IntOp>
+CompiledCode infix(CompiledCode left, CompiledCode right, std::string op, IntOp intOp) {
+    return [left, right, op, intOp](const std::shared_ptr<Frame>& f) -> ObjectRef {
+        auto l = left(f);
+        if (Evaluator::isError(l)) return l;
+        auto r = right(f);
+        if (Evaluator::isError(r)) return r;
+        if (l->Type() == INTEGER_OBJ && r->Type() == INTEGER_OBJ) {
+            int a = static_cast<Integer*>(l.get())->Value;
+            int b = static_cast<Integer*>(r.get())->Value;
+            return intOp(a, b);
+        }
+        return Evaluator::evalInfixExpression(op, l, r);
+    };
+}
+
+} // namespace
+
+CompiledCode ClosureCompiler::Compile(const Program& program) {
+    ClosureCompiler compiler;
+    return compiler.compileBlock(program.Statements, true);
+}
+
+ObjectRef ClosureCompiler::Run(const CompiledCode& code, std::shared_ptr<Environment> env) {
+    return code(std::make_shared<Frame>(0, nullptr, std::move(env)));
+}
+
+ObjectRef ClosureCompiler::Eval(const Program& program, std::shared_ptr<Environment> env) {
+    return Run(Compile(program), std::move(env));
+}
+
+CompiledCode ClosureCompiler::compile(const std::shared_ptr<Node>& node) {
+    if (auto n = std::dynamic_pointer_cast<BlockStatement>(node)) {
+        return compileBlock(n->Statements, false);
+    } else if (auto n = std::dynamic_pointer_cast<ExpressionStatement>(node)) {
+        return compile(n->expr);
+    } else if (auto n = std::dynamic_pointer_cast<ReturnStatement>(node)) {
+        auto value = compile(n->ReturnValue);
+        return [value](const std::shared_ptr<Frame>& f) -> ObjectRef {
+            auto val = value(f);
+            if (Evaluator::isError(val)) return val;
+            return MakeRef<ReturnValue>(val);
+        };
+    } else if (auto n = std::dynamic_pointer_cast<LetStatement>(node)) {
+        return compileLet(*n);
+    } else if (auto n = std::dynamic_pointer_cast<IntegerLiteral>(node)) {
+        return constant(MakeGlobal<Integer>(n->Value));
+    } else if (auto n = std::dynamic_pointer_cast<StringLiteral>(node)) {
+        return constant(MakeGlobal<String>(n->Value));
+    } else if (auto n = std::dynamic_pointer_cast<Boolean>(node)) {
+        return constant(Evaluator::nativeBoolToBooleanObject(n->Value));
+    } else if (auto n = std::dynamic_pointer_cast<PrefixExpression>(node)) {
+        return compilePrefix(*n);
+    } else if (auto n = std::dynamic_pointer_cast<InfixExpression>(node)) {
+        return compileInfix(*n);
+    } else if (auto n = std::dynamic_pointer_cast<IfExpression>(node)) {
+        auto condition = compile(n->Condition);
+        auto consequence = compile(n->Consequence);
+        CompiledCode alternative = n->Alternative ? compile(n->Alternative) : nullptr;
+        return [condition, consequence, alternative](const std::shared_ptr<Frame>& f) -> ObjectRef {
+            auto cond = condition(f);
+            if (Evaluator::isError(cond)) return cond;
+            if (Evaluator::isTruthy(cond)) return consequence(f);
+            if (alternative) return alternative(f);
+            return ObjectConstants::NULL_OBJ;
+        };
+    } else if (auto n = std::dynamic_pointer_cast<Identifier>(node)) {
+        return compileIdentifier(n->Value());
+    } else if (auto n = std::dynamic_pointer_cast<FunctionLiteral>(node)) {
+        return compileFunction(n);
+    } else if (auto n = std::dynamic_pointer_cast<CallExpression>(node)) {
+        return compileCall(*n);
+    } else if (auto n = std::dynamic_pointer_cast<ArrayLiteral>(node)) {
+        std::vector<CompiledCode> elements;
+        for (const auto& elem : n->Elements) elements.push_back(compile(elem));
+        return [elements](const std::shared_ptr<Frame>& f) -> ObjectRef {
+            std::vector<ObjectRef> values;
+            values.reserve(elements.size());
+            for (const auto& elem : elements) {
+                auto val = elem(f);
+                if (Evaluator::isError(val)) return val;
+                values.push_back(std::move(val));
+            }
+            return MakeYoung<ArrayObject>(std::move(values));
+        };
+    } else if (auto n = std::dynamic_pointer_cast<IndexExpression>(node)) {
+        auto left = compile(n->Left);
+        auto index = compile(n->Index);
+        return [left, index](const std::shared_ptr<Frame>& f) -> ObjectRef {
+            auto l = left(f);
+            if (Evaluator::isError(l)) return l;
+            return Evaluator::evalIndexExpression(l, index(f));
+        };
+    } else if (auto n = std::dynamic_pointer_cast<HashLiteral>(node)) {
+        return compileHash(*n);
+    } else if (auto n = std::dynamic_pointer_cast<PackedLiteral>(node)) {
+        return [n](const std::shared_ptr<Frame>&) { return Evaluator::evalPackedLiteral(*n); };
+    }
+
+    return constant(nullptr);
+}
+
+// A program unwraps a return value and stops there; a block hands it on
+// to the function call (or program) it is part of.
+CompiledCode ClosureCompiler::compileBlock(const std::vector<std::shared_ptr<Statement>>& statements, bool program) {
+    std::vector<CompiledCode> codes;
+    for (const auto& stmt : statements) codes.push_back(compile(stmt));
+
+    return [codes, program](const std::shared_ptr<Frame>& f) -> ObjectRef {
+        ObjectRef result;
+        for (const auto& code : codes) {
+            result = code(f);
+            if (result) {
+                auto rt = result->Type();
+                if (rt == RETURN_VALUE_OBJ) return program ? unwrap(result) : result;
+                if (rt == ERROR_OBJ) return result;
+            }
+        }
+        return result;
+    };
+}
+
+// A name resolves to the slots it may live in, innermost function first.
+// A slot that is not set yet (its `let` has not run) falls through to the
+// next one, and from there to the globals and builtins, just as the
+// environment chain would.
+CompiledCode ClosureCompiler::compileIdentifier(const std::string& name) {
+    std::vector<std::pair<uint32_t, uint32_t>> candidates; // depth, slot
+    uint32_t depth = 0;
+    for (Scope* s = scope; s; s = s->outer, depth++) {
+        auto it = s->slots.find(name);
+        if (it != s->slots.end()) candidates.emplace_back(depth, it->second);
+    }
+
+    if (candidates.empty()) {
+        return [name](const std::shared_ptr<Frame>& f) { return Evaluator::lookupIdentifier(name, f->Globals); };
+    }
+    if (candidates.size() == 1 && candidates[0].first == 0) {
+        auto slot = candidates[0].second;
+        return [name, slot](const std::shared_ptr<Frame>& f) {
+            if (const auto& val = f->Slots[slot]) return val;
+            return Evaluator::lookupIdentifier(name, f->Globals);
+        };
+    }
+    return [name, candidates](const std::shared_ptr<Frame>& f) {
+        for (const auto& c : candidates) {
+            Frame* frame = f.get();
+            for (uint32_t d = 0; d < c.first; ++d) frame = frame->Outer.get();
+            if (const auto& val = frame->Slots[c.second]) return val;
+        }
+        return Evaluator::lookupIdentifier(name, f->Globals);
+    };
+}
+
+CompiledCode ClosureCompiler::compileLet(const LetStatement& let) {
+    auto value = compile(let.Value);
+    auto name = let.Name->Value();
+    if (!scope) {
+        return [value, name](const std::shared_ptr<Frame>& f) -> ObjectRef {
+            auto val = value(f);
+            if (Evaluator::isError(val)) return val;
+            f->Globals->Set(name, val);
+            return nullptr;
+        };
+    }
+
+    auto slot = scope->slots.at(name);
+    return [value, slot](const std::shared_ptr<Frame>& f) -> ObjectRef {
+        auto val = value(f);
+        if (Evaluator::isError(val)) return val;
+        f->Slots[slot] = std::move(val);
+        return nullptr;
+    };
+}
+
+CompiledCode ClosureCompiler::compilePrefix(const PrefixExpression& prefix) {
+    auto right = compile(prefix.Right);
+    auto op = prefix.Operator;
+    if (op == "!") {
+        return [right](const std::shared_ptr<Frame>& f) -> ObjectRef {
+            auto r = right(f);
+            if (Evaluator::isError(r)) return r;
+            return Evaluator::evalBangOperatorExpression(r);
+        };
+    } else if (op == "-") {
+        return [right](const std::shared_ptr<Frame>& f) -> ObjectRef {
+            auto r = right(f);
+            if (Evaluator::isError(r)) return r;
+            if (r->Type() == INTEGER_OBJ) {
+                int value = static_cast<Integer*>(r.get())->Value;
+                return MakeInteger(-value);
+            }
+            return Evaluator::evalMinusPrefixOperatorExpression(r);
+        };
+    }
+    return [right, op](const std::shared_ptr<Frame>& f) -> ObjectRef {
+        auto r = right(f);
+        if (Evaluator::isError(r)) return r;
+        return Evaluator::evalPrefixExpression(op, r);
+    };
+}
+
+CompiledCode ClosureCompiler::compileInfix(const InfixExpression& infix) {
+    auto left = compile(infix.Left);
+    auto right = compile(infix.Right);
+    const auto& op = infix.Operator;
+    using Result = ObjectRef;
+
+    if (op == "+") return ::infix(left, right, op, [](int a, int b) -> Result { return MakeInteger(a + b); });
+    if (op == "-") return ::infix(left, right, op, [](int a, int b) -> Result { return MakeInteger(a - b); });
+    if (op == "*") return ::infix(left, right, op, [](int a, int b) -> Result { return MakeInteger(a * b); });
+    if (op == "/") return ::infix(left, right, op, [](int a, int b) -> Result { return MakeInteger(a / b); });
+    if (op == "<") return ::infix(left, right, op, [](int a, int b) -> Result { return Evaluator::nativeBoolToBooleanObject(a < b); });
+    if (op == ">") return ::infix(left, right, op, [](int a, int b) -> Result { return Evaluator::nativeBoolToBooleanObject(a > b); });
+    if (op == "==") return ::infix(left, right, op, [](int a, int b) -> Result { return Evaluator::nativeBoolToBooleanObject(a == b); });
+    if (op == "!=") return ::infix(left, right, op, [](int a, int b) -> Result { return Evaluator::nativeBoolToBooleanObject(a != b); });
+
+    return [left, right, op](const std::shared_ptr<Frame>& f) -> ObjectRef {
+        auto l = left(f);
+        if (Evaluator::isError(l)) return l;
+        auto r = right(f);
+        if (Evaluator::isError(r)) return r;
+        return Evaluator::evalInfixExpression(op, l, r);
+    };
+}
+
+CompiledCode ClosureCompiler::compileFunction(const std::shared_ptr<FunctionLiteral>& literal) {
+    const auto& body = literal->GetBody();
+    if (!body || !literal->BodyErrors.empty()) {
+        // the body did not parse; Evaluator::applyFunction reports that
+        auto prototype = Evaluator::prototypeOf(*literal);
+        return [prototype](const std::shared_ptr<Frame>& f) -> ObjectRef {
+            return MakeRef<Function>(prototype, f->Globals);
+        };
+    }
+
+    Scope fnScope{{}, scope};
+    auto compiled = std::make_shared<CompiledPrototype>(literal);
+    for (const auto& param : literal->Parameters) {
+        auto it = fnScope.slots.emplace(param->Value(), fnScope.slots.size()).first;
+        compiled->ParamSlots.push_back(it->second);
+    }
+    declareLets(body, fnScope);
+
+    scope = &fnScope;
+    compiled->Code = compileBlock(body->Statements, false);
+    scope = fnScope.outer;
+    compiled->SlotCount = fnScope.slots.size();
+
+    std::shared_ptr<const CompiledPrototype> prototype = compiled;
+    return [prototype](const std::shared_ptr<Frame>& f) -> ObjectRef {
+        return MakeRef<CompiledFunction>(prototype, f);
+    };
+}
+
+CompiledCode ClosureCompiler::compileCall(const CallExpression& call) {
+    auto callee = compile(call.Function);
+    std::vector<CompiledCode> arguments;
+    for (const auto& arg : call.Arguments) arguments.push_back(compile(arg));
+
+    return [callee, arguments](const std::shared_ptr<Frame>& f) -> ObjectRef {
+        auto fn = callee(f);
+        if (Evaluator::isError(fn)) return fn;
+
+        ArgBuffer args(arguments.size());
+        for (std::size_t i = 0; i < arguments.size(); ++i) {
+            auto val = arguments[i](f);
+            if (Evaluator::isError(val)) return val;
+            args[i] = std::move(val);
+        }
+
+        if (auto compiled = dynamic_cast<CompiledFunction*>(fn.get())) {
+            const auto& body = compiled->Compiled();
+            auto frame = std::make_shared<Frame>(body.SlotCount, compiled->Captured, compiled->Captured->Globals);
+            for (std::size_t i = 0; i < body.ParamSlots.size() && i < arguments.size(); ++i) {
+                frame->Slots[body.ParamSlots[i]] = std::move(args[i]);
+            }
+            return unwrap(body.Code(frame));
+        }
+        return Evaluator::applyFunction(fn, args.Span());
+    };
+}
+
+bool CompiledFunction::Invoke(ArgSpan args, ObjectRef& result) const {
+    const auto& body = Compiled();
+    auto frame = std::make_shared<Frame>(body.SlotCount, Captured, Captured->Globals);
+    for (std::size_t i = 0; i < body.ParamSlots.size() && i < args.size(); ++i) {
+        frame->Slots[body.ParamSlots[i]] = args[i];
+    }
+    result = unwrap(body.Code(frame));
+    return true;
+}
+
+void CompiledFunction::TraceCaptured(Tracer& tracer) const {
+    for (const Frame* frame = Captured.get(); frame; frame = frame->Outer.get()) {
+        for (const auto& slot : frame->Slots) tracer.Visit(slot);
+    }
+}
+
+// Keys and values are evaluated in the order Evaluator::evalHashLiteral
+// visits them, and, as there, a value that is an error is stored as is.
+CompiledCode ClosureCompiler::compileHash(const HashLiteral& hash) {
+    std::vector<std::pair<CompiledCode, CompiledCode>> pairs;
+    for (const auto& pair : hash.Pairs) {
+        auto key = compile(pair.first);
+        pairs.emplace_back(key, compile(pair.second));
+    }
+
+    return [pairs](const std::shared_ptr<Frame>& f) -> ObjectRef {
+        std::map<HashKey, HashPair> result;
+        for (const auto& pair : pairs) {
+            auto key = pair.first(f);
+            if (Evaluator::isError(key)) return key;
+            if (!IsHashable(key->Type())) return Evaluator::newError(ErrorCode::UNUSABLE_HASH_KEY, ObjectTypeToString(key->Type()));
+            result[key->keyHash()] = HashPair{key, pair.second(f)};
+        }
+        return MakeRef<Hash>(result);
+    };
+}
+
+// Gives a slot to every name a `let` in this function binds, wherever the
+// `let` is, so that closures made before it runs can still find it. Nested
+// function literals are skipped: they get their own scope.
+void ClosureCompiler::declareLets(const std::shared_ptr<Node>& node, Scope& scope) {
+    auto declare = [&](const std::shared_ptr<Node>& child) { declareLets(child, scope); };
+
+    if (auto n = std::dynamic_pointer_cast<BlockStatement>(node)) {
+        for (const auto& stmt : n->Statements) declare(stmt);
+    } else if (auto n = std::dynamic_pointer_cast<ExpressionStatement>(node)) {
+        declare(n->expr);
+    } else if (auto n = std::dynamic_pointer_cast<LetStatement>(node)) {
+        scope.slots.emplace(n->Name->Value(), scope.slots.size());
+        declare(n->Value);
+    } else if (auto n = std::dynamic_pointer_cast<ReturnStatement>(node)) {
+        declare(n->ReturnValue);
+    } else if (auto n = std::dynamic_pointer_cast<PrefixExpression>(node)) {
+        declare(n->Right);
+    } else if (auto n = std::dynamic_pointer_cast<InfixExpression>(node)) {
+        declare(n->Left);
+        declare(n->Right);
+    } else if (auto n = std::dynamic_pointer_cast<IfExpression>(node)) {
+        declare(n->Condition);
+        declare(n->Consequence);
+        declare(n->Alternative);
+    } else if (auto n = std::dynamic_pointer_cast<CallExpression>(node)) {
+        declare(n->Function);
+        for (const auto& arg : n->Arguments) declare(arg);
+    } else if (auto n = std::dynamic_pointer_cast<ArrayLiteral>(node)) {
+        for (const auto& elem : n->Elements) declare(elem);
+    } else if (auto n = std::dynamic_pointer_cast<IndexExpression>(node)) {
+        declare(n->Left);
+        declare(n->Index);
+    } else if (auto n = std::dynamic_pointer_cast<HashLiteral>(node)) {
+        for (const auto& pair : n->Pairs) {
+            declare(pair.first);
+            declare(pair.second);
+        }
+    }
+}
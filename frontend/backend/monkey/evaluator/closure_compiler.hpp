@@ -0,0 +1,86 @@
+// closure_compiler.hpp
+#ifndef CLOSURE_COMPILER_H
+#define CLOSURE_COMPILER_H
+
+#include "evaluator.hpp"
+#include <functional>
+#include <unordered_map>
+
+// The closure compiler turns every AST node into a C++ closure once, with
+// operators picked, variables resolved to frame slots and constants built
+// ahead of time. Running the result calls straight from closure to closure
+// without looking at the AST again.
+
+// Locals of one function call. Parameters and every name a `let` in the
+// function body (outside nested functions) binds get a slot, decided when
+// the function is compiled. The top-level frame has no slots: top-level
+// names live in the Environment the program runs in.
+struct Frame {
+    std::vector<ObjectRef> Slots;
+    std::shared_ptr<Frame> Outer;
+    std::shared_ptr<Environment> Globals;
+
+    Frame(std::size_t slots, std::shared_ptr<Frame> outer, std::shared_ptr<Environment> globals)
+        : Slots(slots), Outer(std::move(outer)), Globals(std::move(globals)) {}
+};
+
+using CompiledCode = std::function<ObjectRef(const std::shared_ptr<Frame>&)>;
+
+// A function literal's prototype with its slot layout and compiled body,
+// built once per compiled literal and shared by every closure made from it
+class CompiledPrototype : public FunctionPrototype {
+public:
+    std::shared_ptr<const FunctionLiteral> Owner; // keeps Literal alive
+    CompiledCode Code;
+    std::vector<uint32_t> ParamSlots;
+    std::size_t SlotCount = 0;
+
+    explicit CompiledPrototype(std::shared_ptr<const FunctionLiteral> literal)
+        : FunctionPrototype(*literal), Owner(std::move(literal)) {}
+};
+
+// A function value made by compiled code. Every call runs its body in a
+// new frame on top of Captured, including calls from the evaluator and from
+// builtins, which come through Invoke.
+class CompiledFunction : public Function {
+public:
+    std::shared_ptr<Frame> Captured;
+
+    CompiledFunction(std::shared_ptr<const CompiledPrototype> prototype, std::shared_ptr<Frame> captured)
+        : Function(std::move(prototype), captured->Globals), Captured(std::move(captured)) {}
+
+    const CompiledPrototype& Compiled() const { return static_cast<const CompiledPrototype&>(*Prototype); }
+    bool Invoke(ArgSpan args, ObjectRef& result) const override;
+    // the slots of Captured and the frames around it
+    void TraceCaptured(Tracer& tracer) const override;
+};
+
+class ClosureCompiler {
+public:
+    // Compiles a program; the result can run any number of times, in any
+    // environment. Results are the same as Evaluator::Eval's.
+    static CompiledCode Compile(const Program& program);
+    static ObjectRef Run(const CompiledCode& code, std::shared_ptr<Environment> env);
+    static ObjectRef Eval(const Program& program, std::shared_ptr<Environment> env);
+
+private:
+    // names with a slot in one function being compiled
+    struct Scope {
+        std::unordered_map<std::string, uint32_t> slots;
+        Scope* outer;
+    };
+    Scope* scope = nullptr; // null at the top level
+
+    CompiledCode compile(const std::shared_ptr<Node>& node);
+    CompiledCode compileBlock(const std::vector<std::shared_ptr<Statement>>& statements, bool program);
+    CompiledCode compileIdentifier(const std::string& name);
+    CompiledCode compileLet(const LetStatement& let);
+    CompiledCode compilePrefix(const PrefixExpression& prefix);
+    CompiledCode compileInfix(const InfixExpression& infix);
+    CompiledCode compileFunction(const std::shared_ptr<FunctionLiteral>& literal);
+    CompiledCode compileCall(const CallExpression& call);
+    CompiledCode compileHash(const HashLiteral& hash);
+    static void declareLets(const std::shared_ptr<Node>& node, Scope& scope);
+};
+
+#endif // CLOSURE_COMPILER_H
@@ -1,208 +1,731 @@
 #include "evaluator.hpp"
+#include "../util/int_kernels.hpp"
+#include "../util/pdqsort.hpp"
+#include "../util/thread_pool.hpp"
+#include <algorithm>
+#include <unordered_set>
 
 //evaluator.cpp
 
-std::shared_ptr<NullObject> ObjectConstants::NULL_OBJ = std::make_shared<NullObject>();
-std::shared_ptr<BooleanObject> ObjectConstants::TRUE = std::make_shared<BooleanObject>(true);
-std::shared_ptr<BooleanObject> ObjectConstants::FALSE = std::make_shared<BooleanObject>(false);
+Ref<NullObject> ObjectConstants::NULL_OBJ = MakeImmortal<NullObject>();
+Ref<BooleanObject> ObjectConstants::TRUE = MakeBoolean(true);
+Ref<BooleanObject> ObjectConstants::FALSE = MakeBoolean(false);
 
-std::map<std::string, std::shared_ptr<Builtin>> builtins = {
-    {"len", std::make_shared<Builtin>([](const std::vector<std::shared_ptr<Object>>& args) -> std::shared_ptr<Object> {
+namespace {
+
+// The values of an array of integers, or nullptr for anything else; an
+// empty array counts whatever its kind
+const std::vector<int64_t>* intsOf(const ObjectRef& arg) {
+    static const std::vector<int64_t> none;
+    if (arg->Type() != ARRAY_OBJ) return nullptr;
+    auto array = static_cast<const ArrayObject*>(arg.get());
+    if (array->Kind() == ElementsKind::PACKED_INT) return &array->Ints();
+    return array->Empty() ? &none : nullptr;
+}
+
+ObjectRef notIntArray(const char* name, const ObjectRef& arg) {
+    return Evaluator::newError(ErrorCode::ARGUMENT_NOT_INTEGER_ARRAY, name, ObjectTypeToString(arg->Type()));
+}
+
+// the most elements range builds, 2 GB of them; past that it returns an
+// error instead of failing to allocate
+constexpr uint64_t MAX_RANGE_LENGTH = uint64_t(1) << 28;
+
+// sum, min and max: one array of integers in, one integer out
+template <typename Reduce>
+ObjectRef reduceInts(const char* name, ArgSpan args, Reduce reduce) {
+    if (args.size() != 1) {
+        return Evaluator::newError(ErrorCode::WRONG_ARGUMENT_COUNT, std::to_string(args.size()), "1");
+    }
+    auto values = intsOf(args[0]);
+    if (!values) return notIntArray(name, args[0]);
+    return reduce(*values);
+}
+
+// add and mul: two arrays of integers of the same length, combined
+// element by element into a new one
+ObjectRef combineInts(const char* name, ArgSpan args,
+                      bool (*kernel)(const int64_t*, const int64_t*, int64_t*, std::size_t)) {
+    if (args.size() != 2) {
+        return Evaluator::newError(ErrorCode::WRONG_ARGUMENT_COUNT, std::to_string(args.size()), "2");
+    }
+    auto a = intsOf(args[0]);
+    if (!a) return notIntArray(name, args[0]);
+    auto b = intsOf(args[1]);
+    if (!b) return notIntArray(name, args[1]);
+    if (a->size() != b->size()) {
+        return Evaluator::newError(ErrorCode::LENGTH_MISMATCH, name, std::to_string(a->size()), std::to_string(b->size()));
+    }
+    std::vector<int64_t> out(a->size());
+    if (!kernel(a->data(), b->data(), out.data(), out.size())) {
+        return Evaluator::newError(ErrorCode::INTEGER_OVERFLOW, name);
+    }
+    return MakeYoung<ArrayObject>(std::move(out));
+}
+
+// map, filter and each: calls fn(x) on every element x of an array in
+// turn, stopping at the first error, and hands each result to `keep`. The
+// output vector comes from `make`, given the array's size, and becomes an
+// array, packed if it can be.
+template <typename Make, typename Keep>
+ObjectRef eachElement(const char* name, ArgSpan args, Make make, Keep keep) {
+    if (args.size() != 2) {
+        return Evaluator::newError(ErrorCode::WRONG_ARGUMENT_COUNT, std::to_string(args.size()), "2");
+    }
+    if (args[0]->Type() != ARRAY_OBJ) {
+        return Evaluator::newError(ErrorCode::ARGUMENT_NOT_ARRAY, name, ObjectTypeToString(args[0]->Type()));
+    }
+    auto arr = static_cast<const ArrayObject*>(args[0].get());
+    FunctionCaller caller(args[1], 1);
+    if (auto error = caller.Check(name)) return error;
+
+    std::vector<ObjectRef> out = make(arr->Size());
+    ObjectRef element;
+    for (std::size_t i = 0; i < arr->Size(); ++i) {
+        element = arr->At(i);
+        auto result = caller.Call(ArgSpan(&element, 1));
+        if (Evaluator::isError(result)) return result;
+        keep(out, i, element, std::move(result));
+    }
+    return MakeYoung<ArrayObject>(std::move(out));
+}
+
+// pmap and preduce hand out chunks of at least this many elements
+constexpr std::size_t PARALLEL_CHUNK = 256;
+
+bool isPure(const ObjectRef& fn, const ObjectRef& arr);
+
+// How many chunks pmap and preduce split `size` elements into; 1 runs
+// them here, in order. Impure callbacks stay on this thread, and so do
+// runs in a Region, whose objects other threads must not allocate.
+std::size_t parallelChunks(std::size_t size, const ObjectRef& fn, const ObjectRef& arr) {
+    if (size / PARALLEL_CHUNK <= 1 || Region::Current() || !isPure(fn, arr)) return 1;
+    std::size_t chunks = std::min<std::size_t>(size / PARALLEL_CHUNK, ThreadPool::Shared().Size() * 4);
+    if (chunks <= 1) return 1;
+    // from here on other threads copy references to both
+    fn->Share();
+    arr->Share();
+    return chunks;
+}
+
+// Runs body(chunk, begin, end) over `chunks` slices of [0, size) across
+// the shared pool. A body returns an Error to stop; the error of the
+// lowest chunk wins, as the first one would in a sequential loop, and
+// chunks after it give up early.
+template <typename Body>
+ObjectRef forChunks(std::size_t size, std::size_t chunks, Body body) {
+    if (chunks == 1) return body(0, 0, size);
+    std::vector<ObjectRef> errors(chunks);
+    std::atomic<std::size_t> failed{chunks};
+    ThreadPool::Shared().ParallelFor(chunks, [&](std::size_t c) {
+        if (failed.load(std::memory_order_relaxed) < c) return;
+        auto error = body(c, size * c / chunks, size * (c + 1) / chunks);
+        if (!error) return;
+        errors[c] = std::move(error);
+        std::size_t lowest = failed.load(std::memory_order_relaxed);
+        while (c < lowest && !failed.compare_exchange_weak(lowest, c, std::memory_order_relaxed)) {}
+    });
+    for (auto& error : errors) {
+        if (error) return error;
+    }
+    return nullptr;
+}
+
+// sort without a comparator: integers ascending, by radix sort, or
+// strings in byte order
+ObjectRef sortNatural(const ArrayObject* arr) {
+    if (arr->Kind() == ElementsKind::PACKED_INT) {
+        std::vector<int64_t> values = arr->Ints();
+        IntKernels::Sort(values.data(), values.size());
+        return MakeYoung<ArrayObject>(std::move(values));
+    }
+    std::vector<ObjectRef> elements = arr->Elements();
+    if (elements.empty()) return MakeYoung<ArrayObject>(std::move(elements));
+    ObjectType type = elements[0]->Type();
+    for (const auto& element : elements) {
+        if (element->Type() != type || (type != INTEGER_OBJ && type != STRING_OBJ)) {
+            std::string got = "ARRAY of " + ObjectTypeToString(type);
+            if (element->Type() != type) got += " and " + ObjectTypeToString(element->Type());
+            return Evaluator::newError(ErrorCode::ARGUMENT_NOT_SUPPORTED, "sort", got);
+        }
+    }
+    // integers left unpacked by a slice of a mixed array
+    if (type == INTEGER_OBJ) {
+        std::vector<int64_t> values(elements.size());
+        for (std::size_t i = 0; i < values.size(); ++i) values[i] = static_cast<const Integer*>(elements[i].get())->Value;
+        IntKernels::Sort(values.data(), values.size());
+        return MakeYoung<ArrayObject>(std::move(values));
+    }
+    PdqSort(elements.begin(), elements.end(), [](const ObjectRef& a, const ObjectRef& b) {
+        return static_cast<const String*>(a.get())->Value < static_cast<const String*>(b.get())->Value;
+    });
+    return MakeYoung<ArrayObject>(std::move(elements));
+}
+
+} // namespace
+
+std::map<std::string, Ref<Builtin>> builtins = {
+    {"len", MakeImmortal<Builtin>([](ArgSpan args) -> ObjectRef {
         if (args.size() != 1) {
-            return Evaluator::newError("wrong number of arguments. got=%zu, want=1", args.size());
+            return Evaluator::newError(ErrorCode::WRONG_ARGUMENT_COUNT, std::to_string(args.size()), "1");
         }
 
         auto argType = args[0]->Type();
         if (argType == ARRAY_OBJ) {
-            auto arrayObj = std::dynamic_pointer_cast<ArrayObject>(args[0]);
-            return std::make_shared<Integer>(arrayObj->Elements.size());
+            auto arrayObj = DynamicRefCast<ArrayObject>(args[0]);
+            return MakeInteger(arrayObj->Size());
         } else if (argType == STRING_OBJ) {
-            auto stringObj = std::dynamic_pointer_cast<String>(args[0]);
-            return std::make_shared<Integer>(stringObj->Value.size());
+            auto stringObj = DynamicRefCast<String>(args[0]);
+            return MakeInteger(stringObj->Value.size());
         } else {
-            return Evaluator::newError("argument to `len` not supported, got %s", ObjectTypeToString(argType).c_str());
+            return Evaluator::newError(ErrorCode::ARGUMENT_NOT_SUPPORTED, "len", ObjectTypeToString(argType));
         }
     })},
-    {"puts", std::make_shared<Builtin>([](const std::vector<std::shared_ptr<Object>>& args) -> std::shared_ptr<Object> {
+    {"puts", MakeImmortal<Builtin>([](ArgSpan args) -> ObjectRef {
         for (auto& arg : args) {
             std::cout << arg->Inspect() << std::endl;
         }
         return ObjectConstants::NULL_OBJ;
     })},
 
-    {"first", std::make_shared<Builtin>([](const std::vector<std::shared_ptr<Object>>& args) -> std::shared_ptr<Object> {
+    {"first", MakeImmortal<Builtin>([](ArgSpan args) -> ObjectRef {
         if (args.size() != 1) {
-            return Evaluator::newError("wrong number of arguments. got=" + std::to_string(args.size()) + ", want=1");
+            return Evaluator::newError(ErrorCode::WRONG_ARGUMENT_COUNT, std::to_string(args.size()), "1");
         }
         if (args[0]->Type() != ARRAY_OBJ) {
-            return Evaluator::newError("argument to `first` must be ARRAY, got " + ObjectTypeToString(args[0]->Type()));
+            return Evaluator::newError(ErrorCode::ARGUMENT_NOT_ARRAY, "first", ObjectTypeToString(args[0]->Type()));
         }
-        auto arr = std::dynamic_pointer_cast<ArrayObject>(args[0]);
-        if (!arr->Elements.empty()) {
-            return arr->Elements.front();
+        auto arr = DynamicRefCast<ArrayObject>(args[0]);
+        if (!arr->Empty()) {
+            return arr->At(0);
         }
         return ObjectConstants::NULL_OBJ;
     })},
 
-    {"last", std::make_shared<Builtin>([](const std::vector<std::shared_ptr<Object>>& args) -> std::shared_ptr<Object> {
+    {"last", MakeImmortal<Builtin>([](ArgSpan args) -> ObjectRef {
         if (args.size() != 1) {
-            return Evaluator::newError("wrong number of arguments. got=" + std::to_string(args.size()) + ", want=1");
+            return Evaluator::newError(ErrorCode::WRONG_ARGUMENT_COUNT, std::to_string(args.size()), "1");
         }
         if (args[0]->Type() != ARRAY_OBJ) {
-            return Evaluator::newError("argument to `last` must be ARRAY, got " + ObjectTypeToString(args[0]->Type()));
+            return Evaluator::newError(ErrorCode::ARGUMENT_NOT_ARRAY, "last", ObjectTypeToString(args[0]->Type()));
         }
-        auto arr = std::dynamic_pointer_cast<ArrayObject>(args[0]);
-        if (!arr->Elements.empty()) {
-            return arr->Elements.back();
+        auto arr = DynamicRefCast<ArrayObject>(args[0]);
+        if (!arr->Empty()) {
+            return arr->At(arr->Size() - 1);
         }
         return ObjectConstants::NULL_OBJ;
     })},
 
-    {"rest", std::make_shared<Builtin>([](const std::vector<std::shared_ptr<Object>>& args) -> std::shared_ptr<Object> {
+    {"rest", MakeImmortal<Builtin>([](ArgSpan args) -> ObjectRef {
         if (args.size() != 1) {
-            return Evaluator::newError("wrong number of arguments. got=" + std::to_string(args.size()) + ", want=1");
+            return Evaluator::newError(ErrorCode::WRONG_ARGUMENT_COUNT, std::to_string(args.size()), "1");
         }
         if (args[0]->Type() != ARRAY_OBJ) {
-            return Evaluator::newError("argument to `rest` must be ARRAY, got " + ObjectTypeToString(args[0]->Type()));
+            return Evaluator::newError(ErrorCode::ARGUMENT_NOT_ARRAY, "rest", ObjectTypeToString(args[0]->Type()));
         }
-        auto arr = std::dynamic_pointer_cast<ArrayObject>(args[0]);
-        if (arr->Elements.size() > 1) {
-            std::vector<std::shared_ptr<Object>> newElements(arr->Elements.begin() + 1, arr->Elements.end());
-            return std::make_shared<ArrayObject>(newElements);
+        auto arr = DynamicRefCast<ArrayObject>(args[0]);
+        if (arr->Size() > 1) {
+            return arr->Slice(1);
         }
         return ObjectConstants::NULL_OBJ;
     })},
 
-    {"push", std::make_shared<Builtin>([](const std::vector<std::shared_ptr<Object>>& args) -> std::shared_ptr<Object> {
+    {"push", MakeImmortal<Builtin>([](ArgSpan args) -> ObjectRef {
+        if (args.size() != 2) {
+            return Evaluator::newError(ErrorCode::WRONG_ARGUMENT_COUNT, std::to_string(args.size()), "2");
+        }
+        if (args[0]->Type() != ARRAY_OBJ) {
+            return Evaluator::newError(ErrorCode::ARGUMENT_NOT_ARRAY, "push", ObjectTypeToString(args[0]->Type()));
+        }
+        auto arr = DynamicRefCast<ArrayObject>(args[0]);
+        auto pushed = arr->Slice(0, 1);
+        pushed->Push(args[1]);
+        return pushed;
+    })},
+
+    {"sum", MakeImmortal<Builtin>([](ArgSpan args) -> ObjectRef {
+        return reduceInts("sum", args, [](const std::vector<int64_t>& values) -> ObjectRef {
+            int64_t sum;
+            if (!IntKernels::Sum(values.data(), values.size(), sum)) {
+                return Evaluator::newError(ErrorCode::INTEGER_OVERFLOW, "sum");
+            }
+            return MakeInteger(sum);
+        });
+    })},
+
+    {"min", MakeImmortal<Builtin>([](ArgSpan args) -> ObjectRef {
+        return reduceInts("min", args, [](const std::vector<int64_t>& values) -> ObjectRef {
+            if (values.empty()) return ObjectConstants::NULL_OBJ;
+            return MakeInteger(IntKernels::Min(values.data(), values.size()));
+        });
+    })},
+
+    {"max", MakeImmortal<Builtin>([](ArgSpan args) -> ObjectRef {
+        return reduceInts("max", args, [](const std::vector<int64_t>& values) -> ObjectRef {
+            if (values.empty()) return ObjectConstants::NULL_OBJ;
+            return MakeInteger(IntKernels::Max(values.data(), values.size()));
+        });
+    })},
+
+    {"dot", MakeImmortal<Builtin>([](ArgSpan args) -> ObjectRef {
         if (args.size() != 2) {
-            return Evaluator::newError("wrong number of arguments. got=" + std::to_string(args.size()) + ", want=2");
+            return Evaluator::newError(ErrorCode::WRONG_ARGUMENT_COUNT, std::to_string(args.size()), "2");
+        }
+        auto a = intsOf(args[0]);
+        if (!a) return notIntArray("dot", args[0]);
+        auto b = intsOf(args[1]);
+        if (!b) return notIntArray("dot", args[1]);
+        if (a->size() != b->size()) {
+            return Evaluator::newError(ErrorCode::LENGTH_MISMATCH, "dot", std::to_string(a->size()), std::to_string(b->size()));
+        }
+        int64_t dot;
+        if (!IntKernels::Dot(a->data(), b->data(), a->size(), dot)) {
+            return Evaluator::newError(ErrorCode::INTEGER_OVERFLOW, "dot");
+        }
+        return MakeInteger(dot);
+    })},
+
+    {"add", MakeImmortal<Builtin>([](ArgSpan args) -> ObjectRef {
+        return combineInts("add", args, IntKernels::Add);
+    })},
+
+    {"mul", MakeImmortal<Builtin>([](ArgSpan args) -> ObjectRef {
+        return combineInts("mul", args, IntKernels::Mul);
+    })},
+
+    {"scale", MakeImmortal<Builtin>([](ArgSpan args) -> ObjectRef {
+        if (args.size() != 2) {
+            return Evaluator::newError(ErrorCode::WRONG_ARGUMENT_COUNT, std::to_string(args.size()), "2");
+        }
+        auto values = intsOf(args[0]);
+        if (!values) return notIntArray("scale", args[0]);
+        if (args[1]->Type() != INTEGER_OBJ) {
+            return Evaluator::newError(ErrorCode::ARGUMENT_NOT_SUPPORTED, "scale", ObjectTypeToString(args[1]->Type()));
+        }
+        int64_t k = static_cast<const Integer*>(args[1].get())->Value;
+        std::vector<int64_t> out(values->size());
+        if (!IntKernels::Scale(values->data(), k, out.data(), out.size())) {
+            return Evaluator::newError(ErrorCode::INTEGER_OVERFLOW, "scale");
+        }
+        return MakeYoung<ArrayObject>(std::move(out));
+    })},
+
+    {"map", MakeImmortal<Builtin>([](ArgSpan args) -> ObjectRef {
+        return eachElement("map", args, [](std::size_t size) { return std::vector<ObjectRef>(size); },
+                           [](std::vector<ObjectRef>& out, std::size_t i, const ObjectRef&, ObjectRef result) {
+                               out[i] = std::move(result);
+                           });
+    })},
+
+    {"filter", MakeImmortal<Builtin>([](ArgSpan args) -> ObjectRef {
+        return eachElement("filter", args, [](std::size_t) { return std::vector<ObjectRef>(); },
+                           [](std::vector<ObjectRef>& out, std::size_t, const ObjectRef& element, ObjectRef result) {
+                               if (Evaluator::isTruthy(result)) out.push_back(element);
+                           });
+    })},
+
+    {"each", MakeImmortal<Builtin>([](ArgSpan args) -> ObjectRef {
+        auto done = eachElement("each", args, [](std::size_t) { return std::vector<ObjectRef>(); },
+                                [](std::vector<ObjectRef>&, std::size_t, const ObjectRef&, ObjectRef) {});
+        return Evaluator::isError(done) ? done : ObjectConstants::NULL_OBJ;
+    })},
+
+    // reduce(arr, fn(acc, x), init); without init the first element starts
+    {"reduce", MakeImmortal<Builtin>([](ArgSpan args) -> ObjectRef {
+        if (args.size() != 2 && args.size() != 3) {
+            return Evaluator::newError(ErrorCode::WRONG_ARGUMENT_COUNT, std::to_string(args.size()), "2 or 3");
+        }
+        if (args[0]->Type() != ARRAY_OBJ) {
+            return Evaluator::newError(ErrorCode::ARGUMENT_NOT_ARRAY, "reduce", ObjectTypeToString(args[0]->Type()));
+        }
+        auto arr = static_cast<const ArrayObject*>(args[0].get());
+        FunctionCaller caller(args[1], 2);
+        if (auto error = caller.Check("reduce")) return error;
+
+        std::size_t i = 0;
+        ObjectRef pair[2];
+        if (args.size() == 3) {
+            pair[0] = args[2];
+        } else if (arr->Empty()) {
+            return ObjectConstants::NULL_OBJ;
+        } else {
+            pair[0] = arr->At(i++);
+        }
+        for (; i < arr->Size(); ++i) {
+            pair[1] = arr->At(i);
+            pair[0] = caller.Call(ArgSpan(pair, 2));
+            if (Evaluator::isError(pair[0])) break;
+        }
+        return pair[0];
+    })},
+
+    // map, with chunks of the array on several threads when fn is pure
+    {"pmap", MakeImmortal<Builtin>([](ArgSpan args) -> ObjectRef {
+        if (args.size() != 2) {
+            return Evaluator::newError(ErrorCode::WRONG_ARGUMENT_COUNT, std::to_string(args.size()), "2");
+        }
+        if (args[0]->Type() != ARRAY_OBJ) {
+            return Evaluator::newError(ErrorCode::ARGUMENT_NOT_ARRAY, "pmap", ObjectTypeToString(args[0]->Type()));
+        }
+        if (auto error = FunctionCaller(args[1], 1).Check("pmap")) return error;
+        auto arr = static_cast<const ArrayObject*>(args[0].get());
+
+        std::vector<ObjectRef> out(arr->Size());
+        auto error = forChunks(out.size(), parallelChunks(out.size(), args[1], args[0]),
+                               [&](std::size_t, std::size_t begin, std::size_t end) -> ObjectRef {
+            FunctionCaller caller(args[1], 1);
+            ObjectRef element;
+            for (std::size_t i = begin; i < end; ++i) {
+                element = arr->At(i);
+                auto result = caller.Call(ArgSpan(&element, 1));
+                if (Evaluator::isError(result)) return result;
+                out[i] = std::move(result);
+            }
+            return nullptr;
+        });
+        if (error) return error;
+        return MakeYoung<ArrayObject>(std::move(out));
+    })},
+
+    // reduce, with fn(acc, x) folding each chunk of the array on its own
+    // thread, then the chunks' results into init in order; so fn has to be
+    // associative for the result to match reduce's
+    {"preduce", MakeImmortal<Builtin>([](ArgSpan args) -> ObjectRef {
+        if (args.size() != 2 && args.size() != 3) {
+            return Evaluator::newError(ErrorCode::WRONG_ARGUMENT_COUNT, std::to_string(args.size()), "2 or 3");
+        }
+        if (args[0]->Type() != ARRAY_OBJ) {
+            return Evaluator::newError(ErrorCode::ARGUMENT_NOT_ARRAY, "preduce", ObjectTypeToString(args[0]->Type()));
+        }
+        FunctionCaller caller(args[1], 2);
+        if (auto error = caller.Check("preduce")) return error;
+        auto arr = static_cast<const ArrayObject*>(args[0].get());
+
+        std::size_t chunks = parallelChunks(arr->Size(), args[1], args[0]);
+        std::vector<ObjectRef> partials(chunks);
+        auto error = forChunks(arr->Size(), chunks, [&](std::size_t c, std::size_t begin, std::size_t end) -> ObjectRef {
+            if (begin == end) return nullptr;
+            FunctionCaller chunkCaller(args[1], 2);
+            ObjectRef pair[2] = {arr->At(begin)};
+            for (std::size_t i = begin + 1; i < end; ++i) {
+                pair[1] = arr->At(i);
+                pair[0] = chunkCaller.Call(ArgSpan(pair, 2));
+                if (Evaluator::isError(pair[0])) return pair[0];
+            }
+            partials[c] = std::move(pair[0]);
+            return nullptr;
+        });
+        if (error) return error;
+
+        ObjectRef pair[2];
+        if (args.size() == 3) pair[0] = args[2];
+        for (auto& partial : partials) {
+            if (!partial) continue;
+            if (!pair[0]) {
+                pair[0] = std::move(partial);
+                continue;
+            }
+            pair[1] = std::move(partial);
+            pair[0] = caller.Call(ArgSpan(pair, 2));
+            if (Evaluator::isError(pair[0])) break;
+        }
+        return pair[0] ? pair[0] : ObjectConstants::NULL_OBJ;
+    })},
+
+    // range(end), range(start, end) or range(start, end, step), end excluded
+    {"range", MakeImmortal<Builtin>([](ArgSpan args) -> ObjectRef {
+        if (args.size() < 1 || args.size() > 3) {
+            return Evaluator::newError(ErrorCode::WRONG_ARGUMENT_COUNT, std::to_string(args.size()), "1 to 3");
+        }
+        int64_t bounds[3] = {0, 0, 1};
+        for (std::size_t i = 0; i < args.size(); ++i) {
+            if (args[i]->Type() != INTEGER_OBJ) {
+                return Evaluator::newError(ErrorCode::ARGUMENT_NOT_SUPPORTED, "range", ObjectTypeToString(args[i]->Type()));
+            }
+            bounds[args.size() == 1 ? 1 : i] = static_cast<const Integer*>(args[i].get())->Value;
+        }
+        int64_t start = bounds[0], end = bounds[1], step = bounds[2];
+        if (step == 0) return Evaluator::newError(ErrorCode::ARGUMENT_NOT_SUPPORTED, "range", "step 0");
+
+        // in unsigned arithmetic, where the distance and the products wrap
+        // into the right values instead of overflowing
+        uint64_t count = 0;
+        if (step > 0 && end > start) {
+            count = (uint64_t(end) - uint64_t(start) - 1) / uint64_t(step) + 1;
+        } else if (step < 0 && start > end) {
+            count = (uint64_t(start) - uint64_t(end) - 1) / (0 - uint64_t(step)) + 1;
+        }
+        if (count > MAX_RANGE_LENGTH) {
+            return Evaluator::newError(ErrorCode::ARGUMENT_NOT_SUPPORTED, "range", "length " + std::to_string(count));
+        }
+        std::vector<int64_t> values(count);
+        for (uint64_t i = 0; i < count; ++i) {
+            values[i] = static_cast<int64_t>(uint64_t(start) + i * uint64_t(step));
+        }
+        return MakeYoung<ArrayObject>(std::move(values));
+    })},
+
+    // sort(arr) orders integers or strings ascending; sort(arr, less)
+    // orders anything by less(a, b), true when a goes before b. The sort
+    // is not stable. The first error less returns ends it and is returned.
+    {"sort", MakeImmortal<Builtin>([](ArgSpan args) -> ObjectRef {
+        if (args.size() != 1 && args.size() != 2) {
+            return Evaluator::newError(ErrorCode::WRONG_ARGUMENT_COUNT, std::to_string(args.size()), "1 or 2");
         }
         if (args[0]->Type() != ARRAY_OBJ) {
-            return Evaluator::newError("argument to `push` must be ARRAY, got " + ObjectTypeToString(args[0]->Type()));
+            return Evaluator::newError(ErrorCode::ARGUMENT_NOT_ARRAY, "sort", ObjectTypeToString(args[0]->Type()));
         }
-        auto arr = std::dynamic_pointer_cast<ArrayObject>(args[0]);
-        auto newElements = arr->Elements;
-        newElements.push_back(args[1]);
-        return std::make_shared<ArrayObject>(newElements);
+        auto arr = static_cast<const ArrayObject*>(args[0].get());
+        if (args.size() == 1) return sortNatural(arr);
+
+        FunctionCaller caller(args[1], 2);
+        if (auto error = caller.Check("sort")) return error;
+        std::vector<ObjectRef> elements = arr->Elements();
+        ObjectRef pair[2];
+        ObjectRef error;
+        PdqSort(elements.begin(), elements.end(), [&](const ObjectRef& a, const ObjectRef& b) {
+            if (error) return false;
+            pair[0] = a;
+            pair[1] = b;
+            auto result = caller.Call(ArgSpan(pair, 2));
+            if (Evaluator::isError(result)) {
+                error = std::move(result);
+                return false;
+            }
+            return Evaluator::isTruthy(result);
+        });
+        if (error) return error;
+        return MakeYoung<ArrayObject>(std::move(elements));
     })}
 };
 
-std::shared_ptr<Object> Evaluator::Eval(std::shared_ptr<Node> node, std::shared_ptr<Environment> env) {
+namespace {
+
+// Builtins with an effect besides their result
+const char* const IMPURE_BUILTINS[] = {"puts"};
+
+// Walks everything a callback and its array reach, environments
+// included, as Share() would, looking for an impure builtin: one held as
+// a value, or named by a function that does not bind the name itself.
+// Monkey has no assignment, so whatever the callback can see stays as it
+// is while the threads run.
+class PurityCheck : public Tracer {
+public:
+    bool Pure = true;
+
+    void Visit(const ObjectRef& ref) override {
+        if (!Pure || !ref || (ref->IsImmortal() && ref->Type() != BUILTIN_OBJ) || !seen.insert(ref.get()).second) return;
+        if (auto builtin = dynamic_cast<const Builtin*>(ref.get())) {
+            for (auto name : IMPURE_BUILTINS) Pure = Pure && builtins.at(name).get() != builtin;
+            return;
+        }
+        if (auto function = dynamic_cast<const Function*>(ref.get())) {
+            const auto& names = function->Prototype->FreeNames();
+            for (auto name : IMPURE_BUILTINS) {
+                if (std::binary_search(names.begin(), names.end(), name) && !function->Env->Get(name)) Pure = false;
+            }
+            function->TraceCaptured(*this);
+        }
+        ref->Trace(*this);
+    }
+    void Visit(const std::shared_ptr<Environment>& ref) override {
+        if (!Pure || !ref || !seen.insert(ref.get()).second) return;
+        for (const auto& binding : ref->store) Visit(binding.second);
+        Visit(ref->outer);
+    }
+
+private:
+    std::unordered_set<const void*> seen;
+};
+
+bool isPure(const ObjectRef& fn, const ObjectRef& arr) {
+    PurityCheck check;
+    check.Visit(fn);
+    check.Visit(arr);
+    return check.Pure;
+}
+
+// The per-thread stack behind ArgBuffers with more than INLINE values.
+// Runs are taken and given back in LIFO order; a run that does not fit in
+// the current chunk starts the next one, and chunks are kept for reuse.
+class ArgStack {
+public:
+    ObjectRef* Take(std::size_t count) {
+        while (current < chunks.size() && chunks[current].size - chunks[current].used < count) {
+            ++current;
+        }
+        if (current == chunks.size()) {
+            // the chunks outlive any region the first call was made in
+            Region::Outside outside;
+            std::size_t size = std::max<std::size_t>(count, 1024);
+            chunks.push_back(Chunk{std::unique_ptr<ObjectRef[]>(new ObjectRef[size]), size, 0});
+        }
+        Chunk& chunk = chunks[current];
+        auto run = chunk.slots.get() + chunk.used;
+        chunk.used += count;
+        return run;
+    }
+
+    void Give(ObjectRef* run, std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) run[i].reset();
+        chunks[current].used -= count;
+        while (current > 0 && chunks[current].used == 0) --current;
+    }
+
+private:
+    struct Chunk {
+        std::unique_ptr<ObjectRef[]> slots;
+        std::size_t size;
+        std::size_t used;
+    };
+    std::vector<Chunk> chunks;
+    std::size_t current = 0;
+};
+
+thread_local ArgStack argStack;
+
+}
+
+ArgBuffer::ArgBuffer(std::size_t count)
+    : values(count <= INLINE ? inlineValues : argStack.Take(count)), count(count) {}
+
+ArgBuffer::~ArgBuffer() {
+    if (values != inlineValues) argStack.Give(values, count);
+}
+
+EvalResult::EvalResult(ObjectRef value) : Value(std::move(value)) {
+    if (!Value) return;
+    auto type = Value->Type();
+    if (type == ERROR_OBJ) {
+        Status = Signal::ERROR;
+    } else if (type == RETURN_VALUE_OBJ) {
+        Value = StaticRefCast<ReturnValue>(Value)->Value;
+        Status = Signal::RETURN;
+    }
+}
+
+ObjectRef Evaluator::Eval(const std::shared_ptr<Node>& node, const std::shared_ptr<Environment>& env) {
+    if (auto n = dynamic_cast<const Program*>(node.get())) {
+        return evalProgram(*n, env);
+    }
+    return asValue(evalNode(node.get(), env));
+}
+
+// Wherever a node's value is used as a value (bound, passed, operated on)
+// a `return` inside it is turned back into a ReturnValue object, which is
+// what the operators and the environment have always seen there. Only
+// the plain "return out of the function" path is allocation free.
+//
+// Nodes and the environment are borrowed: nothing here takes a reference
+// count on them unless it stores them, as a function value does.
+EvalResult Evaluator::evalNode(const Node* node, const std::shared_ptr<Environment>& env) {
+#ifdef MONKEY_COUNT_REFS
+    ++NodesVisited;
+#endif
     // The dynamic_cast will check the actual type of Node and return nullptr if the cast is not valid.
-    if (auto n = std::dynamic_pointer_cast<Program>(node)) {
-        return evalProgram(n, env);
-    } else if (auto n = std::dynamic_pointer_cast<BlockStatement>(node)) {
-        return evalBlockStatement(n, env);
-    } else if (auto n = std::dynamic_pointer_cast<ExpressionStatement>(node)) {
-        return Eval(n->expr, env);
-    } else if (auto n = std::dynamic_pointer_cast<ReturnStatement>(node)) {
-        auto val = Eval(n->ReturnValue, env);
-        if (isError(val)) {
+    if (auto n = dynamic_cast<const Program*>(node)) {
+        return EvalResult(evalProgram(*n, env));
+    } else if (auto n = dynamic_cast<const BlockStatement*>(node)) {
+        return evalBlockStatement(*n, env);
+    } else if (auto n = dynamic_cast<const ExpressionStatement*>(node)) {
+        return evalNode(n->expr.get(), env);
+    } else if (auto n = dynamic_cast<const ReturnStatement*>(node)) {
+        auto val = evalNode(n->ReturnValue.get(), env);
+        if (val.Status == Signal::ERROR) {
             return val;
         }
-        return std::make_shared<ReturnValue>(val);
-    } else if (auto n = std::dynamic_pointer_cast<LetStatement>(node)){
-        auto val = Eval(n->Value, env);
-        if(Evaluator::isError(val)) {
+        return EvalResult(asValue(std::move(val)), Signal::RETURN);
+    } else if (auto n = dynamic_cast<const LetStatement*>(node)){
+        if (auto lit = dynamic_cast<const FunctionLiteral*>(n->Value.get())) {
+            env->Set(n->Name->Value(), makeClosure(*lit, env, &n->Name->Value()));
+            return EvalResult();
+        }
+        auto val = evalNode(n->Value.get(), env);
+        if(val.Status == Signal::ERROR) {
             return val;
         }
-        env->Set(n->Name->Value(), val);
-    } else if (auto n = std::dynamic_pointer_cast<IntegerLiteral>(node)){
-        return std::make_shared<Integer>(n->Value);
-    } else if (auto n = std::dynamic_pointer_cast<StringLiteral>(node)){
-        return std::make_shared<String>(n->Value);
-    } else if (auto n = std::dynamic_pointer_cast<Boolean>(node)){
-        return nativeBoolToBooleanObject(n->Value);
-    } else if (auto n = std::dynamic_pointer_cast<PrefixExpression>(node)){
-        auto right = Eval(n->Right, env);
-        if(isError(right)) {
+        env->Set(n->Name->Value(), asValue(std::move(val)));
+    } else if (auto n = dynamic_cast<const IntegerLiteral*>(node)){
+        return EvalResult(MakeInteger(n->Value), Signal::NONE);
+    } else if (auto n = dynamic_cast<const StringLiteral*>(node)){
+        return EvalResult(MakeYoung<String>(n->Value), Signal::NONE);
+    } else if (auto n = dynamic_cast<const Boolean*>(node)){
+        return EvalResult(nativeBoolToBooleanObject(n->Value), Signal::NONE);
+    } else if (auto n = dynamic_cast<const PrefixExpression*>(node)){
+        auto right = evalNode(n->Right.get(), env);
+        if(right.Status == Signal::ERROR) {
             return right;
         }
-        return evalPrefixExpression(n->Operator, right);
-    } else if (auto n = std::dynamic_pointer_cast<InfixExpression>(node)){
-        auto left = Eval(n->Left, env);
-        if(isError(left)){
+        return evalPrefixExpression(n->Operator, asValue(std::move(right)));
+    } else if (auto n = dynamic_cast<const InfixExpression*>(node)){
+        auto left = evalNode(n->Left.get(), env);
+        if(left.Status == Signal::ERROR){
             return left;
         }
 
-        auto right = Eval(n->Right, env);
-        if(isError(right)) {
+        auto right = evalNode(n->Right.get(), env);
+        if(right.Status == Signal::ERROR) {
             return right;
         }
-        return evalInfixExpression(n->Operator, left, right);
-    } else if (auto n = std::dynamic_pointer_cast<IfExpression>(node)){
-        return evalIfExpression(n, env);
-    } else if (auto n = std::dynamic_pointer_cast<Identifier>(node)){
-        return evalIdentifier(n, env);
-    } else if (auto n = std::dynamic_pointer_cast<FunctionLiteral>(node)){
-        auto params = n->Parameters;
-        auto body = n->Body;
-        return std::make_shared<Function>(params, env, body);
-    } else if (auto n = std::dynamic_pointer_cast<CallExpression>(node)){
-        auto function = Eval(n->Function, env);
-        
-        if(isError(function)){
-            return function;
-        }
-
-        auto args = evalExpressions(n->Arguments, env);
-        if(args.size() == 1 && isError(args[0])){
-            return args[0];
-        }
-        return applyFunction(function, args);
-    } else if (auto n = std::dynamic_pointer_cast<ArrayLiteral>(node)){
-        auto elements = evalExpressions(n->Elements, env);
-        if(elements.size() == 1 && isError(elements[0])) return elements[0];
-        return std::make_shared<ArrayObject>(elements);
-    } else if (auto n = std::dynamic_pointer_cast<IndexExpression>(node)) {
-        auto left = Eval(n->Left, env);
-        if(isError(left)) return left;
-        auto index = Eval(n->Index, env);
-        return evalIndexExpression(left, index);
-    } else if (auto n = std::dynamic_pointer_cast<HashLiteral>(node)){
-        return evalHashLiteral(n, env);
+        return evalInfixExpression(n->Operator, asValue(std::move(left)), asValue(std::move(right)));
+    } else if (auto n = dynamic_cast<const IfExpression*>(node)){
+        return evalIfExpression(*n, env);
+    } else if (auto n = dynamic_cast<const Identifier*>(node)){
+        return evalIdentifier(*n, env);
+    } else if (auto n = dynamic_cast<const FunctionLiteral*>(node)){
+        return EvalResult(makeClosure(*n, env), Signal::NONE);
+    } else if (auto n = dynamic_cast<const CallExpression*>(node)){
+        return evalCallExpression(*n, env);
+    } else if (auto n = dynamic_cast<const ArrayLiteral*>(node)){
+        std::vector<ObjectRef> elements(n->Elements.size());
+        auto failed = evalExpressions(n->Elements, env, elements.data());
+        if(failed.Status == Signal::ERROR) return failed;
+        return EvalResult(MakeYoung<ArrayObject>(std::move(elements)), Signal::NONE);
+    } else if (auto n = dynamic_cast<const IndexExpression*>(node)) {
+        auto left = evalNode(n->Left.get(), env);
+        if(left.Status == Signal::ERROR) return left;
+        auto index = evalNode(n->Index.get(), env);
+        return evalIndexExpression(asValue(std::move(left)), asValue(std::move(index)));
+    } else if (auto n = dynamic_cast<const HashLiteral*>(node)){
+        return evalHashLiteral(*n, env);
+    } else if (auto n = dynamic_cast<const PackedLiteral*>(node)){
+        return EvalResult(evalPackedLiteral(*n), Signal::NONE);
     }
 
-    return nullptr;
+    return EvalResult();
 }
 
-std::shared_ptr<Object> Evaluator::evalProgram(std::shared_ptr<Program> program, std::shared_ptr<Environment> env){
-    std::shared_ptr<Object> result;
+ObjectRef Evaluator::evalProgram(const Program& program, const std::shared_ptr<Environment>& env){
+    EvalResult result;
 
-    for(auto& stmt : program->Statements){
-        result = Eval(stmt, env);
-        if(auto returnValue = std::dynamic_pointer_cast<ReturnValue>(result)){
-            return returnValue->Value;
-        }
-        else if(auto errorValue = std::dynamic_pointer_cast<Error>(result)){
-            return errorValue;
+    for(auto& stmt : program.Statements){
+        result = evalNode(stmt.get(), env);
+        if(result.Status != Signal::NONE){
+            break;
         }
     }
 
-    return result;
+    return result.Value;
 }
 
-std::shared_ptr<Object> Evaluator::evalBlockStatement(std::shared_ptr<BlockStatement> block, std::shared_ptr<Environment> env){
-    std::shared_ptr<Object> result;
+EvalResult Evaluator::evalBlockStatement(const BlockStatement& block, const std::shared_ptr<Environment>& env){
+    EvalResult result;
 
-    for(auto& stmt: block->Statements) {
-        result = Eval(stmt, env);
-        if(result){
-            auto rt = result->Type();
-            if(rt == RETURN_VALUE_OBJ or rt == ERROR_OBJ){
-                return result;
-            }
+    for(auto& stmt: block.Statements) {
+        result = evalNode(stmt.get(), env);
+        if(result.Status != Signal::NONE){
+            return result;
         }
     }
 
     return result;
 }
 
-std::shared_ptr<BooleanObject> Evaluator::nativeBoolToBooleanObject(bool input){
+Ref<BooleanObject> Evaluator::nativeBoolToBooleanObject(bool input){
     return input ? ObjectConstants::TRUE : ObjectConstants::FALSE;
 }
 
-std::shared_ptr<Object> Evaluator::evalPrefixExpression(const std::string& op, std::shared_ptr<Object> right){
+ObjectRef Evaluator::evalPrefixExpression(const std::string& op, const ObjectRef& right){
     if(op == "!"){
         return evalBangOperatorExpression(right);
     }
@@ -210,13 +733,13 @@ std::shared_ptr<Object> Evaluator::evalPrefixExpression(const std::string& op, s
         return evalMinusPrefixOperatorExpression(right);
     }
     else{
-        return newError("unknown operator: %s%s", op.c_str(), ObjectTypeToString(right->Type()).c_str());
+        return newError(ErrorCode::UNKNOWN_PREFIX_OPERATOR, op, ObjectTypeToString(right->Type()));
     }
 }
 
-std::shared_ptr<Object> Evaluator::evalInfixExpression(const std::string& op, std::shared_ptr<Object> left, std::shared_ptr<Object> right){
+ObjectRef Evaluator::evalInfixExpression(const std::string& op, const ObjectRef& left, const ObjectRef& right){
     if (left->Type() != right->Type()) {
-        return newError("type mismatch: %s %s %s", ObjectTypeToString(left->Type()).c_str(), op.c_str(), ObjectTypeToString(right->Type()).c_str());
+        return newError(ErrorCode::TYPE_MISMATCH, ObjectTypeToString(left->Type()), op, ObjectTypeToString(right->Type()));
     } else if (left->Type() == INTEGER_OBJ && right->Type() == INTEGER_OBJ) {
         return evalIntegerInfixExpression(op, left, right);
     } else if(left->Type() == STRING_OBJ && right->Type() == STRING_OBJ) {
@@ -226,11 +749,11 @@ std::shared_ptr<Object> Evaluator::evalInfixExpression(const std::string& op, st
     } else if (op == "!=") {
         return nativeBoolToBooleanObject(left != right);
     } else {
-        return newError("unknown operator: %s %s %s", ObjectTypeToString(left->Type()).c_str(), op.c_str(), ObjectTypeToString(right->Type()).c_str());
+        return newError(ErrorCode::UNKNOWN_INFIX_OPERATOR, ObjectTypeToString(left->Type()), op, ObjectTypeToString(right->Type()));
     }
 }
 
-std::shared_ptr<Object> Evaluator::evalBangOperatorExpression(std::shared_ptr<Object> right){
+ObjectRef Evaluator::evalBangOperatorExpression(const ObjectRef& right){
     if(right == ObjectConstants::TRUE){
         return ObjectConstants::FALSE;
     }
@@ -245,182 +768,397 @@ std::shared_ptr<Object> Evaluator::evalBangOperatorExpression(std::shared_ptr<Ob
     }
 }
 
-std::shared_ptr<Object> Evaluator::evalMinusPrefixOperatorExpression(std::shared_ptr<Object> right){
+ObjectRef Evaluator::evalMinusPrefixOperatorExpression(const ObjectRef& right){
     if(right->Type() != INTEGER_OBJ){
-        return newError("unknown operator: -%s", ObjectTypeToString(right->Type()).c_str());
+        return newError(ErrorCode::UNKNOWN_PREFIX_OPERATOR, "-", ObjectTypeToString(right->Type()));
     }
 
-    int value = std::static_pointer_cast<Integer>(right)->Value;
-    return std::make_shared<Integer>(-value);
+    int value = static_cast<const Integer*>(right.get())->Value;
+    return MakeInteger(-value);
 }
 
-std::shared_ptr<Object> Evaluator::evalIntegerInfixExpression(const std::string& op, std::shared_ptr<Object> left, std::shared_ptr<Object> right){
-    int leftVal = std::static_pointer_cast<Integer>(left)->Value;
-    int rightVal = std::static_pointer_cast<Integer>(right)->Value;
+ObjectRef Evaluator::evalIntegerInfixExpression(const std::string& op, const ObjectRef& left, const ObjectRef& right){
+    int leftVal = static_cast<const Integer*>(left.get())->Value;
+    int rightVal = static_cast<const Integer*>(right.get())->Value;
 
-    if(op == "+") { return std::make_shared<Integer>(leftVal + rightVal);}
-    else if (op == "-") { return std::make_shared<Integer>(leftVal - rightVal); }
-    else if (op == "*") { return std::make_shared<Integer>(leftVal * rightVal); }
-    else if (op == "/") { return std::make_shared<Integer>(leftVal / rightVal); }
+    if(op == "+") { return MakeInteger(leftVal + rightVal);}
+    else if (op == "-") { return MakeInteger(leftVal - rightVal); }
+    else if (op == "*") { return MakeInteger(leftVal * rightVal); }
+    else if (op == "/") { return MakeInteger(leftVal / rightVal); }
     else if (op == "<") { return nativeBoolToBooleanObject(leftVal < rightVal); }
     else if (op == ">") { return nativeBoolToBooleanObject(leftVal > rightVal); }
     else if (op == "==") { return nativeBoolToBooleanObject(leftVal == rightVal); }
     else if (op == "!=") { return nativeBoolToBooleanObject(leftVal != rightVal); }
-    else {return newError("unknown operator: %s %s %s", ObjectTypeToString(left->Type()).c_str(), op.c_str(), ObjectTypeToString(right->Type()).c_str()); }
+    else {return newError(ErrorCode::UNKNOWN_INFIX_OPERATOR, ObjectTypeToString(left->Type()), op, ObjectTypeToString(right->Type())); }
     //else {return newError("unknown operator: %s %s %s", left->Inspect().c_str(), op.c_str(), right->Inspect().c_str()); }
 }
 
-std::shared_ptr<Object> Evaluator::evalStringInfixExpression(const std::string& op, std::shared_ptr<Object> left, std::shared_ptr<Object> right){
+ObjectRef Evaluator::evalStringInfixExpression(const std::string& op, const ObjectRef& left, const ObjectRef& right){
     if(op != "+"){
-       return newError("unknown operator: %s %s %s", ObjectTypeToString(left->Type()).c_str(), op.c_str(), ObjectTypeToString(right->Type()).c_str());
+       return newError(ErrorCode::UNKNOWN_INFIX_OPERATOR, ObjectTypeToString(left->Type()), op, ObjectTypeToString(right->Type()));
     }
-    std::string leftVal = std::static_pointer_cast<String>(left)->Value;
-    std::string rightVal = std::static_pointer_cast<String>(right)->Value;
+    const auto& leftVal = static_cast<const String*>(left.get())->Value;
+    const auto& rightVal = static_cast<const String*>(right.get())->Value;
 
-    return std::make_shared<String>(leftVal + rightVal);
+    return MakeYoung<String>(leftVal + rightVal);
 }
 
-std::shared_ptr<Object> Evaluator::evalIfExpression(std::shared_ptr<IfExpression> ie, std::shared_ptr<Environment> env){
-    auto condition = Eval(ie->Condition, env);
-    if(isError(condition)) return condition;
-    if(isTruthy(condition)){
-        return Eval(ie->Consequence, env);
+EvalResult Evaluator::evalIfExpression(const IfExpression& ie, const std::shared_ptr<Environment>& env){
+    auto condition = evalNode(ie.Condition.get(), env);
+    if(condition.Status == Signal::ERROR) return condition;
+    if(isTruthy(asValue(std::move(condition)))){
+        return evalNode(ie.Consequence.get(), env);
     }
-    else if(ie->Alternative){
-        return Eval(ie->Alternative, env);
+    else if(ie.Alternative){
+        return evalNode(ie.Alternative.get(), env);
     }
     else{
-        return ObjectConstants::NULL_OBJ;
+        return EvalResult(ObjectConstants::NULL_OBJ, Signal::NONE);
     }
 }
 
-std::shared_ptr<Object> Evaluator::evalIdentifier(std::shared_ptr<Identifier> node, std::shared_ptr<Environment> env){
-    auto val = env->Get(node->Value());
+EvalResult Evaluator::evalIdentifier(const Identifier& node, const std::shared_ptr<Environment>& env){
+    return EvalResult(lookupIdentifier(node.Value(), env));
+}
+
+ObjectRef Evaluator::lookupIdentifier(const std::string& name, const std::shared_ptr<Environment>& env){
+    auto val = env->Get(name);
     if (val) {
         return val;
     }
 
     // If not found in the environment, check if it's a built-in function
-    auto it = builtins.find(node->Value());
+    auto it = builtins.find(name);
     if (it != builtins.end()) {
         return it->second;  // Return the built-in function
     }
 
     // If neither in environment nor a built-in, return an error
-    return newError("identifier not found: " + node->Value());
+    return newError(ErrorCode::IDENTIFIER_NOT_FOUND, name);
 }
 
-bool Evaluator::isTruthy(std::shared_ptr<Object> obj){
+bool Evaluator::isTruthy(const ObjectRef& obj){
     if(obj == ObjectConstants::NULL_OBJ) return false;
     else if(obj == ObjectConstants::TRUE) return true;
     else if(obj == ObjectConstants::FALSE) return false;
     else return true;
 }
 
-//The ellipsis ... in the parameter list of a function, like the 
-//newError function in Go or C++, is used to denote a variadic 
-//function. This means that the function can accept an arbitrary 
-//number of arguments of a specified type. 
-std::shared_ptr<Error> Evaluator::newError(const std::string format, ...) {
-    char buffer[1024];
-    va_list args;
-    va_start(args, format);
-    vsnprintf(buffer, sizeof(buffer), format.c_str(), args);
-    va_end(args);
-    return std::make_shared<Error>(buffer);
+Ref<Error> Evaluator::newError(ErrorCode code, std::string a, std::string b, std::string c) {
+    return MakeRef<Error>(code, std::move(a), std::move(b), std::move(c));
 }
 
 
-bool Evaluator::isError(std::shared_ptr<Object> obj){
+bool Evaluator::isError(const ObjectRef& obj){
     if(obj) return obj->Type() == ERROR_OBJ;
     return false;
 }
 
-std::vector<std::shared_ptr<Object>> Evaluator::evalExpressions(std::vector<std::shared_ptr<Expression>> exps, std::shared_ptr<Environment> env){
-    std::vector<std::shared_ptr<Object>> result;
+ObjectRef Evaluator::asValue(const EvalResult& result){
+    if (result.Status == Signal::RETURN) {
+        return MakeRef<ReturnValue>(result.Value);
+    }
+    return result.Value;
+}
+
+ObjectRef Evaluator::asValue(EvalResult&& result){
+    if (result.Status == Signal::RETURN) {
+        return MakeRef<ReturnValue>(std::move(result.Value));
+    }
+    return std::move(result.Value);
+}
+
+// Evaluates exps into out[0], out[1], ..., stopping at the first error,
+// which is returned.
+EvalResult Evaluator::evalExpressions(const std::vector<std::shared_ptr<Expression>>& exps, const std::shared_ptr<Environment>& env, ObjectRef* out){
     for (auto& exp : exps) {
-        auto evaluated = Eval(exp, env);
-        if (isError(evaluated)) {
-            // If an error occurs, return a vector with just that error.
-            return {evaluated};
+        auto evaluated = evalNode(exp.get(), env);
+        if (evaluated.Status == Signal::ERROR) {
+            return evaluated;
         }
-        result.push_back(evaluated);
+        *out++ = asValue(std::move(evaluated));
     }
-    return result;
+    return EvalResult();
 }
 
-std::shared_ptr<Object> Evaluator::applyFunction(std::shared_ptr<Object> fn, std::vector<std::shared_ptr<Object>> args){
-    if(auto fnCast = std::dynamic_pointer_cast<Function>(fn)){
-        auto extendedEnv = extendFunctionEnv(fnCast, args);
-        auto evaluated = Eval(fnCast->Body, extendedEnv);
-        return unwrapReturnValue(evaluated);
-    } else if (auto fnCast = std::dynamic_pointer_cast<Builtin>(fn)){
-        return fnCast->function(args);
+// Kept out of evalNode so only call frames carry the argument buffer.
+EvalResult Evaluator::evalCallExpression(const CallExpression& call, const std::shared_ptr<Environment>& env){
+    auto function = evalNode(call.Function.get(), env);
+    if(function.Status == Signal::ERROR){
+        return function;
+    }
+
+    ArgBuffer args(call.Arguments.size());
+    auto failed = evalExpressions(call.Arguments, env, args.Data());
+    if(failed.Status == Signal::ERROR){
+        return failed;
+    }
+    return callFunction(asValue(std::move(function)), args.Span());
+}
+
+ObjectRef Evaluator::applyFunction(const ObjectRef& fn, ArgSpan args){
+    return asValue(callFunction(fn, args));
+}
+
+// A `return` ends at the call: its value comes back as an ordinary value.
+EvalResult Evaluator::callFunction(const ObjectRef& fn, ArgSpan args){
+    if(auto fnCast = dynamic_cast<const Function*>(fn.get())){
+        ObjectRef invoked;
+        if (fnCast->Invoke(args, invoked)) return EvalResult(std::move(invoked));
+        const auto& body = fnCast->GetBody();
+        const auto& bodyErrors = fnCast->Prototype->Literal->BodyErrors;
+        if (!bodyErrors.empty()) {
+            return EvalResult(newError(ErrorCode::UNPARSED_FUNCTION_BODY, bodyErrors[0]), Signal::ERROR);
+        }
+        auto extendedEnv = extendFunctionEnv(*fnCast, args);
+        auto evaluated = evalBlockStatement(*body, extendedEnv);
+        if (evaluated.Status == Signal::RETURN) {
+            // a ReturnValue object that was returned is a return again
+            return EvalResult(std::move(evaluated.Value));
+        }
+        return evaluated;
+    } else if (auto fnCast = dynamic_cast<const Builtin*>(fn.get())){
+        return EvalResult(fnCast->function(args));
     }
     //else
-    return newError("not a function: %s", fn->Inspect().c_str());
+    return EvalResult(newError(ErrorCode::NOT_A_FUNCTION, fn->Inspect()), Signal::ERROR);
 }
 
-std::shared_ptr<Environment> Evaluator::extendFunctionEnv(std::shared_ptr<Function> fn, std::vector<std::shared_ptr<Object>> args){
-    auto env = std::make_shared<Environment>(fn->Env);
-    for (size_t i = 0; i < fn->Parameters.size(); ++i) {
-        env->Set(fn->Parameters[i]->Value(), args[i]);
+std::shared_ptr<Environment> Evaluator::extendFunctionEnv(const Function& fn, ArgSpan args){
+    auto env = MakeEnvironment(fn.Env);
+    env->Owner = fn.Prototype;
+    const auto& parameters = fn.Parameters();
+    for (size_t i = 0; i < parameters.size(); ++i) {
+        env->Set(parameters[i]->Value(), args[i]);
     }
     return env;
 }
 
-std::shared_ptr<Object> Evaluator::unwrapReturnValue(std::shared_ptr<Object> obj){
-    auto returnValue = std::dynamic_pointer_cast<ReturnValue>(obj);
+FunctionCaller::FunctionCaller(ObjectRef fn, std::size_t arity) : fn(std::move(fn)), arity(arity) {
+    function = dynamic_cast<const Function*>(this->fn.get());
+}
+
+ObjectRef FunctionCaller::Check(const std::string& builtin) const {
+    if (function) {
+        if (function->Prototype->Arity != arity) {
+            return Evaluator::newError(ErrorCode::WRONG_ARGUMENT_COUNT, std::to_string(arity),
+                                       std::to_string(function->Prototype->Arity));
+        }
+        return nullptr;
+    }
+    if (fn->Type() != BUILTIN_OBJ) {
+        return Evaluator::newError(ErrorCode::ARGUMENT_NOT_SUPPORTED, builtin, ObjectTypeToString(fn->Type()));
+    }
+    return nullptr;
+}
+
+ObjectRef FunctionCaller::Call(ArgSpan args) {
+    // a lazy body is parsed here, before its errors can be known
+    if (!function || !function->GetBody() || !function->Prototype->Literal->BodyErrors.empty()) {
+        return Evaluator::applyFunction(fn, args);
+    }
+    ObjectRef invoked;
+    if (function->Invoke(args, invoked)) return Evaluator::asValue(EvalResult(std::move(invoked)));
+
+    const auto& parameters = function->Parameters();
+    if (!frame || frame.use_count() != 1 || frame->store.size() != parameters.size()) {
+        frame = MakeEnvironment(function->Env);
+        frame->Owner = function->Prototype;
+    }
+    for (std::size_t i = 0; i < parameters.size(); ++i) {
+        frame->Set(parameters[i]->Value(), args[i]);
+    }
+    auto evaluated = Evaluator::evalBlockStatement(*function->GetBody(), frame);
+    if (evaluated.Status == Signal::RETURN) return Evaluator::asValue(EvalResult(std::move(evaluated.Value)));
+    return Evaluator::asValue(std::move(evaluated));
+}
+
+ObjectRef Evaluator::unwrapReturnValue(const ObjectRef& obj){
+    auto returnValue = dynamic_cast<const ReturnValue*>(obj.get());
     if (returnValue) {
         return returnValue->Value;
     }
     return obj;
 }
 
-std::shared_ptr<Object> Evaluator::evalIndexExpression(std::shared_ptr<Object> left, std::shared_ptr<Object> index){
+ObjectRef Evaluator::evalIndexExpression(const ObjectRef& left, const ObjectRef& index){
     if(left->Type() == ARRAY_OBJ && index->Type() == INTEGER_OBJ) return evalArrayIndexExpression(left, index);
     else if(left->Type() == HASH_OBJ) return evalHashIndexExpression(left, index);
-    else {return newError("index operator not supported: %s", ObjectTypeToString(left->Type()).c_str()); }
+    else {return newError(ErrorCode::INDEX_NOT_SUPPORTED, ObjectTypeToString(left->Type())); }
 }
 
-std::shared_ptr<Object> Evaluator::evalArrayIndexExpression(std::shared_ptr<Object> array, std::shared_ptr<Object> index){
-    auto arrayObject = std::dynamic_pointer_cast<ArrayObject>(array);
-    int idx = std::dynamic_pointer_cast<Integer>(index)->Value;
-    int max = arrayObject->Elements.size() - 1;
+ObjectRef Evaluator::evalArrayIndexExpression(const ObjectRef& array, const ObjectRef& index){
+    auto arrayObject = static_cast<const ArrayObject*>(array.get());
+    int idx = static_cast<const Integer*>(index.get())->Value;
+    int max = arrayObject->Size() - 1;
 
     if(idx < 0 or idx > max) return ObjectConstants::NULL_OBJ;
 
-    return arrayObject->Elements[idx];
+    return arrayObject->At(idx);
 }
 
-std::shared_ptr<Object> Evaluator::evalHashLiteral(std::shared_ptr<HashLiteral> node, std::shared_ptr<Environment> env){
+EvalResult Evaluator::evalHashLiteral(const HashLiteral& node, const std::shared_ptr<Environment>& env){
     std::map<HashKey, HashPair> pairs;
-    for(const auto& nodePair : node->Pairs) {
-        auto key = Eval(nodePair.first, env);
-        if(isError(key)) return key;
+    for(const auto& nodePair : node.Pairs) {
+        auto keyResult = evalNode(nodePair.first.get(), env);
+        if(keyResult.Status == Signal::ERROR) return keyResult;
 
-        auto hashKey = std::dynamic_pointer_cast<Hashable>(key);
-        if(!hashKey) return newError("unusable as hash key: %s", ObjectTypeToString(key->Type()).c_str());
+        auto key = asValue(keyResult);
+        if(!IsHashable(key->Type())) return EvalResult(newError(ErrorCode::UNUSABLE_HASH_KEY, ObjectTypeToString(key->Type())), Signal::ERROR);
 
-        auto value = Eval(nodePair.second, env);
-        if(isError(key)) return value;
+        // an error here is kept as the value
+        auto value = asValue(evalNode(nodePair.second.get(), env));
 
-        auto hashed = hashKey->keyHash();
-        pairs[hashed] = HashPair{key, value};
+        auto hashed = key->keyHash();
+        pairs[hashed] = HashPair{std::move(key), std::move(value)};
     }
 
-    return std::make_shared<Hash>(pairs);
+    return EvalResult(MakeRef<Hash>(std::move(pairs)), Signal::NONE);
 }
 
-std::shared_ptr<Object> Evaluator::evalHashIndexExpression(std::shared_ptr<Object> hash, std::shared_ptr<Object> index){
-    auto hashObject = std::dynamic_pointer_cast<Hash>(hash);
+ObjectRef Evaluator::evalHashIndexExpression(const ObjectRef& hash, const ObjectRef& index){
+    auto hashObject = static_cast<const Hash*>(hash.get());
 
-    auto key = std::dynamic_pointer_cast<Hashable>(index);
-    if(!key) return newError("unusable as hash key: %s", ObjectTypeToString(index->Type()).c_str());
-    auto pair = hashObject->Pairs.find(key->keyHash());
+    if(!IsHashable(index->Type())) return newError(ErrorCode::UNUSABLE_HASH_KEY, ObjectTypeToString(index->Type()));
+    auto pair = hashObject->Pairs.find(index->keyHash());
     if(pair == hashObject->Pairs.end()) return ObjectConstants::NULL_OBJ;
 
     return pair->second.Value;
 }
 
+// Arrays and hashes compare by identity, so every evaluation of a
+// literal makes an object of its own, as for any other literal. What goes
+// into it is ready, though: an array copies the literal's packed
+// integers, and a hash copies the pairs of a template built on first use,
+// whose keys and values are shared by every copy.
+ObjectRef Evaluator::evalPackedLiteral(const PackedLiteral& node){
+    if (auto array = dynamic_cast<const IntegerArrayLiteral*>(&node)) {
+        return MakeYoung<ArrayObject>(array->Values);
+    }
+
+    auto cached = std::atomic_load(&node.Materialized);
+    if (!cached) {
+        auto hash = static_cast<const ConstantHashLiteral*>(&node);
+        std::map<HashKey, HashPair> pairs;
+        for (const auto& pair : hash->Pairs) {
+            auto key = constantToObject(pair.first);
+            auto hashed = key->keyHash();
+            pairs[hashed] = HashPair{std::move(key), constantToObject(pair.second)};
+        }
+        ObjectRef obj = MakeRef<Hash>(std::move(pairs));
+
+        // Any thread may pick it up from here. The AST only knows Object by
+        // name, so the node holds it through a shared_ptr whose deleter owns
+        // the reference. If two threads race here, both templates are equal
+        // and either is kept.
+        obj->Share();
+        cached = std::shared_ptr<Object>(obj.get(), [obj](Object*) {});
+        std::atomic_store(&node.Materialized, cached);
+    }
+    return MakeYoung<Hash>(static_cast<const Hash*>(cached.get())->Pairs);
+}
+
+// The prototype is built once per literal and cached on it. The literal
+// owns it, and the pointer handed out shares ownership of the literal,
+// so the two can never form a cycle.
+std::shared_ptr<const FunctionPrototype> Evaluator::prototypeOf(const FunctionLiteral& literal){
+    auto prototype = std::atomic_load(&literal.Prototype);
+    if (!prototype) {
+        std::shared_ptr<const FunctionPrototype> expected;
+        prototype = std::make_shared<const FunctionPrototype>(literal);
+        // if another thread got there first, use its prototype
+        if (!std::atomic_compare_exchange_strong(&literal.Prototype, &expected, prototype)) {
+            prototype = std::move(expected);
+        }
+    }
+    return std::shared_ptr<const FunctionPrototype>(literal.shared_from_this(), prototype.get());
+}
+
+namespace {
+
+// how many lets in the body of the call owning scope bind name
+std::size_t letsOf(const Environment& scope, const std::string& name) {
+    if (!scope.Owner) return 0;
+    const auto& lets = scope.Owner->LetNames();
+    auto range = std::equal_range(lets.begin(), lets.end(), name);
+    return static_cast<std::size_t>(range.second - range.first);
+}
+
+// Whether name, bound in scope or not, stays as it is: no let still to
+// run in the call owning scope can bind it. A let runs at most once per
+// call, so a bound name is settled when it was bound by its only let, or
+// is a parameter that no let binds again.
+bool settled(const Environment& scope, const std::string& name, bool bound) {
+    std::size_t lets = letsOf(scope, name);
+    if (!bound || lets == 0) return lets == 0;
+    for (const auto& param : scope.Owner->Parameters()) {
+        if (param->Value() == name) return false;
+    }
+    return lets == 1;
+}
+
+} // namespace
+
+// A closure made at the top level keeps the top-level environment, where
+// the top-level names it uses are looked up when it runs, as always. One
+// made inside a call copies only the bindings it uses out of the call
+// environments around it, into a fresh environment on top of the top
+// level, and keeps nothing else of them alive. Its own name (selfName)
+// is bound to the closure itself, so local functions can recurse.
+//
+// A copy only stands in for the chain while what it read cannot change.
+// Bindings are never removed, but a call that is still running may yet
+// bind a name again, or bind it in a scope nearer the closure, by a let
+// in its body; up to the top level when the name is found there or
+// nowhere. When that can happen to any name, the closure keeps the whole
+// chain and looks its names up as it runs, as mutually recursive local
+// functions need.
+Ref<Function> Evaluator::makeClosure(const FunctionLiteral& literal, const std::shared_ptr<Environment>& env, const std::string* selfName){
+    auto prototype = prototypeOf(literal);
+    if (!env->outer) {
+        return MakeRef<Function>(std::move(prototype), env);
+    }
+
+    auto global = env->outer;
+    while (global->outer) global = global->outer;
+
+    std::shared_ptr<Environment> captured;
+    bool self = false;
+    for (const auto& name : prototype->FreeNames()) {
+        if (selfName && name == *selfName) {
+            // the let about to bind the closure has to be the name's only one
+            if (env->store.count(name) || letsOf(*env, name) != 1) return MakeRef<Function>(std::move(prototype), env);
+            self = true;
+            continue;
+        }
+        const ObjectRef* value = nullptr;
+        for (auto scope = env.get(); scope != global.get() && !value; scope = scope->outer.get()) {
+            auto it = scope->store.find(name);
+            if (it != scope->store.end()) value = &it->second;
+            if (!settled(*scope, name, value)) return MakeRef<Function>(std::move(prototype), env);
+        }
+        if (value) {
+            if (!captured) captured = MakeEnvironment(global);
+            captured->Set(name, *value);
+        }
+    }
+
+    if (!captured && !self) {
+        return MakeRef<Function>(std::move(prototype), std::move(global));
+    }
+    if (!captured) captured = MakeEnvironment(std::move(global));
+    auto fn = MakeRef<Function>(std::move(prototype), captured);
+    if (self) captured->Set(*selfName, fn);
+    return fn;
+}
+
+ObjectRef Evaluator::constantToObject(const ConstantValue& c){
+    switch (c.Kind) {
+        case TokenType::INT: return MakeInteger(c.Int);
+        case TokenType::STRING: return MakeRef<String>(c.Str);
+        case TokenType::TRUE: return ObjectConstants::TRUE;
+        default: return ObjectConstants::FALSE;
+    }
+}
+
 //g++ -std=c++17 -Isrc -c src/monkey/evaluator/evaluator.cpp -o evaluator.o
\ No newline at end of file
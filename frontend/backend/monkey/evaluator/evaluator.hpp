@@ -5,48 +5,134 @@
 #include "../ast/ast.hpp"
 #include "../object/object.hpp"
 #include "../object/environment.hpp"
+#include "../object/heap.hpp"
+#include "../object/region.hpp"
 #include <map>
-#include <cstdarg>
-#include <cstdio>
+#include <cstdint>
 #include <memory>
 
 using namespace YOXS_OBJECT;
 using namespace YOXS_AST;
 
+// How evaluation left a node: normally, through a `return`, or with an
+// error. It travels next to the value, so a `return` needs no wrapper
+// object on its way out of a function. For ERROR the value is the Error.
+enum class Signal : uint8_t {
+    NONE,
+    RETURN,
+    ERROR
+};
+
+struct EvalResult {
+    ObjectRef Value;
+    Signal Status = Signal::NONE;
+
+    EvalResult() = default;
+    EvalResult(ObjectRef value, Signal status) : Value(std::move(value)), Status(status) {}
+    // An Error is an error, and a ReturnValue object (one that was stored
+    // as a value, say by `let`) is a return of what it wraps.
+    EvalResult(ObjectRef value);
+};
+
+#ifdef MONKEY_COUNT_REFS
+// Bench builds count the nodes Evaluator::evalNode visits on each thread
+inline thread_local long NodesVisited = 0;
+#endif
+
+// Storage for the arguments of one call. Up to INLINE values live in the
+// buffer itself, on the native stack; a call with more takes a run of
+// slots from a per-thread stack that grows in chunks and never moves, so
+// nested calls can take their own runs while this one is still in use.
+// Either way an ordinary call allocates nothing to pass its arguments.
+class ArgBuffer {
+public:
+    static constexpr std::size_t INLINE = 8;
+
+    explicit ArgBuffer(std::size_t count);
+    ~ArgBuffer();
+    ArgBuffer(const ArgBuffer&) = delete;
+    ArgBuffer& operator=(const ArgBuffer&) = delete;
+
+    ObjectRef* Data() { return values; }
+    ObjectRef& operator[](std::size_t i) { return values[i]; }
+    ArgSpan Span() const { return ArgSpan(values, count); }
+
+private:
+    ObjectRef inlineValues[INLINE];
+    ObjectRef* values;
+    std::size_t count;
+};
+
 class Evaluator {
 public:
 
-    static std::shared_ptr<Object> Eval(std::shared_ptr<Node> node, std::shared_ptr<Environment> env);
-    static std::shared_ptr<Object> evalProgram(std::shared_ptr<Program> program, std::shared_ptr<Environment> env);
-    static std::shared_ptr<Object> evalBlockStatement(std::shared_ptr<BlockStatement> block, std::shared_ptr<Environment> env);
-    static std::shared_ptr<BooleanObject> nativeBoolToBooleanObject(bool input);
-    static std::shared_ptr<Object> evalPrefixExpression(const std::string& op, std::shared_ptr<Object> right);
-    static std::shared_ptr<Object> evalInfixExpression(const std::string& op, std::shared_ptr<Object> left, std::shared_ptr<Object> right);
-    static std::shared_ptr<Object> evalBangOperatorExpression(std::shared_ptr<Object> right);
-    static std::shared_ptr<Object> evalMinusPrefixOperatorExpression(std::shared_ptr<Object> right);
-    static std::shared_ptr<Object> evalIntegerInfixExpression(const std::string& op, std::shared_ptr<Object> left, std::shared_ptr<Object> right);
-    static std::shared_ptr<Object> evalStringInfixExpression(const std::string& op, std::shared_ptr<Object> left, std::shared_ptr<Object> right);
-    static std::shared_ptr<Object> evalIfExpression(std::shared_ptr<IfExpression> ie, std::shared_ptr<Environment> env);
-    static std::shared_ptr<Object> evalIdentifier(std::shared_ptr<Identifier> node, std::shared_ptr<Environment> env);
+    // Returns the program's value, or for any other node its value with a
+    // `return` wrapped in a ReturnValue.
+    static ObjectRef Eval(const std::shared_ptr<Node>& node, const std::shared_ptr<Environment>& env);
+    static ObjectRef evalProgram(const Program& program, const std::shared_ptr<Environment>& env);
+    static EvalResult evalNode(const Node* node, const std::shared_ptr<Environment>& env);
+    static EvalResult evalBlockStatement(const BlockStatement& block, const std::shared_ptr<Environment>& env);
+    static Ref<BooleanObject> nativeBoolToBooleanObject(bool input);
+    static ObjectRef evalPrefixExpression(const std::string& op, const ObjectRef& right);
+    static ObjectRef evalInfixExpression(const std::string& op, const ObjectRef& left, const ObjectRef& right);
+    static ObjectRef evalBangOperatorExpression(const ObjectRef& right);
+    static ObjectRef evalMinusPrefixOperatorExpression(const ObjectRef& right);
+    static ObjectRef evalIntegerInfixExpression(const std::string& op, const ObjectRef& left, const ObjectRef& right);
+    static ObjectRef evalStringInfixExpression(const std::string& op, const ObjectRef& left, const ObjectRef& right);
+    static EvalResult evalIfExpression(const IfExpression& ie, const std::shared_ptr<Environment>& env);
+    static EvalResult evalIdentifier(const Identifier& node, const std::shared_ptr<Environment>& env);
+    static ObjectRef lookupIdentifier(const std::string& name, const std::shared_ptr<Environment>& env);
     
-    static bool isTruthy(std::shared_ptr<Object> obj);
-    static std::shared_ptr<Error> newError(const std::string format, ...);
-    static bool isError(std::shared_ptr<Object> obj);
-    static std::vector<std::shared_ptr<Object>> evalExpressions(std::vector<std::shared_ptr<Expression>> exps, std::shared_ptr<Environment> env);
-    static std::shared_ptr<Object> applyFunction(std::shared_ptr<Object> fn, std::vector<std::shared_ptr<Object>> args);
-    static std::shared_ptr<Environment> extendFunctionEnv(std::shared_ptr<Function> fn, std::vector<std::shared_ptr<Object>> args);
-    static std::shared_ptr<Object> unwrapReturnValue(std::shared_ptr<Object> obj);
-    static std::shared_ptr<Object> evalIndexExpression(std::shared_ptr<Object> left, std::shared_ptr<Object> index);
-    static std::shared_ptr<Object> evalArrayIndexExpression(std::shared_ptr<Object> array, std::shared_ptr<Object> index);
-    static std::shared_ptr<Object> evalHashLiteral(std::shared_ptr<HashLiteral> node, std::shared_ptr<Environment> env);
-    static std::shared_ptr<Object> evalHashIndexExpression(std::shared_ptr<Object> hash, std::shared_ptr<Object> index);
+    static bool isTruthy(const ObjectRef& obj);
+    static Ref<Error> newError(ErrorCode code, std::string a = "", std::string b = "", std::string c = "");
+    static bool isError(const ObjectRef& obj);
+    // the object the tree-walker of old would have seen: a ReturnValue for
+    // a return, the Error for an error
+    static ObjectRef asValue(const EvalResult& result);
+    static ObjectRef asValue(EvalResult&& result);
+    static EvalResult evalExpressions(const std::vector<std::shared_ptr<Expression>>& exps, const std::shared_ptr<Environment>& env, ObjectRef* out);
+    static EvalResult evalCallExpression(const CallExpression& call, const std::shared_ptr<Environment>& env);
+    static ObjectRef applyFunction(const ObjectRef& fn, ArgSpan args);
+    static EvalResult callFunction(const ObjectRef& fn, ArgSpan args);
+    static std::shared_ptr<Environment> extendFunctionEnv(const Function& fn, ArgSpan args);
+    static ObjectRef unwrapReturnValue(const ObjectRef& obj);
+    static ObjectRef evalIndexExpression(const ObjectRef& left, const ObjectRef& index);
+    static ObjectRef evalArrayIndexExpression(const ObjectRef& array, const ObjectRef& index);
+    static EvalResult evalHashLiteral(const HashLiteral& node, const std::shared_ptr<Environment>& env);
+    static ObjectRef evalHashIndexExpression(const ObjectRef& hash, const ObjectRef& index);
+    static ObjectRef evalPackedLiteral(const PackedLiteral& node);
+    static std::shared_ptr<const FunctionPrototype> prototypeOf(const FunctionLiteral& literal);
+    // selfName, when given, is the name the closure is about to be bound to
+    static Ref<Function> makeClosure(const FunctionLiteral& literal, const std::shared_ptr<Environment>& env, const std::string* selfName = nullptr);
+    static ObjectRef constantToObject(const ConstantValue& c);
+};
+
+// Calls one function over and over with the same number of arguments, for
+// the builtins that take a callback. A function the evaluator runs gets
+// the environment of its last call back, instead of a new one, when that
+// call left nothing holding on to it and bound nothing but the parameters;
+// any other callable goes through Evaluator::applyFunction.
+class FunctionCaller {
+public:
+    FunctionCaller(ObjectRef fn, std::size_t arity);
+
+    // an Error if the function cannot take `arity` arguments, else null
+    ObjectRef Check(const std::string& builtin) const;
+    // like Evaluator::applyFunction
+    ObjectRef Call(ArgSpan args);
+
+private:
+    ObjectRef fn;
+    const Function* function = nullptr; // fn, when it is one
+    std::size_t arity;
+    std::shared_ptr<Environment> frame;
 };
 
 class ObjectConstants {
 public:
-    static std::shared_ptr<NullObject> NULL_OBJ;
-    static std::shared_ptr<BooleanObject> TRUE;
-    static std::shared_ptr<BooleanObject> FALSE;
+    static Ref<NullObject> NULL_OBJ;
+    static Ref<BooleanObject> TRUE;
+    static Ref<BooleanObject> FALSE;
 };
 
 #endif // EVALUATOR_H
@@ -0,0 +1,241 @@
+#include "evaluator.hpp"
+#include "flat_evaluator.hpp"
+#include "closure_compiler.hpp"
+#include "../lexer/lexer.hpp"
+#include "../parser/parser.hpp"
+#include "../util/int_kernels.hpp"
+#include "../util/pdqsort.hpp"
+#include "../util/thread_pool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Evaluator Benchmark: times the tree-walking evaluator, the flat
+//evaluator and the closure compiler on the same small programs.
+//"tree in a region" is the tree walker with everything the run allocates
+//taken from a Region that is released without destroying any of it.
+//Last, what it costs threads to copy handles to one object that is counted
+//atomically, as TRUE, FALSE and NULL were, and to the immortal ones.
+//
+//Built with MONKEY_COUNT_REFS (make evaluator_refs) it times nothing, and
+//instead counts the object references the tree walker takes and drops
+//during one Evaluator::Eval of each program, per node it visits. Nodes
+//are borrowed and take none; environments, whose std::shared_ptr is
+//copied once or twice per call rather than per node, are not counted.
+
+template <typename F>
+double timeMs(F&& f, int runs) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; ++i) f();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / runs;
+}
+
+// Wall time for `threads` threads to each run `work` once, together
+template <typename F>
+double onThreads(unsigned threads, F work) {
+    return timeMs([&] {
+        std::vector<std::thread> running;
+        for (unsigned i = 0; i < threads; ++i) running.emplace_back(work);
+        for (auto& t : running) t.join();
+    }, 1);
+}
+
+// Copies and drops a handle to `object` over and over, the way every
+// comparison's result used to be
+void copyHandles(const ObjectRef& object, long copies) {
+    volatile long alive = 0;
+    for (long i = 0; i < copies; ++i) {
+        ObjectRef copy = object;
+        alive = alive + (copy != nullptr);
+    }
+}
+
+int main() {
+    const int runs = 5;
+    struct Bench {
+        std::string name;
+        std::string input;
+    };
+    std::vector<Bench> benches = {
+        {"fib(22)", "let fib = fn(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } }; fib(22)"},
+        {"closures", "let adder = fn(x) { fn(y) { x + y } }; "
+                     "let loop = fn(i, acc) { if (i == 0) { acc } else { loop(i - 1, adder(i)(acc)) } }; "
+                     "loop(1000, 0)"},
+        {"arrays", "let build = fn(i, arr) { if (i == 0) { arr } else { build(i - 1, push(arr, i)) } }; "
+                   "let sum = fn(arr, acc) { if (len(arr) == 0) { acc } else { sum(rest(arr), acc + first(arr)) } }; "
+                   "sum(build(300, []), 0)"},
+        {"graph", "let tree = fn(d) { if (d == 0) { [] } else { [tree(d - 1), tree(d - 1)] } }; let t = tree(15); len(t)"},
+    };
+
+    for (const auto& bench : benches) {
+        Lexer l(bench.input);
+        Parser p(l);
+        auto program = p.ParseProgram();
+#ifdef MONKEY_COUNT_REFS
+        {
+            auto env = std::make_shared<Environment>();
+            RefCounts = {};
+            NodesVisited = 0;
+            auto result = Evaluator::Eval(program, env);
+            RefTraffic counted = RefCounts;
+            std::cout << bench.name << ": " << NodesVisited << " nodes visited, "
+                      << double(counted.Retains) / NodesVisited << " references taken and "
+                      << double(counted.Releases) / NodesVisited << " dropped per node" << std::endl;
+        }
+        continue;
+#endif
+        auto flat = FlatProgram::Flatten(*program);
+        auto compiled = ClosureCompiler::Compile(*program);
+
+        auto want = Evaluator::Eval(program, std::make_shared<Environment>())->Inspect();
+        ObjectRef got;
+        double tree = timeMs([&] { Evaluator::Eval(program, std::make_shared<Environment>()); }, runs);
+        double region = timeMs([&] {
+            Region r;
+            Region::Scope scope(r);
+            auto env = new std::shared_ptr<Environment>(std::make_shared<Environment>());
+            new ObjectRef(Evaluator::Eval(program, *env));
+        }, runs);
+        double flatMs = timeMs([&] {
+            FlatEvaluator evaluator(flat, std::make_shared<Environment>());
+            evaluator.Run();
+            got = evaluator.Result();
+        }, runs);
+        if (got->Inspect() != want) {
+            std::cerr << bench.name << ": flat evaluator result differs" << std::endl;
+            return 1;
+        }
+        double closure = timeMs([&] { got = ClosureCompiler::Run(compiled, std::make_shared<Environment>()); }, runs);
+        if (got->Inspect() != want) {
+            std::cerr << bench.name << ": closure compiler result differs" << std::endl;
+            return 1;
+        }
+
+        std::cout << bench.name << ": tree " << tree << " ms, tree in a region " << region << " ms, flat " << flatMs << " ms (x" << tree / flatMs
+                  << "), closures " << closure << " ms (x" << tree / closure << ")" << std::endl;
+    }
+#ifdef MONKEY_COUNT_REFS
+    return 0;
+#endif
+
+    unsigned threads = std::max(4u, std::thread::hardware_concurrency());
+    const long copies = 20000000;
+    auto counted = MakeGlobal<BooleanObject>(true);
+    auto& immortal = ObjectConstants::TRUE;
+    for (unsigned n : {1u, threads}) {
+        double before = onThreads(n, [&] { copyHandles(counted, copies); });
+        double after = onThreads(n, [&] { copyHandles(immortal, copies); });
+        std::cout << "copying TRUE on " << n << " threads: atomic count " << before << " ms, immortal "
+                  << after << " ms (x" << before / after << ")" << std::endl;
+    }
+
+    // comparisons on every thread: `n < 2` and `n == 0` hand out TRUE and FALSE
+    Lexer l(benches[0].input);
+    Parser p(l);
+    auto fib = p.ParseProgram();
+    for (unsigned n : {1u, threads}) {
+        double ms = onThreads(n, [&] { Evaluator::Eval(fib, std::make_shared<Environment>()); });
+        std::cout << "fib(22) on " << n << " threads: " << ms << " ms" << std::endl;
+    }
+
+    // a numeric reduction written in Monkey, against the builtin
+    auto parse = [](const std::string& input) {
+        Lexer lexer(input);
+        Parser parser(lexer);
+        return parser.ParseProgram();
+    };
+    auto handWritten = parse("let total = fn(arr, i, acc) { if (i == len(arr)) { acc } else { total(arr, i + 1, acc + arr[i]) } }; "
+                             "total(range(2000), 0, 0)");
+    auto native = parse("sum(range(2000))");
+    double loop = timeMs([&] { Evaluator::Eval(handWritten, std::make_shared<Environment>()); }, runs);
+    double builtin = timeMs([&] { Evaluator::Eval(native, std::make_shared<Environment>()); }, runs);
+    std::cout << "sum of 2000 integers: in Monkey " << loop << " ms, builtin " << builtin << " ms (x" << loop / builtin
+              << ")" << std::endl;
+
+    // map the way users write it, with rest and push, against the builtin
+    auto recursiveMap = parse("let mapped = fn(arr, f, out) { if (len(arr) == 0) { out } else { mapped(rest(arr), f, push(out, f(first(arr)))) } }; "
+                              "len(mapped(range(1, 1001), fn(x) { x * 2 }, []))");
+    auto nativeMap = parse("len(map(range(1, 1001), fn(x) { x * 2 }))");
+    double recursive = timeMs([&] { Evaluator::Eval(recursiveMap, std::make_shared<Environment>()); }, runs);
+    double mapped = timeMs([&] { Evaluator::Eval(nativeMap, std::make_shared<Environment>()); }, runs);
+    std::cout << "map over 1000 integers: recursive " << recursive << " ms, builtin " << mapped << " ms (x"
+              << recursive / mapped << ")" << std::endl;
+
+    // the same callback over a larger array, on this thread and across the pool
+    auto serialMap = parse("len(map(range(20000), fn(x) { x * x + x / 3 }))");
+    auto parallelMap = parse("len(pmap(range(20000), fn(x) { x * x + x / 3 }))");
+    double serial = timeMs([&] { Evaluator::Eval(serialMap, std::make_shared<Environment>()); }, runs);
+    double parallel = timeMs([&] { Evaluator::Eval(parallelMap, std::make_shared<Environment>()); }, runs);
+    std::cout << "map over 20000 integers: map " << serial << " ms, pmap on " << ThreadPool::Shared().Size()
+              << " threads " << parallel << " ms (x" << serial / parallel << ")" << std::endl;
+
+    std::vector<int64_t> values(1 << 20);
+    for (std::size_t i = 0; i < values.size(); ++i) values[i] = int64_t(i * 2654435761u % 1000003);
+    volatile int64_t sink = 0;
+    double scalar = timeMs([&] {
+        int64_t total = 0;
+        for (auto v : values) {
+            if (__builtin_add_overflow(total, v, &total)) break;
+        }
+        sink = total;
+    }, 20);
+    double kernel = timeMs([&] {
+        int64_t total = 0;
+        IntKernels::Sum(values.data(), values.size(), total);
+        sink = total;
+    }, 20);
+    std::cout << "checked sum of 1M integers: scalar loop " << scalar << " ms, " << IntKernels::Isa() << " kernel " << kernel
+              << " ms (x" << scalar / kernel << ")" << std::endl;
+
+    // sorting 1M integers in C++, then 1M integers and 1M strings through
+    // the builtin, which copies the array and boxes nothing for integers
+    auto sortedCopy = [&](void (*sortFn)(std::vector<int64_t>&)) {
+        return timeMs([&] {
+            auto copy = values;
+            sortFn(copy);
+            sink = copy[0];
+        }, 5);
+    };
+    double stdSort = sortedCopy([](std::vector<int64_t>& v) { std::sort(v.begin(), v.end()); });
+    double pdqSort = sortedCopy([](std::vector<int64_t>& v) { PdqSort(v.begin(), v.end()); });
+    double radixSort = sortedCopy([](std::vector<int64_t>& v) { IntKernels::Sort(v.data(), v.size()); });
+    std::cout << "sort of 1M integers: std::sort " << stdSort << " ms, pdqsort " << pdqSort << " ms, radix " << radixSort
+              << " ms" << std::endl;
+
+    auto data = MakeEnvironment();
+    data->Set("ints", MakeRef<ArrayObject>(values));
+    std::vector<ObjectRef> strings(values.size());
+    for (std::size_t i = 0; i < values.size(); ++i) strings[i] = MakeRef<String>("s" + std::to_string(values[i]));
+    data->Set("strings", MakeRef<ArrayObject>(std::move(strings)));
+    auto sortInts = parse("len(sort(ints))");
+    auto sortStrings = parse("len(sort(strings))");
+    double builtinInts = timeMs([&] { Evaluator::Eval(sortInts, data); }, 5);
+    double builtinStrings = timeMs([&] { Evaluator::Eval(sortStrings, data); }, 5);
+    std::cout << "sort builtin on 1M elements: integers " << builtinInts << " ms, strings " << builtinStrings << " ms"
+              << std::endl;
+
+    // a quicksort the way users write it, with rest and push, against the
+    // builtin with and without a comparator in Monkey
+    std::vector<int64_t> shuffled(1000);
+    for (std::size_t i = 0; i < shuffled.size(); ++i) shuffled[i] = int64_t(i * 7919 % shuffled.size());
+    data->Set("small", MakeRef<ArrayObject>(shuffled));
+    auto quicksort = parse("let part = fn(arr, p, lo, hi) { if (len(arr) == 0) { [lo, hi] } else { let x = first(arr); "
+                           "if (x < p) { part(rest(arr), p, push(lo, x), hi) } else { part(rest(arr), p, lo, push(hi, x)) } } }; "
+                           "let cat = fn(a, b) { if (len(b) == 0) { a } else { cat(push(a, first(b)), rest(b)) } }; "
+                           "let qs = fn(arr) { if (len(arr) < 2) { arr } else { let p = first(arr); "
+                           "let parts = part(rest(arr), p, [], []); cat(push(qs(parts[0]), p), qs(parts[1])) } }; "
+                           "len(qs(small))");
+    auto builtinSort = parse("len(sort(small))");
+    auto comparatorSort = parse("len(sort(small, fn(a, b) { a < b }))");
+    double monkeySort = timeMs([&] { Evaluator::Eval(quicksort, MakeEnvironment(data)); }, runs);
+    double nativeSort = timeMs([&] { Evaluator::Eval(builtinSort, data); }, runs);
+    double calledBack = timeMs([&] { Evaluator::Eval(comparatorSort, data); }, runs);
+    std::cout << "sort of 1000 integers: quicksort in Monkey " << monkeySort << " ms, builtin " << nativeSort
+              << " ms (x" << monkeySort / nativeSort << "), builtin with a Monkey comparator " << calledBack << " ms (x"
+              << monkeySort / calledBack << ")" << std::endl;
+    return 0;
+}
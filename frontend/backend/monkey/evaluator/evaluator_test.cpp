@@ -2,9 +2,13 @@
 #include <cassert>
 #include <variant>
 #include <string>
+#include <thread>
 #include "evaluator.hpp"
+#include "flat_evaluator.hpp"
+#include "closure_compiler.hpp"
 #include "../lexer/lexer.hpp"
 #include "../object/object.hpp"
+#include "../object/heap.hpp"
 #include "../parser/parser.hpp"
 
 void TestEvalIntegerExpression();
@@ -15,14 +19,23 @@ void TestReturnStatements();
 void TestErrorHandling();
 void TestLetStatements();
 void TestFunctionObject();
+void TestFunctionPrototypes();
 void TestFunctionApplication();
 void TestEnclosingEnvironments();
 void TestClosures();
+void TestClosureCapture();
+void TestNursery();
+void TestCycleCollection();
 void TestStringLiteral();
-std::shared_ptr<Object> testEval(const std::string& input);
-bool testIntegerObject(const std::shared_ptr<Object>& obj, int64_t expected);
-bool testBooleanObject(const std::shared_ptr<Object>& obj, bool expected);
-bool testNullObject(const std::shared_ptr<Object> obj);
+ObjectRef testEval(const std::string& input);
+void runSuite();
+
+// the whole suite runs once on every engine
+enum class Engine { TREE, FLAT, CLOSURE };
+Engine engine = Engine::TREE;
+bool testIntegerObject(const ObjectRef& obj, int64_t expected);
+bool testBooleanObject(const ObjectRef& obj, bool expected);
+bool testNullObject(const ObjectRef obj);
 
 void TestEvalIntegerExpression(){
     struct TestCase {
@@ -111,23 +124,23 @@ void TestBangOperator(){
 void TestIfElseExpressions(){
     struct TestCase {
         std::string input;
-        std::shared_ptr<Object> expected;
+        ObjectRef expected;
     };
 
     std::vector<TestCase> tests = {
-        {"if (true) { 10 }", std::make_shared<Integer>(10)},
+        {"if (true) { 10 }", MakeRef<Integer>(10)},
 		{"if (false) { 10 }", nullptr},
-		{"if (1) { 10 }", std::make_shared<Integer>(10)},
-		{"if (1 < 2) { 10 }", std::make_shared<Integer>(10)},
+		{"if (1) { 10 }", MakeRef<Integer>(10)},
+		{"if (1 < 2) { 10 }", MakeRef<Integer>(10)},
 		{"if (1 > 2) { 10 }", nullptr},
-		{"if (1 > 2) { 10 } else { 20 }", std::make_shared<Integer>(20)},
-		{"if (1 < 2) { 10 } else { 20 }", std::make_shared<Integer>(10)},
+		{"if (1 > 2) { 10 } else { 20 }", MakeRef<Integer>(20)},
+		{"if (1 < 2) { 10 } else { 20 }", MakeRef<Integer>(10)},
     };
 
     for(const auto& tt : tests){
         auto evaluated = testEval(tt.input);
         if(tt.expected){
-            testIntegerObject(evaluated, std::static_pointer_cast<Integer>(tt.expected)->Value);
+            testIntegerObject(evaluated, StaticRefCast<Integer>(tt.expected)->Value);
         } else {
             testNullObject(evaluated);
         }
@@ -241,16 +254,16 @@ void TestErrorHandling(){
     };
 
     for (const auto& tt : tests) {
-        std::shared_ptr<Object> evaluated = testEval(tt.input);
-        std::shared_ptr<Error> errObj = std::dynamic_pointer_cast<Error>(evaluated);
+        ObjectRef evaluated = testEval(tt.input);
+        Ref<Error> errObj = DynamicRefCast<Error>(evaluated);
         if (!errObj) {
             auto& evaluated_ref = *evaluated;
             std::cerr << "no error object returned. got=" << typeid(evaluated_ref).name() << "\n";
             continue;
         }
 
-        if (errObj->Message != tt.expectedMessage) {
-            std::cerr << "wrong error message. expected=\"" << tt.expectedMessage << "\", got=\"" << errObj->Message << "\"\n";
+        if (errObj->Message() != tt.expectedMessage) {
+            std::cerr << "wrong error message. expected=\"" << tt.expectedMessage << "\", got=\"" << errObj->Message() << "\"\n";
         }
     }
 }
@@ -275,26 +288,45 @@ void TestLetStatements() {
 void TestFunctionObject() {
     std::string input = "fn(x) { x + 2; };";
 
-    std::shared_ptr<Object> evaluated = testEval(input);
-    std::shared_ptr<Function> fn = std::dynamic_pointer_cast<Function>(evaluated);
+    ObjectRef evaluated = testEval(input);
+    Ref<Function> fn = DynamicRefCast<Function>(evaluated);
     if (!fn) {
         throw std::runtime_error("Object is not Function.");
     }
 
-    if (fn->Parameters.size() != 1) {
+    if (fn->Parameters().size() != 1) {
         throw std::runtime_error("Function has wrong number of parameters.");
     }
 
-    if (fn->Parameters[0]->String() != "x") {
+    if (fn->Parameters()[0]->String() != "x") {
         throw std::runtime_error("Parameter is not 'x'.");
     }
 
     std::string expectedBody = "(x + 2)";
-    if (fn->Body->String() != expectedBody) {
+    if (fn->GetBody()->String() != expectedBody) {
         throw std::runtime_error("Body is not '" + expectedBody + "'.");
     }
 }
 
+void TestFunctionPrototypes() {
+    auto evaluated = testEval("let adder = fn(x) { fn(y) { x + y } }; [adder(1), adder(2)]");
+    auto array = DynamicRefCast<ArrayObject>(evaluated);
+    if (!array || array->Size() != 2) {
+        throw std::runtime_error("object is not an Array of two closures.");
+    }
+    auto a = DynamicRefCast<Function>(array->At(0));
+    auto b = DynamicRefCast<Function>(array->At(1));
+    if (!a || !b) {
+        throw std::runtime_error("array elements are not Functions.");
+    }
+    if (a->Prototype != b->Prototype || a->Prototype->Arity != 1) {
+        throw std::runtime_error("closures of one literal do not share its prototype.");
+    }
+    if (a.get() == b.get()) {
+        throw std::runtime_error("closures of one literal are the same object.");
+    }
+}
+
 void TestFunctionApplication(){
     struct TestCase {
         std::string input;
@@ -308,6 +340,10 @@ void TestFunctionApplication(){
 		{"let add = fn(x, y) { x + y; }; add(5, 5);", 10},
 		{"let add = fn(x, y) { x + y; }; add(5 + 5, add(5, 5));", 20},
 		{"fn(x) { x; }(5)", 5},
+		// more arguments than an argument buffer holds in place
+		{"let sum = fn(a, b, c, d, e, f, g, h, i, j) { a + b + c + d + e + f + g + h + i + j }; sum(1, 2, 3, 4, 5, 6, 7, 8, 9, 10);", 55},
+		{"let sum = fn(a, b, c, d, e, f, g, h, i, j) { a + b + c + d + e + f + g + h + i + j }; sum(1, 2, 3, 4, 5, 6, 7, 8, 9, sum(1, 1, 1, 1, 1, 1, 1, 1, 1, 1));", 55},
+		{"let count = fn(n, a, b, c, d, e, f, g, h, i) { if (n == 0) { a + i } else { count(n - 1, a + 1, b, c, d, e, f, g, h, i + 1) } }; count(600, 0, 0, 0, 0, 0, 0, 0, 0, 0);", 1200},
     };
     
     for(const auto& tt : tests){
@@ -343,10 +379,98 @@ void TestClosures() {
     testIntegerObject(testEval(input), 4);
 }
 
+void TestClosureCapture() {
+    struct TestCase {
+        std::string input;
+        int64_t expected;
+    };
+    std::vector<TestCase> tests = {
+        {"let f = fn() { let loop = fn(n) { if (n == 0) { 7 } else { loop(n - 1) } }; loop(5) }; f()", 7},
+        {"let f = fn() { let even = fn(n) { if (n == 0) { 1 } else { odd(n - 1) } }; "
+         "let odd = fn(n) { if (n == 0) { 0 } else { even(n - 1) } }; even(10) }; f()", 1},
+        {"let k = 3; let f = fn(x) { fn(y) { len([x, y]) + x + y + k } }; f(1)(2)", 8},
+        {"let f = fn(x) { fn() { fn() { x } } }; f(9)()()", 9},
+        // a let later in an enclosing call still binds what the closure sees
+        {"let x = 1; let f = fn() { let g = fn() { x }; let x = 5; g() }; f()", 5},
+        {"let f = fn() { let n = 0; let inc = fn() { n + 1 }; let n = 41; inc() }; f()", 42},
+        {"let f = fn(n) { let inc = fn() { n + 1 }; let n = 41; inc() }; f(0)", 42},
+        {"let f = fn() { let g = fn() { 1 }; let h = fn() { g() }; let g = fn() { 2 }; h() }; f()", 2},
+        {"let f = fn() { let y = 2; let g = fn() { if (true) { let y = 3; y } else { 0 } + y }; g() }; f()", 6},
+    };
+    for (const auto& tt : tests) {
+        testIntegerObject(testEval(tt.input), tt.expected);
+    }
+
+    // compiled closures keep their frames; the rest copy what they use
+    if (engine == Engine::CLOSURE) return;
+    auto fn = DynamicRefCast<Function>(testEval(
+        "let make = fn() { let big = [1, 2, 3]; let small = 5; fn() { small } }; make()"));
+    if (!fn || fn->Env->store.size() != 1 || !fn->Env->store.count("small") || fn->Env->outer->outer) {
+        std::cerr << "closure did not capture just the binding it uses" << std::endl;
+    }
+}
+
+void TestCycleCollection() {
+    // compiled closures reach their environment through frames, which the
+    // collector does not trace
+    if (engine == Engine::CLOSURE) return;
+
+    // a function lives exactly as long as the environment in its cycle
+    std::weak_ptr<Environment> global =
+        DynamicRefCast<Function>(testEval("let f = fn(n) { if (n == 0) { 0 } else { f(n - 1) } }; f"))->Env;
+    std::weak_ptr<Environment> local = DynamicRefCast<Function>(testEval(
+        "let make = fn() { let loop = fn(n) { if (n == 0) { 0 } else { loop(n - 1) } }; loop }; make()"))->Env;
+    auto live = DynamicRefCast<Function>(testEval("let g = fn(n) { g }; g"));
+    if (global.expired() || local.expired() || !live) {
+        throw std::runtime_error("recursive functions were freed without a collection.");
+    }
+
+    auto before = Heap::Stats();
+    auto freed = Heap::Collect();
+    auto after = Heap::Stats();
+    if (!global.expired() || !local.expired()) {
+        std::cerr << "cycle collection left a recursive function alive" << std::endl;
+    }
+    if (freed < 2 || after.Collections != before.Collections + 1 || after.TotalFreed != before.TotalFreed + freed) {
+        std::cerr << "heap stats do not match the collection. freed=" << freed << std::endl;
+    }
+    if (live->Env->store.count("g") != 1) {
+        std::cerr << "cycle collection cleared a live environment" << std::endl;
+    }
+}
+
+void TestNursery() {
+    auto chunks = [] { return Heap::Stats().NurseryChunks; };
+    // the current chunk of this thread, if it has none yet
+    MakeYoung<Integer>(0);
+    auto before = chunks();
+
+    std::vector<Ref<Integer>> kept;
+    for (int i = 0; i < 50000; ++i) {
+        auto temporary = MakeYoung<Integer>(i);
+        if (i % 1000 == 0) kept.push_back(temporary);
+    }
+    if (chunks() <= before || kept[7]->Value != 7000) {
+        throw std::runtime_error("survivors did not keep their nursery chunks.");
+    }
+    kept.clear();
+    if (chunks() > before + 1) {
+        std::cerr << "nursery chunks were not freed with their last survivor. got=" << chunks() << std::endl;
+    }
+
+    Ref<Integer> fromThread;
+    std::thread([&] { fromThread = MakeYoung<Integer>(42); }).join();
+    testIntegerObject(fromThread, 42);
+    fromThread.reset();
+    if (chunks() > before + 1) {
+        std::cerr << "a chunk of a finished thread was not freed. got=" << chunks() << std::endl;
+    }
+}
+
 void TestStringLiteral(){
     std::string input = R"("Hello World!")";
     auto evaluated = testEval(input);
-    auto str = std::dynamic_pointer_cast<String>(evaluated);
+    auto str = DynamicRefCast<String>(evaluated);
     if(!str) std::cerr << "object is not String. got=" << typeid(evaluated.get()).name() << std::endl;
 
     if(str->Value != "Hello World!") throw std::runtime_error("String has wrong value. got=" + str->Value);
@@ -355,7 +479,7 @@ void TestStringLiteral(){
 void TestStringConcatenation() {
     std::string input = R"("Hello" + " " + "World!")";
     auto evaluated = testEval(input);
-    auto str = std::dynamic_pointer_cast<String>(evaluated);
+    auto str = DynamicRefCast<String>(evaluated);
     if(!str) std::cerr << "object is not String. got=" << typeid(evaluated.get()).name() << std::endl;
     if(str->Value != "Hello World!") throw std::runtime_error("String has wrong value. got=" + str->Value);
 }
@@ -372,6 +496,7 @@ void TestBuiltinFunctions() {
         {"len(\"hello world\")", 11},
         {"len(1)", std::string("argument to `len` not supported, got INTEGER")},
         {"len(\"one\", \"two\")", std::string("wrong number of arguments. got=2, want=1")},
+        {"len(1, 2, 3, 4, 5, 6, 7, 8, 9)", std::string("wrong number of arguments. got=9, want=1")},
         {"len([1, 2, 3])", 3},
         {"len([])", 0},
         {"puts(\"hello\", \"world!\")", nullptr},
@@ -384,6 +509,72 @@ void TestBuiltinFunctions() {
         {"rest([1, 2, 3])", std::vector<int>{2, 3}},
         {"rest([])", nullptr},
         {"push([], 1)", std::vector<int>{1}},
+        {"push([1, 2], 3)", std::vector<int>{1, 2, 3}},
+        {"rest(push([5000, 6000], 7000))", std::vector<int>{6000, 7000}},
+        {"last(push([true, false], 1))", 1},
+        {"sum([1, 2, 3])", 6},
+        {"sum([])", 0},
+        {"sum(range(1000))", 499500},
+        {"sum([1, \"a\"])", std::string("argument to `sum` must be ARRAY of INTEGER, got ARRAY")},
+        {"sum([9223372036854775807, 1])", std::string("integer overflow in `sum`")},
+        {"min([5, 3, 8, -2, 7, 1, 9])", -2},
+        {"max([5, 3, 8, -2, 7, 1, 9])", 9},
+        {"min([])", nullptr},
+        {"max(1)", std::string("argument to `max` must be ARRAY of INTEGER, got INTEGER")},
+        {"dot(range(5), range(5))", 30},
+        {"dot([1], [1, 2])", std::string("arrays given to `dot` differ in length: 1 and 2")},
+        {"dot([4611686018427387904], [2])", std::string("integer overflow in `dot`")},
+        {"add(range(6), range(6, 0, -1))", std::vector<int>{6, 6, 6, 6, 6, 6}},
+        {"add([9223372036854775807, 0, 0, 0, 0], [1, 0, 0, 0, 0])", std::string("integer overflow in `add`")},
+        {"mul(range(1, 6), range(1, 6))", std::vector<int>{1, 4, 9, 16, 25}},
+        {"scale(range(5), 3)", std::vector<int>{0, 3, 6, 9, 12}},
+        {"scale([4611686018427387904], 2)", std::string("integer overflow in `scale`")},
+        {"range(4)", std::vector<int>{0, 1, 2, 3}},
+        {"range(10, 0, -3)", std::vector<int>{10, 7, 4, 1}},
+        {"range(3, 1)", std::vector<int>{}},
+        {"range(1, 2, 0)", std::string("argument to `range` not supported, got step 0")},
+        {"range(0, 9000000000000000000)", std::string("argument to `range` not supported, got length 9000000000000000000")},
+        {"range(0, 4000000000)", std::string("argument to `range` not supported, got length 4000000000")},
+        {"len(range(-268435456, 0, 1000000))", 269},
+        {"map([1, 2, 3], fn(x) { x * 2 })", std::vector<int>{2, 4, 6}},
+        {"map([], fn(x) { x })", std::vector<int>{}},
+        {"map([\"a\", \"bb\"], len)", std::vector<int>{1, 2}},
+        {"map([1, 2], fn(x) { let y = x * 10; y })", std::vector<int>{10, 20}},
+        {"let f = fn(k) { map([1, 2], fn(x) { x * k }) }; f(3)", std::vector<int>{3, 6}},
+        {"map([1], fn(a, b) { a })", std::string("wrong number of arguments. got=1, want=2")},
+        {"map([1], 5)", std::string("argument to `map` not supported, got INTEGER")},
+        {"map([1, 2], fn(x) { x + true })", std::string("type mismatch: INTEGER + BOOLEAN")},
+        {"filter(range(10), fn(x) { x > 6 })", std::vector<int>{7, 8, 9}},
+        {"filter([1, 2], fn(x) { false })", std::vector<int>{}},
+        {"reduce([1, 2, 3, 4], fn(acc, x) { acc + x }, 10)", 20},
+        {"reduce([1, 2, 3, 4], fn(acc, x) { acc * x })", 24},
+        {"reduce([], fn(acc, x) { acc })", nullptr},
+        {"reduce(range(5), fn(acc, x) { push(acc, x * x) }, [])", std::vector<int>{0, 1, 4, 9, 16}},
+        {"each([1, 2], fn(x) { x })", nullptr},
+        {"each([1, 2], fn(x) { x + \"a\" })", std::string("type mismatch: INTEGER + STRING")},
+        {"pmap([1, 2, 3], fn(x) { x + 1 })", std::vector<int>{2, 3, 4}},
+        {"sum(pmap(range(2000), fn(x) { x * 2 }))", 3998000},
+        {"let f = fn(k) { sum(pmap(range(2000), fn(x) { x * k })) }; f(3)", 5997000},
+        {"len(pmap(range(2000), fn(x) { puts(); x }))", 2000},
+        {"pmap(range(2000), fn(x) { if (x == 1500) { x + true } else { if (x == 1900) { x + \"a\" } else { x } } })", std::string("type mismatch: INTEGER + BOOLEAN")},
+        {"pmap([1], fn(a, b) { a })", std::string("wrong number of arguments. got=1, want=2")},
+        {"pmap(1, len)", std::string("argument to `pmap` must be ARRAY, got INTEGER")},
+        {"preduce(range(2000), fn(a, b) { a + b }, 0)", 1999000},
+        {"preduce(range(1, 6), fn(a, b) { a * b })", 120},
+        {"preduce([], fn(a, b) { a })", nullptr},
+        {"preduce([], fn(a, b) { a }, 7)", 7},
+        {"preduce([1], 5)", std::string("argument to `preduce` not supported, got INTEGER")},
+        {"sort([3, 1, 2])", std::vector<int>{1, 2, 3}},
+        {"sort([])", std::vector<int>{}},
+        {"let p = map(range(200), fn(x) { x * 37 - x * 37 / 200 * 200 }); sum(mul(sort(p), range(200)))", 2646700},
+        {"let p = map(range(200), fn(x) { x * 37 - x * 37 / 200 * 200 }); sum(mul(sort(p, fn(a, b) { a < b }), range(200)))", 2646700},
+        {"map(sort([\"ccc\", \"a\", \"bb\"], fn(a, b) { len(a) < len(b) }), len)", std::vector<int>{1, 2, 3}},
+        {"len(sort(range(500), fn(a, b) { true }))", 500},
+        {"sort([1, 2, 3], fn(a, b) { a + true })", std::string("type mismatch: INTEGER + BOOLEAN")},
+        {"sort([1, \"a\"])", std::string("argument to `sort` not supported, got ARRAY of INTEGER and STRING")},
+        {"sort([true, false])", std::string("argument to `sort` not supported, got ARRAY of BOOLEAN")},
+        {"sort([1], fn(a) { a })", std::string("wrong number of arguments. got=2, want=1")},
+        {"sort(1)", std::string("argument to `sort` must be ARRAY, got INTEGER")},
         {"push(1, 1)", std::string("argument to `push` must be ARRAY, got INTEGER")}
     };
 
@@ -397,80 +588,126 @@ void TestBuiltinFunctions() {
             } else if constexpr (std::is_same_v<T, std::nullptr_t>) {
                 testNullObject(evaluated);
             } else if constexpr (std::is_same_v<T, std::string>) {
-                auto errObj = std::dynamic_pointer_cast<Error>(evaluated);
+                auto errObj = DynamicRefCast<Error>(evaluated);
                 if(!errObj) std::cerr << "object is not Error. got=" << typeid(evaluated).name() << std::endl;
                 const std::string& expectedError = std::get<std::string>(tt.expected);
-                if (errObj->Message != expectedError) {
-                    std::cerr << "wrong error message. expected=" << expectedError << ", got=" << errObj->Message << std::endl;
+                if (errObj->Message() != expectedError) {
+                    std::cerr << "wrong error message. expected=" << expectedError << ", got=" << errObj->Message() << std::endl;
                 }
             } else if constexpr (std::is_same_v<T, std::vector<int>>) {
-                auto array = std::dynamic_pointer_cast<ArrayObject>(evaluated);
+                auto array = DynamicRefCast<ArrayObject>(evaluated);
                 if (!array) {
                     std::cerr << "obj not Array. got=" << typeid(evaluated).name() << std::endl;
                     return;
                 }
                 // Extract the vector from the variant for comparison
                 const std::vector<int>& expectedVector = std::get<std::vector<int>>(tt.expected);
-                if (array->Elements.size() != expectedVector.size()) {
-                    std::cerr << "wrong num of elements. want=" << expectedVector.size() << " got=" << array->Elements.size() << "\n";
+                if (array->Size() != expectedVector.size()) {
+                    std::cerr << "wrong num of elements. want=" << expectedVector.size() << " got=" << array->Size() << "\n";
                 }
                 for (size_t i = 0; i < expectedVector.size(); ++i) {
-                    testIntegerObject(array->Elements[i], expectedVector[i]);
+                    testIntegerObject(array->At(i), expectedVector[i]);
                 }
             }
         }, tt.expected);
     }
+
+    // only the exact total has to fit, however the partial sums wrap
+    testBooleanObject(testEval("sum([9223372036854775807, 1, 2, 3, 4, 5, 6, -30]) == 9223372036854775798"), true);
+
+    // a callback's environment is only reused when nothing kept it
+    testIntegerObject(testEval("let fs = map([1, 2, 3], fn(x) { fn() { x } }); fs[0]() + fs[2]()"), 4);
 }
 
 void TestArrayLiteral() {
     std::string input = "[1, 2 * 2, 3 + 3]";
     auto evaluated = testEval(input);
-    auto result = std::dynamic_pointer_cast<ArrayObject>(evaluated);
+    auto result = DynamicRefCast<ArrayObject>(evaluated);
     if(!result) std::cerr << "object is not Array. got=" << evaluated << std::endl;
-    if(result->Elements.size() != 3) std::cerr << "array has wrong num of elements. got=" << result->Elements.size() << "\n";
-    testIntegerObject(result->Elements[0], 1);
-	testIntegerObject(result->Elements[1], 4);
-	testIntegerObject(result->Elements[2], 6);
+    if(result->Size() != 3) std::cerr << "array has wrong num of elements. got=" << result->Size() << "\n";
+    testIntegerObject(result->At(0), 1);
+	testIntegerObject(result->At(1), 4);
+	testIntegerObject(result->At(2), 6);
+}
+
+void TestPackedArrays() {
+    struct TestCase {
+        std::string input;
+        ElementsKind kind;
+        std::string inspected;
+    };
+
+    std::vector<TestCase> tests = {
+        {"[1, 2 * 2, 3 + 3]", ElementsKind::PACKED_INT, "[1, 4, 6]"},
+        {"[100000, -100000]", ElementsKind::PACKED_INT, "[100000, -100000]"},
+        {"[]", ElementsKind::PACKED_INT, "[]"},
+        {"[true, 1 < 2, false]", ElementsKind::PACKED_BOOL, "[true, true, false]"},
+        {"[1, true]", ElementsKind::GENERIC, "[1, true]"},
+        {"push([1, 2], \"three\")", ElementsKind::GENERIC, "[1, 2, three]"},
+        {"push([], true)", ElementsKind::PACKED_BOOL, "[true]"},
+        {"rest([1, \"a\", 3])", ElementsKind::GENERIC, "[a, 3]"},
+        {"let f = fn() { [1, 2, 3, 4, 5] }; rest(f())", ElementsKind::PACKED_INT, "[2, 3, 4, 5]"},
+        {"sort([\"pear\", \"apple\", \"fig\"])", ElementsKind::GENERIC, "[apple, fig, pear]"},
+        {"sort(rest([\"a\", 3, 1, 2]))", ElementsKind::PACKED_INT, "[1, 2, 3]"},
+        {"let s = sort(push(push(range(100, 0, -1), 9223372036854775807), -2000000000)); [s[0], s[1], s[100], s[101]]",
+         ElementsKind::PACKED_INT, "[-2000000000, 1, 100, 9223372036854775807]"},
+        {"sort([3, 1, 2], fn(a, b) { a > b })", ElementsKind::PACKED_INT, "[3, 2, 1]"},
+    };
+
+    for (const auto& tt : tests) {
+        auto array = DynamicRefCast<ArrayObject>(testEval(tt.input));
+        if (!array) {
+            std::cerr << tt.input << " is not an array\n";
+            continue;
+        }
+        if (array->Kind() != tt.kind || array->Inspect() != tt.inspected) {
+            std::cerr << tt.input << " gave " << array->Inspect() << " of kind " << static_cast<int>(array->Kind()) << "\n";
+        }
+    }
+
+    // booleans come back as the shared TRUE and FALSE, so == still works
+    testBooleanObject(testEval("[true, false][1] == false"), true);
+    testIntegerObject(testEval("[1000000, 2000000][1] - [1000000, 2000000][0]"), 1000000);
 }
 
 void TestArrayIndexExpressions() {
     struct TestCase {
         std::string input;
-        std::shared_ptr<Object> expected;
+        ObjectRef expected;
     };
 
     std::vector<TestCase> tests = {
         {
 			"[1, 2, 3][0]",
-			std::make_shared<Integer>(1),
+			MakeRef<Integer>(1),
 		},
 		{
 			"[1, 2, 3][1]",
-			std::make_shared<Integer>(2),
+			MakeRef<Integer>(2),
 		},
 		{
 			"[1, 2, 3][2]",
-			std::make_shared<Integer>(3),
+			MakeRef<Integer>(3),
 		},
 		{
 			"let i = 0; [1][i];",
-			std::make_shared<Integer>(1),
+			MakeRef<Integer>(1),
 		},
 		{
 			"[1, 2, 3][1 + 1];",
-			std::make_shared<Integer>(3),
+			MakeRef<Integer>(3),
 		},
 		{
 			"let myArray = [1, 2, 3]; myArray[2];",
-			std::make_shared<Integer>(3),
+			MakeRef<Integer>(3),
 		},
 		{
 			"let myArray = [1, 2, 3]; myArray[0] + myArray[1] + myArray[2];",
-			std::make_shared<Integer>(6),
+			MakeRef<Integer>(6),
 		},
 		{
 			"let myArray = [1, 2, 3]; let i = myArray[0]; myArray[i]",
-			std::make_shared<Integer>(2),
+			MakeRef<Integer>(2),
 		},
 		{
 			"[1, 2, 3][3]",
@@ -485,7 +722,7 @@ void TestArrayIndexExpressions() {
     for(const auto& tt: tests){
         auto evaluated = testEval(tt.input);
         if(tt.expected){
-            testIntegerObject(evaluated, std::static_pointer_cast<Integer>(tt.expected)->Value);
+            testIntegerObject(evaluated, StaticRefCast<Integer>(tt.expected)->Value);
         } else {
             testNullObject(evaluated);
         }
@@ -506,14 +743,14 @@ void TestHashLiterals() {
     )";
 
     auto evaluated = testEval(input);
-    auto result = std::dynamic_pointer_cast<Hash>(evaluated);
+    auto result = DynamicRefCast<Hash>(evaluated);
     if(!result) std::cerr << "Eval didn't return Hash. got=" << evaluated << std::endl;
 
     auto expected = std::map<HashKey, int64_t>{
-        { std::make_shared<String>("one")->keyHash(), 1 },
-        { std::make_shared<String>("two")->keyHash(), 2 },
-        { std::make_shared<String>("three")->keyHash(), 3 },
-        { std::make_shared<Integer>(4)->keyHash(), 4 },
+        { MakeRef<String>("one")->keyHash(), 1 },
+        { MakeRef<String>("two")->keyHash(), 2 },
+        { MakeRef<String>("three")->keyHash(), 3 },
+        { MakeRef<Integer>(4)->keyHash(), 4 },
         { ObjectConstants::TRUE->keyHash(), 5 },
         { ObjectConstants::FALSE->keyHash(), 6 },
     };
@@ -535,13 +772,13 @@ void TestHashLiterals() {
 void TestHashIndexExpressions() {
     struct TestCase {
         std::string input;
-        std::shared_ptr<Object> expected;
+        ObjectRef expected;
     };
 
     std::vector<TestCase> tests = {
         {
 			"{\"foo\": 5}[\"foo\"]",
-			std::make_shared<Integer>(5),
+			MakeRef<Integer>(5),
 		},
 		{
 			"{\"foo\": 5}[\"bar\"]",
@@ -549,7 +786,7 @@ void TestHashIndexExpressions() {
 		},
 		{
 			"let key = \"foo\"; {\"foo\": 5}[key]",
-			std::make_shared<Integer>(5),
+			MakeRef<Integer>(5),
 		},
 		{
 			"{}[\"foo\"]",
@@ -557,22 +794,22 @@ void TestHashIndexExpressions() {
 		},
 		{
 			"{5: 5}[5]",
-			std::make_shared<Integer>(5),
+			MakeRef<Integer>(5),
 		},
 		{
 			"{true: 5}[true]",
-			std::make_shared<Integer>(5),
+			MakeRef<Integer>(5),
 		},
 		{
 			"{false: 5}[false]",
-			std::make_shared<Integer>(5),
+			MakeRef<Integer>(5),
 		},
     };
 
     for(const auto& tt: tests){
         auto evaluated = testEval(tt.input);
         if(tt.expected){
-            testIntegerObject(evaluated, std::static_pointer_cast<Integer>(tt.expected)->Value);
+            testIntegerObject(evaluated, StaticRefCast<Integer>(tt.expected)->Value);
         } else {
             testNullObject(evaluated);
         }
@@ -580,18 +817,148 @@ void TestHashIndexExpressions() {
 
 }
 
-std::shared_ptr<Object> testEval(const std::string& input) {
+std::string inspectOrNull(const ObjectRef& obj) {
+    return obj ? obj->Inspect() : "<nullptr>";
+}
+
+void TestPackedLiterals() {
+    std::string input = "let f = fn() { [10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25] };\n"
+                        "let g = fn() { {\"a\": 1, \"b\": 2, \"c\": 3, \"d\": 4, \"e\": 5, \"f\": 6, \"g\": 7, \"h\": 8,\n"
+                        "                 \"i\": 9, \"j\": 10, \"k\": 11, \"l\": 12, 1: true, true: 14, false: 15, \"p\": 16} };\n";
+
+    testIntegerObject(testEval(input + "f()[3] + len(f())"), 29);
+    testIntegerObject(testEval(input + "g()[\"k\"] + g()[true]"), 25);
+    testBooleanObject(testEval(input + "g()[1]"), true);
+
+    // each evaluation makes a new array or hash, as unpacked literals do,
+    // while a hash's keys and values are built once
+    auto fresh = DynamicRefCast<ArrayObject>(testEval(input + "let h = fn() { [1, 2] }; [f() == f(), g() == g(), h() == h()]"));
+    if (!fresh || fresh->Inspect() != "[false, false, false]") {
+        std::cerr << "packed literals gave " << inspectOrNull(fresh) << " for [f() == f(), g() == g(), h() == h()]" << std::endl;
+    }
+    auto hashes = DynamicRefCast<ArrayObject>(testEval(input + "[g(), g()]"));
+    auto first = hashes ? DynamicRefCast<Hash>(hashes->At(0)) : nullptr;
+    auto second = hashes ? DynamicRefCast<Hash>(hashes->At(1)) : nullptr;
+    bool shared = first && second && first != second && first->Pairs.size() == second->Pairs.size();
+    if (shared) {
+        for (auto a = first->Pairs.begin(), b = second->Pairs.begin(); shared && a != first->Pairs.end(); ++a, ++b) {
+            shared = a->second.Key == b->second.Key && a->second.Value == b->second.Value;
+        }
+    }
+    if (!shared) std::cerr << "packed hash literal's pairs were rebuilt on the second evaluation" << std::endl;
+}
+
+void TestFlatEvaluator() {
+    std::vector<std::string> inputs = {
+        "5 + 5 * 2 - -3 / 1",
+        "!true == !!false",
+        "if (1 < 2) { 10 } else { 20 }",
+        "if (1 > 2) { 10 }",
+        "if (10 > 1) { if (10 > 1) { return 10; } return 1; }",
+        "let f = fn(x) { return x * 2; 99 }; f(4) + 1",
+        "let x = if (true) { return 5; }; x",
+        "5 + true; 5;",
+        "-true",
+        "foobar",
+        "let newAdder = fn(x) { fn(y) { x + y } }; let addTwo = newAdder(2); addTwo(2);",
+        "\"Hello\" + \" \" + \"World!\"",
+        "\"Hello\" - \"World\"",
+        "len(\"four\") + len([1, 2, 3])",
+        "let a = [1, 2 * 2, 3 + 3]; a[1] + a[2] + a[10 - 10]",
+        "push(rest([1, 2, 3]), first([9]))",
+        "[1, 2][-1]",
+        "[1, foo, 3]",
+        "let two = \"two\"; {\"one\": 10 - 9, two: 1 + 1, \"thr\" + \"ee\": 6 / 2, 4: 4, true: 5}",
+        "{\"name\": \"Monkey\"}[fn(x) { x }]",
+        "{fn(x) { x }: 1}",
+        "[1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16][15]",
+        "let map = fn(arr, f) { let iter = fn(a, acc) { if (len(a) == 0) { acc } else { iter(rest(a), push(acc, f(first(a)))) } }; iter(arr, []) }; map([1, 2, 3, 4], fn(x) { x * x })",
+        "let fib = fn(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } }; fib(15)",
+        "1(2)",
+        "let f = fn() { }; f()",
+        "let x = 1;",
+        "",
+    };
+
+    for (const auto& input : inputs) {
+        Lexer l(input);
+        Parser p(l);
+        auto program = p.ParseProgram();
+        auto want = Evaluator::Eval(program, std::make_shared<Environment>());
+        auto got = FlatEvaluator::Eval(*program, std::make_shared<Environment>());
+        if (inspectOrNull(got) != inspectOrNull(want)) {
+            std::cerr << "flat evaluator differs for " << input << ": expected=" << inspectOrNull(want)
+                      << ", got=" << inspectOrNull(got) << std::endl;
+        }
+    }
+
+    // recursion depth is only bounded by memory
+    std::string deep = "let count = fn(n) { if (n == 0) { 0 } else { 1 + count(n - 1) } }; count(100000)";
+    Lexer dl(deep);
+    Parser dp(dl);
+    testIntegerObject(FlatEvaluator::Eval(*dp.ParseProgram(), std::make_shared<Environment>()), 100000);
+
+    // two scripts taking turns on one thread
+    std::vector<std::string> scripts = {
+        "let sum = fn(n) { if (n == 0) { 0 } else { n + sum(n - 1) } }; sum(100)",
+        "let fib = fn(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } }; fib(10)",
+    };
+    std::vector<std::unique_ptr<FlatEvaluator>> running;
+    for (const auto& script : scripts) {
+        Lexer l(script);
+        Parser p(l);
+        running.push_back(std::make_unique<FlatEvaluator>(FlatProgram::Flatten(*p.ParseProgram()), std::make_shared<Environment>()));
+    }
+    int turns = 0;
+    while (!running[0]->Done() || !running[1]->Done()) {
+        for (auto& evaluator : running) evaluator->Run(7);
+        turns++;
+    }
+    assert(turns > 10);
+    testIntegerObject(running[0]->Result(), 5050);
+    testIntegerObject(running[1]->Result(), 55);
+}
+
+void TestLazyFunctionBodies() {
+    std::string input = "let unused = fn() { let = ; };\n"
+                        "let add = fn(a, b) { let twice = fn(x) { x * 2 }; twice(a) + b };\n";
+    auto run = [](const std::string& src) {
+        Lexer l(src);
+        Parser p(l);
+        p.SetLazyFunctionBodies(true);
+        auto program = p.ParseProgram();
+        return Evaluator::Eval(program, std::make_shared<Environment>());
+    };
+
+    testIntegerObject(run(input + "add(5, 1)"), 11);
+
+    auto err = DynamicRefCast<Error>(run(input + "unused()"));
+    if (!err || err->Message() != "could not parse function body: expected next token to be IDENT, got = instead") {
+        std::cerr << "calling a function with a broken body did not report its parse error" << std::endl;
+    }
+    err = DynamicRefCast<Error>(run("let broken = fn(x) { let = ; }; map([1], broken)"));
+    if (!err || err->Message() != "could not parse function body: expected next token to be IDENT, got = instead") {
+        std::cerr << "a callback with a broken body did not report its parse error" << std::endl;
+    }
+}
+
+ObjectRef testEval(const std::string& input) {
     Lexer l(input);
     Parser p(l);
     auto program = p.ParseProgram();
     //std::cout << "input: " << input << " program: " << program->String() << std::endl; 
     auto env = std::make_shared<Environment>();
+    switch (engine) {
+        case Engine::FLAT: return FlatEvaluator::Eval(*program, env);
+        case Engine::CLOSURE: return ClosureCompiler::Eval(*program, env);
+        default: break;
+    }
     Evaluator evaluator;
     return evaluator.Eval(program, env);
 }
 
-bool testIntegerObject(const std::shared_ptr<Object>& obj, int64_t expected) {
-    auto result = std::dynamic_pointer_cast<Integer>(obj);
+bool testIntegerObject(const ObjectRef& obj, int64_t expected) {
+    auto result = DynamicRefCast<Integer>(obj);
     if (!result) {
         std::cerr << "Object is not Integer. Got=" << typeid(obj.get()).name() << std::endl;
         return false;
@@ -603,8 +970,8 @@ bool testIntegerObject(const std::shared_ptr<Object>& obj, int64_t expected) {
     return true;
 }
 
-bool testBooleanObject(const std::shared_ptr<Object>& obj, bool expected) {
-    auto result = std::dynamic_pointer_cast<BooleanObject>(obj);
+bool testBooleanObject(const ObjectRef& obj, bool expected) {
+    auto result = DynamicRefCast<BooleanObject>(obj);
     if (!result) {
         std::cerr << "Object is not Boolean. Got=" << typeid(obj.get()).name() << std::endl;
         return false;
@@ -616,7 +983,7 @@ bool testBooleanObject(const std::shared_ptr<Object>& obj, bool expected) {
     return true;
 }
 
-bool testNullObject(const std::shared_ptr<Object> obj) {
+bool testNullObject(const ObjectRef obj) {
     if (obj != nullptr && typeid(obj->Type()) != typeid(NULL_OBJ)) {
         std::cerr << "Object is not NULL. Got=" << typeid(obj.get()).name() << std::endl;
         return false;
@@ -625,6 +992,16 @@ bool testNullObject(const std::shared_ptr<Object> obj) {
 }
 
 int main() {
+    for (auto e : {Engine::TREE, Engine::FLAT, Engine::CLOSURE}) {
+        engine = e;
+        runSuite();
+    }
+    TestNursery();
+    std::cout << "All evaluator_test.cpp tests passed!" << std::endl;
+    return 0;
+}
+
+void runSuite() {
     TestEvalIntegerExpression();
     TestEvalBooleanExpression();
     TestBangOperator();
@@ -633,18 +1010,23 @@ int main() {
     TestErrorHandling();
     TestLetStatements();
     TestFunctionObject();
+    TestFunctionPrototypes();
     TestFunctionApplication();
     TestEnclosingEnvironments();
     TestClosures();
+    TestClosureCapture();
+    TestCycleCollection();
     TestStringLiteral();
     TestStringConcatenation();
     TestBuiltinFunctions();
     TestArrayLiteral();
     TestArrayIndexExpressions();
+    TestPackedArrays();
     TestHashLiterals();
     TestHashIndexExpressions();
-    std::cout << "All evaluator_test.cpp tests passed!" << std::endl;
-    return 0;
+    TestPackedLiterals();
+    TestLazyFunctionBodies();
+    TestFlatEvaluator();
 }
 
 // g++ -std=c++17 -Isrc -c src/monkey/parser/parser.cpp -o parser.o
@@ -0,0 +1,329 @@
+#include "flat_evaluator.hpp"
+
+//flat_evaluator.cpp
+
+std::shared_ptr<FlatProgram> FlatProgram::Flatten(const Program& program) {
+    auto flat = std::make_shared<FlatProgram>();
+    std::unordered_map<std::string, uint32_t> names;
+    std::vector<uint32_t> statements;
+    for (const auto& stmt : program.Statements) {
+        statements.push_back(flat->flatten(stmt, names));
+    }
+    flat->emit(FlatKind::PROGRAM, 0, statements);
+    return flat;
+}
+
+uint32_t FlatProgram::flatten(const std::shared_ptr<Node>& node, std::unordered_map<std::string, uint32_t>& names) {
+    auto name = [&](const std::string& n) {
+        auto it = names.emplace(n, Names.size()).first;
+        if (it->second == Names.size()) Names.push_back(n);
+        return it->second;
+    };
+    auto constant = [&](ObjectRef obj) {
+        Constants.push_back(std::move(obj));
+        return emit(FlatKind::CONSTANT, Constants.size() - 1, {});
+    };
+
+    if (auto n = std::dynamic_pointer_cast<BlockStatement>(node)) {
+        std::vector<uint32_t> statements;
+        for (const auto& stmt : n->Statements) statements.push_back(flatten(stmt, names));
+        return emit(FlatKind::BLOCK, 0, statements);
+    } else if (auto n = std::dynamic_pointer_cast<ExpressionStatement>(node)) {
+        return flatten(n->expr, names);
+    } else if (auto n = std::dynamic_pointer_cast<LetStatement>(node)) {
+        return emit(FlatKind::LET, name(n->Name->Value()), {flatten(n->Value, names)});
+    } else if (auto n = std::dynamic_pointer_cast<ReturnStatement>(node)) {
+        return emit(FlatKind::RETURN, 0, {flatten(n->ReturnValue, names)});
+    } else if (auto n = std::dynamic_pointer_cast<IntegerLiteral>(node)) {
+        return constant(MakeGlobal<Integer>(n->Value));
+    } else if (auto n = std::dynamic_pointer_cast<StringLiteral>(node)) {
+        return constant(MakeGlobal<String>(n->Value));
+    } else if (auto n = std::dynamic_pointer_cast<Boolean>(node)) {
+        return constant(Evaluator::nativeBoolToBooleanObject(n->Value));
+    } else if (auto n = std::dynamic_pointer_cast<Identifier>(node)) {
+        return emit(FlatKind::IDENTIFIER, name(n->Value()), {});
+    } else if (auto n = std::dynamic_pointer_cast<PrefixExpression>(node)) {
+        return emit(FlatKind::PREFIX, name(n->Operator), {flatten(n->Right, names)});
+    } else if (auto n = std::dynamic_pointer_cast<InfixExpression>(node)) {
+        auto left = flatten(n->Left, names);
+        return emit(FlatKind::INFIX, name(n->Operator), {left, flatten(n->Right, names)});
+    } else if (auto n = std::dynamic_pointer_cast<IfExpression>(node)) {
+        std::vector<uint32_t> children{flatten(n->Condition, names)};
+        children.push_back(flatten(n->Consequence, names));
+        if (n->Alternative) children.push_back(flatten(n->Alternative, names));
+        return emit(FlatKind::IF, 0, children);
+    } else if (auto n = std::dynamic_pointer_cast<FunctionLiteral>(node)) {
+        // a body that failed to parse is left out, calls then report it
+        std::vector<uint32_t> children;
+        if (const auto& body = n->GetBody()) children.push_back(flatten(body, names));
+        Literals.push_back(n);
+        auto index = emit(FlatKind::FUNCTION, Literals.size() - 1, children);
+        Functions[n.get()] = index;
+        return index;
+    } else if (auto n = std::dynamic_pointer_cast<CallExpression>(node)) {
+        std::vector<uint32_t> children{flatten(n->Function, names)};
+        for (const auto& arg : n->Arguments) children.push_back(flatten(arg, names));
+        return emit(FlatKind::CALL, 0, children);
+    } else if (auto n = std::dynamic_pointer_cast<ArrayLiteral>(node)) {
+        std::vector<uint32_t> children;
+        for (const auto& elem : n->Elements) children.push_back(flatten(elem, names));
+        return emit(FlatKind::ARRAY, 0, children);
+    } else if (auto n = std::dynamic_pointer_cast<IndexExpression>(node)) {
+        auto left = flatten(n->Left, names);
+        return emit(FlatKind::INDEX, 0, {left, flatten(n->Index, names)});
+    } else if (auto n = std::dynamic_pointer_cast<HashLiteral>(node)) {
+        // keys and values alternate, in the order Evaluator::Eval visits them
+        std::vector<uint32_t> children;
+        for (const auto& pair : n->Pairs) {
+            children.push_back(flatten(pair.first, names));
+            children.push_back(flatten(pair.second, names));
+        }
+        return emit(FlatKind::HASH, 0, children);
+    } else if (auto n = std::dynamic_pointer_cast<PackedLiteral>(node)) {
+        Literals.push_back(n);
+        return emit(FlatKind::PACKED, Literals.size() - 1, {});
+    }
+
+    // Evaluator::Eval gives nullptr for anything else
+    return constant(nullptr);
+}
+
+uint32_t FlatProgram::emit(FlatKind kind, uint32_t data, const std::vector<uint32_t>& children) {
+    FlatNode node{kind, data, static_cast<uint32_t>(Children.size()), static_cast<uint32_t>(children.size())};
+    Children.insert(Children.end(), children.begin(), children.end());
+    Nodes.push_back(node);
+    return Nodes.size() - 1;
+}
+
+FlatEvaluator::FlatEvaluator(std::shared_ptr<const FlatProgram> program, std::shared_ptr<Environment> env)
+    : program(std::move(program)), envs{std::move(env)} {
+    push(this->program->Root());
+}
+
+ObjectRef FlatEvaluator::Eval(const Program& program, std::shared_ptr<Environment> env) {
+    FlatEvaluator evaluator(FlatProgram::Flatten(program), std::move(env));
+    evaluator.Run();
+    return evaluator.Result();
+}
+
+bool FlatEvaluator::Run(std::size_t maxSteps) {
+    for (std::size_t i = 0; i < maxSteps && !tasks.empty(); ++i) {
+        step();
+    }
+    return Done();
+}
+
+ObjectRef FlatEvaluator::Result() const {
+    return values.empty() ? nullptr : values.back();
+}
+
+void FlatEvaluator::push(uint32_t node) {
+    tasks.push_back(Task{node, 0, values.size()});
+}
+
+// Replaces whatever the current task left on the value stack with its
+// result, and pops the task.
+void FlatEvaluator::finish(ObjectRef result) {
+    values.resize(tasks.back().base);
+    values.push_back(std::move(result));
+    tasks.pop_back();
+}
+
+// One step of the task on top. A task with children pushes them one at a
+// time, bumping its step, and looks at each child's value (on top of the
+// value stack) when it comes back to it, in the same order and with the
+// same error checks as Evaluator::Eval.
+void FlatEvaluator::step() {
+    Task& t = tasks.back();
+    const FlatProgram& p = *program;
+    const FlatNode& n = p.Nodes[t.node];
+
+    switch (n.Kind) {
+    case FlatKind::CONSTANT:
+        finish(p.Constants[n.Data]);
+        return;
+    case FlatKind::IDENTIFIER:
+        finish(Evaluator::lookupIdentifier(p.Names[n.Data], envs.back()));
+        return;
+    case FlatKind::FUNCTION: {
+        const auto& lit = static_cast<const FunctionLiteral&>(*p.Literals[n.Data]);
+        // a function bound by a let may call itself by that name
+        const std::string* self = nullptr;
+        if (tasks.size() > 1) {
+            const FlatNode& parent = p.Nodes[tasks[tasks.size() - 2].node];
+            if (parent.Kind == FlatKind::LET) self = &p.Names[parent.Data];
+        }
+        finish(Evaluator::makeClosure(lit, envs.back(), self));
+        return;
+    }
+    case FlatKind::PACKED:
+        finish(Evaluator::evalPackedLiteral(static_cast<const PackedLiteral&>(*p.Literals[n.Data])));
+        return;
+
+    case FlatKind::PROGRAM:
+    case FlatKind::BLOCK:
+        if (t.step > 0) {
+            auto last = values.back();
+            if (n.Kind == FlatKind::PROGRAM && last && last->Type() == RETURN_VALUE_OBJ) {
+                finish(Evaluator::unwrapReturnValue(last));
+                return;
+            }
+            if (last && (last->Type() == RETURN_VALUE_OBJ || last->Type() == ERROR_OBJ)) {
+                finish(last);
+                return;
+            }
+            if (t.step == n.ChildCount) {
+                finish(last);
+                return;
+            }
+            values.pop_back();
+        }
+        if (n.ChildCount == 0) {
+            finish(nullptr);
+            return;
+        }
+        push(p.Child(n, t.step++));
+        return;
+
+    case FlatKind::LET:
+    case FlatKind::RETURN:
+    case FlatKind::PREFIX:
+        if (t.step == 0) {
+            t.step = 1;
+            push(p.Child(n, 0));
+            return;
+        }
+        if (Evaluator::isError(values.back())) {
+            finish(values.back());
+        } else if (n.Kind == FlatKind::LET) {
+            envs.back()->Set(p.Names[n.Data], values.back());
+            finish(nullptr);
+        } else if (n.Kind == FlatKind::RETURN) {
+            finish(MakeRef<ReturnValue>(values.back()));
+        } else {
+            finish(Evaluator::evalPrefixExpression(p.Names[n.Data], values.back()));
+        }
+        return;
+
+    case FlatKind::INFIX:
+    case FlatKind::INDEX:
+        if (t.step == 0) {
+            t.step = 1;
+            push(p.Child(n, 0));
+        } else if (t.step == 1) {
+            if (Evaluator::isError(values.back())) {
+                finish(values.back());
+                return;
+            }
+            t.step = 2;
+            push(p.Child(n, 1));
+        } else if (n.Kind == FlatKind::INDEX) {
+            // the index itself is not checked for errors, as in Evaluator::Eval
+            finish(Evaluator::evalIndexExpression(values[t.base], values[t.base + 1]));
+        } else if (Evaluator::isError(values.back())) {
+            finish(values.back());
+        } else {
+            finish(Evaluator::evalInfixExpression(p.Names[n.Data], values[t.base], values[t.base + 1]));
+        }
+        return;
+
+    case FlatKind::IF:
+        if (t.step == 0) {
+            t.step = 1;
+            push(p.Child(n, 0));
+        } else if (t.step == 1) {
+            auto condition = values.back();
+            if (Evaluator::isError(condition)) {
+                finish(condition);
+            } else if (Evaluator::isTruthy(condition)) {
+                t.step = 2;
+                push(p.Child(n, 1));
+            } else if (n.ChildCount == 3) {
+                t.step = 2;
+                push(p.Child(n, 2));
+            } else {
+                finish(ObjectConstants::NULL_OBJ);
+            }
+        } else {
+            finish(values.back());
+        }
+        return;
+
+    case FlatKind::ARRAY:
+        if (t.step > 0 && Evaluator::isError(values.back())) {
+            finish(values.back());
+        } else if (t.step < n.ChildCount) {
+            push(p.Child(n, t.step++));
+        } else {
+            finish(MakeYoung<ArrayObject>(
+                std::vector<ObjectRef>(values.begin() + t.base, values.end())));
+        }
+        return;
+
+    case FlatKind::HASH:
+        // odd steps come back from a key; a value is stored even when it
+        // is an error, as in Evaluator::evalHashLiteral
+        if (t.step % 2 == 1) {
+            auto key = values.back();
+            if (Evaluator::isError(key)) {
+                finish(key);
+                return;
+            }
+            if (!IsHashable(key->Type())) {
+                finish(Evaluator::newError(ErrorCode::UNUSABLE_HASH_KEY, ObjectTypeToString(key->Type())));
+                return;
+            }
+        }
+        if (t.step < n.ChildCount) {
+            push(p.Child(n, t.step++));
+        } else {
+            std::map<HashKey, HashPair> pairs;
+            for (std::size_t i = t.base; i < values.size(); i += 2) {
+                auto hashed = values[i]->keyHash();
+                pairs[hashed] = HashPair{values[i], values[i + 1]};
+            }
+            finish(MakeRef<Hash>(pairs));
+        }
+        return;
+
+    case FlatKind::CALL:
+        if (t.step > n.ChildCount) {
+            // back from the body of a function this task called
+            envs.pop_back();
+            finish(Evaluator::unwrapReturnValue(values.back()));
+        } else if (t.step > 0 && Evaluator::isError(values.back())) {
+            finish(values.back());
+        } else if (t.step < n.ChildCount) {
+            push(p.Child(n, t.step++));
+        } else {
+            call(t, n);
+        }
+        return;
+    }
+}
+
+// Applies the function on the value stack to the arguments above it. The
+// body of a function from this program runs as a new task; anything else
+// is handed to Evaluator::applyFunction.
+void FlatEvaluator::call(Task& t, const FlatNode& n) {
+    const FlatProgram& p = *program;
+    auto fn = values[t.base];
+    ArgSpan args(values.data() + t.base + 1, values.size() - t.base - 1);
+
+    if (auto function = DynamicRefCast<Function>(fn)) {
+        auto it = p.Functions.find(function->Prototype->Literal);
+        if (it != p.Functions.end() && p.Nodes[it->second].ChildCount == 1) {
+            auto env = MakeEnvironment(function->Env);
+            env->Owner = function->Prototype;
+            const auto& parameters = function->Parameters();
+            for (std::size_t i = 0; i < parameters.size() && i < args.size(); ++i) {
+                env->Set(parameters[i]->Value(), args[i]);
+            }
+            envs.push_back(std::move(env));
+            t.step = n.ChildCount + 1;
+            push(p.Child(p.Nodes[it->second], 0));
+            return;
+        }
+    }
+    finish(Evaluator::applyFunction(fn, args));
+}
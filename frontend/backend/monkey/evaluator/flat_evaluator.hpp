@@ -0,0 +1,103 @@
+// flat_evaluator.hpp
+#ifndef FLAT_EVALUATOR_H
+#define FLAT_EVALUATOR_H
+
+#include "evaluator.hpp"
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+
+// A program flattened into one array of fixed-size node records in
+// post-order: every node's children come before it, and the program node
+// is last. Evaluating it needs no native recursion, see FlatEvaluator.
+
+enum class FlatKind : uint8_t {
+    PROGRAM,
+    BLOCK,
+    LET,
+    RETURN,
+    CONSTANT,
+    IDENTIFIER,
+    PREFIX,
+    INFIX,
+    IF,
+    FUNCTION,
+    CALL,
+    ARRAY,
+    INDEX,
+    HASH,
+    PACKED
+};
+
+struct FlatNode {
+    FlatKind Kind;
+    // Meaning depends on Kind: index into Constants (CONSTANT), Names
+    // (LET, IDENTIFIER, PREFIX and INFIX operators) or Literals (FUNCTION,
+    // PACKED).
+    uint32_t Data = 0;
+    uint32_t FirstChild = 0; // index into FlatProgram::Children
+    uint32_t ChildCount = 0;
+};
+
+class FlatProgram {
+public:
+    std::vector<FlatNode> Nodes;
+    std::vector<uint32_t> Children;
+    std::vector<ObjectRef> Constants;
+    std::vector<std::string> Names;
+    std::vector<std::shared_ptr<Expression>> Literals;
+    // node of every function literal, to find the body of a Function
+    std::unordered_map<const FunctionLiteral*, uint32_t> Functions;
+
+    uint32_t Root() const { return Nodes.size() - 1; }
+    uint32_t Child(const FlatNode& node, uint32_t i) const { return Children[node.FirstChild + i]; }
+
+    // Function bodies are flattened along with the rest, so deferred bodies
+    // are parsed here.
+    static std::shared_ptr<FlatProgram> Flatten(const Program& program);
+
+private:
+    uint32_t flatten(const std::shared_ptr<Node>& node, std::unordered_map<std::string, uint32_t>& names);
+    uint32_t emit(FlatKind kind, uint32_t data, const std::vector<uint32_t>& children);
+};
+
+// Evaluates a FlatProgram with an explicit task stack and value stack, so
+// deep recursion in the script only grows heap memory. Evaluation can be
+// suspended after any number of steps and resumed later, which lets one
+// thread take turns running many scripts.
+//
+// Results are the same as Evaluator::Eval's. Functions the program did not
+// create itself (say, from an environment filled by Evaluator::Eval) are
+// called through Evaluator::applyFunction.
+class FlatEvaluator {
+public:
+    FlatEvaluator(std::shared_ptr<const FlatProgram> program, std::shared_ptr<Environment> env);
+
+    // Runs at most maxSteps steps and returns whether the program finished.
+    bool Run(std::size_t maxSteps = std::numeric_limits<std::size_t>::max());
+    bool Done() const { return tasks.empty(); }
+    // the program's value once Done()
+    ObjectRef Result() const;
+
+    static ObjectRef Eval(const Program& program, std::shared_ptr<Environment> env);
+
+private:
+    struct Task {
+        uint32_t node;
+        uint32_t step;
+        std::size_t base; // size of the value stack when the task started
+    };
+
+    std::shared_ptr<const FlatProgram> program;
+    std::vector<Task> tasks;
+    std::vector<ObjectRef> values;
+    // innermost last; function calls push their environment
+    std::vector<std::shared_ptr<Environment>> envs;
+
+    void step();
+    void push(uint32_t node);
+    void finish(ObjectRef result);
+    void call(Task& t, const FlatNode& n);
+};
+
+#endif // FLAT_EVALUATOR_H
@@ -1,11 +1,26 @@
 #include "lexer.hpp"
+#include <algorithm>
+#include <cstring>
+#include <thread>
 
-Lexer::Lexer(const std::string& input) : input(input), position(0), readPosition(0), ch(0) {
+Lexer::Lexer(const std::string& input) : input(input), stream(nullptr), chunkSize(0), consumed(0), tokenPos(0), tokenEnd(0), position(0), readPosition(0), ch(0) {
     readChar();
 }
 
+Lexer::Lexer(std::shared_ptr<const std::string> src, std::string::size_type begin, std::string::size_type end)
+    : input(src->substr(begin, end - begin)), stream(nullptr), chunkSize(0), consumed(begin), source(std::move(src)), tokenPos(0), tokenEnd(0), position(0), readPosition(0), ch(0) {
+    readChar();
+}
+
+Lexer::Lexer(std::istream& in, std::string::size_type chunkSize) : stream(&in), chunkSize(chunkSize), consumed(0), tokenPos(0), tokenEnd(0), position(0), readPosition(0), ch(0) {
+    readChar();
+}
+
+Lexer::Lexer(std::shared_ptr<const std::vector<Token>> toks, std::size_t begin, std::size_t end, std::shared_ptr<const std::string> src)
+    : stream(nullptr), chunkSize(0), consumed(0), source(std::move(src)), tokens(std::move(toks)), tokenPos(begin), tokenEnd(end), position(0), readPosition(0), ch(0) {}
+
 void Lexer::readChar() {
-    if (readPosition >= input.size()) {
+    if (readPosition >= input.size() && !fill()) {
         ch = 0;
     } else {
         ch = input[readPosition];
@@ -14,13 +29,43 @@ void Lexer::readChar() {
     readPosition++;
 }
 
-char Lexer::peekChar() const {
-    if (readPosition >= input.size()) {
+char Lexer::peekChar() {
+    if (readPosition >= input.size() && !fill()) {
         return 0;
     }
     return input[readPosition];
 }
 
+// Appends the next chunk of the stream to the buffer. Blocks until at least
+// one character is available, but never waits for a whole chunk, so input
+// arriving over a pipe is lexed as soon as it shows up.
+bool Lexer::fill() {
+    if (!stream) return false;
+
+    std::streambuf* buf = stream->rdbuf();
+    if (buf->sgetc() == std::char_traits<char>::eof()) return false;
+
+    std::streamsize want = buf->in_avail();
+    if (want < 1) want = 1;
+    if (static_cast<std::string::size_type>(want) > chunkSize) want = chunkSize;
+
+    auto oldSize = input.size();
+    input.resize(oldSize + want);
+    auto got = buf->sgetn(&input[oldSize], want);
+    input.resize(oldSize + got);
+    return got > 0;
+}
+
+// Drops everything before the current character. Only called between
+// tokens, so the start positions the read* helpers hold stay valid.
+void Lexer::compact() {
+    if (!stream || position < chunkSize) return;
+    consumed += position;
+    input.erase(0, position);
+    readPosition -= position;
+    position = 0;
+}
+
 std::string Lexer::readIdentifier() {
     int startPosition = position;
     while (isLetter(ch)) {
@@ -65,9 +110,18 @@ Token Lexer::newToken(TokenType tokenType, char ch) {
 }
 
 Token Lexer::NextToken() {
+    if (tokens) {
+        if (tokenPos < tokenEnd) return (*tokens)[tokenPos++];
+        Token eof(TokenType::EOF_TOKEN, "");
+        if (tokenEnd < tokens->size()) eof.Position = (*tokens)[tokenEnd].Position;
+        return eof;
+    }
+
+    compact();
     skipWhitespace();
 
     Token tok;
+    auto start = consumed + position;
 
     switch (ch) {
         case '=':
@@ -141,15 +195,18 @@ Token Lexer::NextToken() {
             break;
         case 0:
             tok = Token(TokenType::EOF_TOKEN, "");
+            start = consumed + input.size(); // an unterminated string leaves us one past the end
             break;
         default:
             if (isLetter(ch)) {
                 std::string identifier = readIdentifier();
                 tok = Token(LookupIdent(identifier), identifier);
+                tok.Position = start;
                 return tok;  // Return here because readIdentifier advances the characters
             } else if (isDigit(ch)) {
                 std::string num = readNumber();
                 tok = Token(TokenType::INT, num);
+                tok.Position = start;
                 return tok;  // Return here because readNumber advances the characters
             } else {
                 tok = newToken(TokenType::ILLEGAL, ch);
@@ -157,6 +214,135 @@ Token Lexer::NextToken() {
             break;
     }
 
+    tok.Position = start;
     readChar();
     return tok;
 }
+
+std::shared_ptr<const std::string> Lexer::Source() const {
+    if (!source && !stream && !tokens) {
+        source = std::make_shared<const std::string>(input);
+    }
+    return source;
+}
+
+
+std::vector<Token> Lexer::Tokenize(const std::string& input) {
+    std::vector<Token> out;
+    Lexer l(input);
+    for (Token tok = l.NextToken();; tok = l.NextToken()) {
+        bool done = tok.Type == TokenType::EOF_TOKEN;
+        out.push_back(std::move(tok));
+        if (done) return out;
+    }
+}
+
+namespace {
+
+// What one chunk of the input lexes to, assuming a given start state
+struct ChunkTokens {
+    std::string head;          // if we started inside a string: its contents up to the closing quote
+    bool headClosed = false;   // whether that closing quote is in this chunk
+    std::vector<Token> tokens; // everything after the head, without EOF
+    bool endsInString = false; // the last token is a string still open at the chunk end
+};
+
+bool isChunkSpace(char ch) {
+    return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+}
+
+void lexChunk(const std::string& input, std::size_t begin, std::size_t end, bool insideString, ChunkTokens& out) {
+    if (insideString) {
+        const void* quote = std::memchr(input.data() + begin, '"', end - begin);
+        if (!quote) {
+            out.head = input.substr(begin, end - begin);
+            out.endsInString = true;
+            return;
+        }
+        std::size_t q = static_cast<const char*>(quote) - input.data();
+        out.head = input.substr(begin, q - begin);
+        out.headClosed = true;
+        begin = q + 1;
+    }
+
+    out.tokens = Lexer::Tokenize(input.substr(begin, end - begin));
+    out.tokens.pop_back(); // EOF
+    for (auto& tok : out.tokens) tok.Position += begin;
+    // strings have no escapes, so quotes simply alternate between opening
+    // and closing one; an odd count means the last string is still open
+    auto quotes = std::count(input.begin() + begin, input.begin() + end, '"');
+    out.endsInString = quotes % 2 == 1;
+}
+
+} // namespace
+
+std::vector<Token> Lexer::TokenizeParallel(const std::string& input, unsigned threads, std::string::size_type minChunkSize) {
+    if (minChunkSize == 0) minChunkSize = 1;
+    std::size_t chunks = std::min<std::size_t>(threads, input.size() / minChunkSize);
+    // a NUL ends the input for the sequential lexer, which chunks can't see
+    if (chunks < 2 || std::memchr(input.data(), 0, input.size())) {
+        return Tokenize(input);
+    }
+
+    // Cut at whitespace so that, outside of strings, no token straddles two
+    // chunks. Whitespace inside a string is fine too: that chunk's "inside
+    // string" result picks the string up where the previous chunk left it.
+    std::vector<std::size_t> bounds{0};
+    for (std::size_t i = 1; i < chunks; i++) {
+        std::size_t cut = std::max(input.size() * i / chunks, bounds.back() + 1);
+        while (cut < input.size() && !isChunkSpace(input[cut])) cut++;
+        if (cut >= input.size()) break;
+        bounds.push_back(cut);
+    }
+    bounds.push_back(input.size());
+    chunks = bounds.size() - 1;
+
+    // Speculatively lex every chunk for both start states; the first chunk
+    // always starts outside a string.
+    std::vector<ChunkTokens> outside(chunks), inside(chunks);
+    auto work = [&](std::size_t i) {
+        lexChunk(input, bounds[i], bounds[i + 1], false, outside[i]);
+        if (i > 0) lexChunk(input, bounds[i], bounds[i + 1], true, inside[i]);
+    };
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < chunks; i++) workers.emplace_back(work, i);
+    work(0);
+    for (auto& w : workers) w.join();
+
+    // Stitch: the real start state of each chunk is known once the previous
+    // one has been chosen, and a string split across chunks is glued back.
+    std::size_t total = 1;
+    for (const auto& c : outside) total += c.tokens.size();
+    std::vector<Token> out;
+    out.reserve(total);
+
+    bool inString = false;
+    std::string pending;
+    std::string::size_type pendingPos = 0;
+    for (std::size_t i = 0; i < chunks; i++) {
+        ChunkTokens& c = inString ? inside[i] : outside[i];
+        if (inString) {
+            pending += c.head;
+            if (!c.headClosed) continue;
+            out.emplace_back(TokenType::STRING, pending);
+            out.back().Position = pendingPos;
+            pending.clear();
+            inString = false;
+        }
+        std::move(c.tokens.begin(), c.tokens.end(), std::back_inserter(out));
+        if (c.endsInString) {
+            pending = std::move(out.back().Literal);
+            pendingPos = out.back().Position;
+            out.pop_back();
+            inString = true;
+        }
+    }
+    // like the sequential lexer, an unterminated string runs to the end
+    if (inString) {
+        out.emplace_back(TokenType::STRING, pending);
+        out.back().Position = pendingPos;
+    }
+    out.emplace_back(TokenType::EOF_TOKEN, "");
+    out.back().Position = input.size();
+    return out;
+}
@@ -2,17 +2,33 @@
 #define LEXER_H
 
 #include <string>
+#include <istream>
+#include <memory>
+#include <vector>
 #include "../token/token.hpp"
 
+// How much the streaming lexer pulls from its stream at a time
+const std::string::size_type DEFAULT_LEXER_CHUNK_SIZE = 4096;
+
 class Lexer {
 private:
-    std::string input;
+    std::string input;    // the whole source, or a sliding window of it when streaming
+    std::istream* stream; // null unless the lexer was built over a stream
+    std::string::size_type chunkSize;
+    std::string::size_type consumed; // source bytes dropped from the front of input
+    mutable std::shared_ptr<const std::string> source;
+    // when replaying an already lexed token stream, tokens[tokenPos, tokenEnd)
+    std::shared_ptr<const std::vector<Token>> tokens;
+    std::size_t tokenPos;
+    std::size_t tokenEnd;
     std::string::size_type position;         // current position in input (points to current char)
     std::string::size_type readPosition;     // current reading position in input (after current char)
     char ch;              // current char under examination
 
     void readChar();
-    char peekChar() const;
+    char peekChar();
+    bool fill();
+    void compact();
     std::string readIdentifier();
     std::string readNumber();
     std::string readString();
@@ -23,7 +39,28 @@ private:
 
 public:
     Lexer(const std::string& input);
+    // Lexes src[begin, end), with token positions counted from the start of src
+    Lexer(std::shared_ptr<const std::string> src, std::string::size_type begin, std::string::size_type end);
+    // Pulls source from in as it is needed, so tokens are available before
+    // the whole stream has arrived and only the unread tail is buffered
+    Lexer(std::istream& in, std::string::size_type chunkSize = DEFAULT_LEXER_CHUNK_SIZE);
+    // Replays toks[begin, end) and then EOF, so a parser can run over
+    // tokens that were lexed ahead of time
+    Lexer(std::shared_ptr<const std::vector<Token>> toks, std::size_t begin, std::size_t end,
+          std::shared_ptr<const std::string> src = nullptr);
     Token NextToken();
+
+    // The complete source the token positions refer to, or null when the
+    // lexer never holds all of it (streaming, or replaying without source)
+    std::shared_ptr<const std::string> Source() const;
+
+    // Lexes the whole input up front; the result ends with the EOF token
+    static std::vector<Token> Tokenize(const std::string& input);
+    // Same token stream as Tokenize, but input is cut into one chunk per
+    // thread and the chunks are lexed concurrently. Inputs that would give
+    // chunks smaller than minChunkSize are lexed sequentially.
+    static std::vector<Token> TokenizeParallel(const std::string& input, unsigned threads,
+                                               std::string::size_type minChunkSize = 64 * 1024);
 };
 
 #endif // LEXER_H
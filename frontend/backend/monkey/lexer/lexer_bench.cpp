@@ -0,0 +1,50 @@
+#include "lexer.hpp"
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Lexer Benchmark: times sequential lexing against chunked parallel lexing
+//of a large machine-generated data literal, for 1 to 16 threads.
+
+std::string generateInput(size_t elements) {
+    std::string src = "let data = [";
+    for (size_t i = 0; i < elements; ++i) {
+        if (i % 3 == 0) src += "\"item number " + std::to_string(i) + "\"";
+        else src += std::to_string(i * 7919);
+        src += ", ";
+    }
+    src += "0];\n";
+    return src;
+}
+
+template <typename F>
+double timeMs(F&& f, int runs) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; ++i) f();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / runs;
+}
+
+int main() {
+    const int runs = 5;
+    std::string input = generateInput(1000000);
+    std::cout << "input: " << input.size() / (1024 * 1024) << " MB, "
+              << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+
+    auto sequential = Lexer::Tokenize(input);
+    double base = timeMs([&] { Lexer::Tokenize(input); }, runs);
+    std::cout << "sequential: " << base << " ms (" << sequential.size() << " tokens)" << std::endl;
+
+    for (unsigned threads : {1u, 2u, 4u, 8u, 16u}) {
+        auto tokens = Lexer::TokenizeParallel(input, threads);
+        if (tokens.size() != sequential.size()) {
+            std::cerr << "token count mismatch at " << threads << " threads" << std::endl;
+            return 1;
+        }
+        double ms = timeMs([&] { Lexer::TokenizeParallel(input, threads); }, runs);
+        std::cout << "threads=" << threads << ": " << ms << " ms (x" << base / ms << ")" << std::endl;
+    }
+    return 0;
+}
@@ -1,6 +1,7 @@
 
 #include "lexer.hpp"
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -148,6 +149,70 @@ if (5 < 10) {
         }
     }
 
+    // A lexer pulling from a stream must produce the same tokens no matter
+    // where the chunk boundaries fall.
+    for (std::string::size_type chunk : {1, 2, 3, 7, 64}) {
+        std::istringstream in(input);
+        Lexer streamed(in, chunk);
+        Lexer whole(input);
+        for (size_t i = 0;; ++i) {
+            Token want = whole.NextToken();
+            Token got = streamed.NextToken();
+            if (got.Type != want.Type || got.Literal != want.Literal || got.Position != want.Position) {
+                std::cerr << "stream chunk=" << chunk << " token[" << i << "] wrong. Expected="
+                          << want.Literal << ", Got=" << got.Literal << std::endl;
+                return 1;
+            }
+            if (want.Type == TokenType::EOF_TOKEN) break;
+        }
+    }
+
+    // Chunked parallel lexing must give exactly the sequential token stream,
+    // including strings with spaces that straddle chunk boundaries and a
+    // string left open at the end of the input.
+    std::vector<std::string> inputs = {
+        input,
+        input + "\"never closed  with spaces",
+        "let s = [\"a b c\", \"  \", \"x\ny\", 1, 22, 333, \"\", \"tail\"];",
+        "\"\" \"\" \"   \" a\"b c\"d == != = !",
+    };
+    for (const auto& src : inputs) {
+        auto want = Lexer::Tokenize(src);
+        for (unsigned threads : {2u, 3u, 5u, 16u}) {
+            for (std::string::size_type minChunk : {1, 4, 16}) {
+                auto got = Lexer::TokenizeParallel(src, threads, minChunk);
+                bool same = got.size() == want.size();
+                for (size_t i = 0; same && i < got.size(); ++i) {
+                    same = got[i].Type == want[i].Type && got[i].Literal == want[i].Literal &&
+                           got[i].Position == want[i].Position;
+                }
+                if (!same) {
+                    std::cerr << "parallel lexing (threads=" << threads << ", minChunk=" << minChunk
+                              << ") differs from sequential for: " << src << std::endl;
+                    return 1;
+                }
+            }
+        }
+    }
+
+    // tokens know where they start
+    Lexer positions("let  x =\n\"ab\";");
+    for (std::string::size_type want : {0, 5, 7, 9, 13, 14}) {
+        if (positions.NextToken().Position != want) {
+            std::cerr << "token position wrong, want=" << want << std::endl;
+            return 1;
+        }
+    }
+
+    // the parser can run over a replayed token stream
+    auto toks = std::make_shared<const std::vector<Token>>(Lexer::Tokenize("let x = 1;"));
+    Lexer replay(toks, 1, 3);
+    if (replay.NextToken().Literal != "x" || replay.NextToken().Literal != "=" ||
+        replay.NextToken().Type != TokenType::EOF_TOKEN) {
+        std::cerr << "replayed token range is wrong" << std::endl;
+        return 1;
+    }
+
     std::cout << "All lexer_test.cpp tests passed!" << std::endl;
 
     return 0;
@@ -1,7 +1,27 @@
 #include "repl/repl.hpp"
 #include <iostream>
+#include <iterator>
+#include <string>
+
+int main(int argc, char* argv[]) {
+    // `monkey --stream < script.mk` runs a whole program, evaluating each
+    // statement as soon as it arrives
+    if (argc > 1 && std::string(argv[1]) == "--stream") {
+        // unsynced cin keeps its own buffer, which lets the lexer see how
+        // much input is already available instead of reading byte by byte
+        std::ios::sync_with_stdio(false);
+        REPL::StartStream(std::cin, std::cout);
+        return 0;
+    }
+
+    // `monkey --run < script.mk` runs a whole program in a region of its
+    // own and prints its result; the run's memory is dropped in one go
+    if (argc > 1 && std::string(argv[1]) == "--run") {
+        std::string source((std::istreambuf_iterator<char>(std::cin)), std::istreambuf_iterator<char>());
+        std::cout << REPL::RunIsolated(source);
+        return 0;
+    }
 
-int main() {
     std::cout << "This is the Monkey programming language!" << std::endl;
     std::cout << "Feel free to type in commands" << std::endl;
 
@@ -11,7 +31,7 @@ int main() {
 
     return 0;
 }
-//g++ -std=c++17 -I. -o monkey_repl main.cpp repl/repl.cpp object/object.cpp object/environment.cpp lexer/lexer.cpp parser/parser.cpp evaluator/evaluator.cpp ast/ast.cpp token/token.cpp && ./monkey_repl
+//g++ -std=c++17 -I. -o monkey_repl main.cpp repl/repl.cpp object/object.cpp object/environment.cpp object/heap.cpp object/region.cpp object/slab.cpp lexer/lexer.cpp parser/parser.cpp util/thread_pool.cpp evaluator/evaluator.cpp util/int_kernels.cpp ast/ast.cpp token/token.cpp && ./monkey_repl
 
 
 /*
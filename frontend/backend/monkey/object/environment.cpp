@@ -1,9 +1,11 @@
 // environment.cpp
 #include "environment.hpp"
+#include "heap.hpp"
+#include "region.hpp"
 
 namespace YOXS_OBJECT {
 
-std::shared_ptr<Object> Environment::Get(const std::string& name) {
+ObjectRef Environment::Get(const std::string& name) {
     auto it = store.find(name);
     if(it != store.end()) {
         return it->second;
@@ -14,9 +16,19 @@ std::shared_ptr<Object> Environment::Get(const std::string& name) {
     }
 }
 
-std::shared_ptr<Object> Environment::Set(const std::string& name, std::shared_ptr<Object> val) {
-    store[name] = val;
-    return val;
+Environment::~Environment() {
+    if (tracked.load(std::memory_order_relaxed)) Heap::Untrack(this);
+}
+
+ObjectRef Environment::Set(const std::string& name, ObjectRef val) {
+    // a region's cycles go when the region does
+    if (val && !tracked.load(std::memory_order_relaxed) && HoldsReferences(val->Type()) && !Region::Current()) {
+        tracked.store(true, std::memory_order_relaxed);
+        Heap::Track(this);
+    }
+    auto& slot = store[name];
+    slot = std::move(val);
+    return slot;
 }
 
 }//namespace YOXS_OBJECT
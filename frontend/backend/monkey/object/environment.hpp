@@ -5,6 +5,7 @@
 #include <unordered_map>
 #include <string>
 #include "object.hpp"
+#include <atomic>
 #include <memory>
 
 namespace YOXS_OBJECT {
@@ -12,13 +13,28 @@ namespace YOXS_OBJECT {
 class Environment {
 public:
     std::shared_ptr<Environment> outer;
-    std::unordered_map<std::string, std::shared_ptr<Object>> store;
+    std::unordered_map<std::string, ObjectRef> store;
+    // for a call's environment, the function whose body runs in it and
+    // may still bind more names here; null for the top level and for
+    // environments that nothing binds in after they are built
+    std::shared_ptr<const FunctionPrototype> Owner;
 
     Environment(std::shared_ptr<Environment> outer = nullptr) : outer(outer) {}
-    std::shared_ptr<Object> Get(const std::string& name);
-    std::shared_ptr<Object> Set(const std::string& name, std::shared_ptr<Object> val);
+    ~Environment();
+    ObjectRef Get(const std::string& name);
+    // Storing a value that can hold references makes the environment known
+    // to the cycle collector.
+    ObjectRef Set(const std::string& name, ObjectRef val);
+
+private:
+    std::atomic<bool> tracked{false};
 };
 
+// make_shared from the slabs: the environment and its count in one block
+inline std::shared_ptr<Environment> MakeEnvironment(std::shared_ptr<Environment> outer = nullptr) {
+    return std::allocate_shared<Environment>(SlabAllocator<Environment>(), std::move(outer));
+}
+
 } //namespace YOXS_OBJECT
 
 #endif // ENVIRONMENT_H
\ No newline at end of file
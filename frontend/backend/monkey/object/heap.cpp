@@ -0,0 +1,308 @@
+// heap.cpp
+#include "heap.hpp"
+#include "region.hpp"
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace YOXS_OBJECT {
+
+namespace {
+
+std::mutex heapMutex;
+std::unordered_set<Environment*> tracked;
+HeapStats stats;
+
+struct HeapNode {
+    Environment* env = nullptr; // either an environment or an object
+    const Object* object = nullptr;
+    long useCount = -1; // -1 while it has only been found in `tracked`
+    long found = 0;     // references to it found on the walk
+    bool reached = false;
+};
+
+// Walks everything reachable from the tracked environments, counting the
+// references it finds to each node
+class HeapGraph : public Tracer {
+public:
+    std::unordered_map<const void*, HeapNode> nodes;
+
+    void Build() {
+        for (auto env : tracked) {
+            auto inserted = nodes.try_emplace(env);
+            if (inserted.second) {
+                inserted.first->second.env = env;
+                pending.push_back(&inserted.first->second);
+            }
+        }
+        while (!pending.empty()) {
+            HeapNode* node = pending.back();
+            pending.pop_back();
+            expand(*node, *this);
+        }
+    }
+
+    // Marks what the roots reach
+    void Mark() {
+        Marker marker{*this, {}};
+        for (auto& entry : nodes) {
+            HeapNode& node = entry.second;
+            if (!node.reached && (node.useCount < 0 || node.useCount > node.found)) {
+                node.reached = true;
+                marker.pending.push_back(&node);
+            }
+        }
+        while (!marker.pending.empty()) {
+            HeapNode* node = marker.pending.back();
+            marker.pending.pop_back();
+            expand(*node, marker);
+        }
+    }
+
+    void Visit(const ObjectRef& ref) override {
+        if (ref && HoldsReferences(ref->Type())) found(ref.get(), nullptr, ref.get(), ref.use_count());
+    }
+    void Visit(const std::shared_ptr<Environment>& ref) override {
+        if (ref) found(ref.get(), ref.get(), nullptr, ref.use_count());
+    }
+
+private:
+    std::vector<HeapNode*> pending;
+
+    struct Marker : Tracer {
+        HeapGraph& graph;
+        std::vector<HeapNode*> pending;
+
+        Marker(HeapGraph& g, std::vector<HeapNode*> p) : graph(g), pending(std::move(p)) {}
+        void Visit(const ObjectRef& ref) override { reach(ref.get()); }
+        void Visit(const std::shared_ptr<Environment>& ref) override { reach(ref.get()); }
+        void reach(const void* key) {
+            auto it = graph.nodes.find(key);
+            if (it != graph.nodes.end() && !it->second.reached) {
+                it->second.reached = true;
+                pending.push_back(&it->second);
+            }
+        }
+    };
+
+    static void expand(const HeapNode& node, Tracer& tracer) {
+        if (node.env) {
+            for (const auto& binding : node.env->store) tracer.Visit(binding.second);
+            tracer.Visit(node.env->outer);
+        } else {
+            node.object->Trace(tracer);
+        }
+    }
+
+    void found(const void* key, Environment* env, const Object* object, long useCount) {
+        auto inserted = nodes.try_emplace(key);
+        HeapNode& node = inserted.first->second;
+        if (inserted.second) {
+            node.env = env;
+            node.object = object;
+            pending.push_back(&node);
+        }
+        if (node.useCount < 0) node.useCount = useCount;
+        node.found++;
+    }
+};
+
+// Chunk layout: this header, then the objects. Live starts at
+// UNRETIRED and only frees from other threads (or after the chunk was
+// retired) subtract from it; when the owner retires the chunk it adds
+// what it still counts as allocated, minus UNRETIRED. Whoever brings it to
+// zero frees the chunk.
+struct alignas(alignof(std::max_align_t)) NurseryChunk {
+    std::atomic<long> Live;
+};
+
+constexpr long UNRETIRED = LONG_MAX / 2;
+std::atomic<std::size_t> nurseryChunks{0};
+
+NurseryChunk* newChunk() {
+    void* memory = std::aligned_alloc(Nursery::CHUNK_SIZE, Nursery::CHUNK_SIZE);
+    if (!memory) throw std::bad_alloc();
+    nurseryChunks++;
+    return new (memory) NurseryChunk{{UNRETIRED}};
+}
+
+void freeChunk(NurseryChunk* chunk) {
+    chunk->~NurseryChunk();
+    std::free(chunk);
+    nurseryChunks--;
+}
+
+char* chunkStart(NurseryChunk* chunk) {
+    return reinterpret_cast<char*>(chunk) + sizeof(NurseryChunk);
+}
+
+// Trivially destructible, so it stays usable while the thread exits
+struct NurseryState {
+    NurseryChunk* chunk;
+    char* next;
+    char* limit;
+    long allocated; // objects in chunk not freed on this thread
+
+    // Hands the chunk over to its survivors; false if there are none, and
+    // the chunk is still this thread's to reuse
+    bool retire() {
+        long live = chunk->Live.fetch_add(allocated - UNRETIRED) + allocated - UNRETIRED;
+        if (live == 0) {
+            chunk->Live.store(UNRETIRED);
+            return false;
+        }
+        return true;
+    }
+
+    void refill() {
+        if (chunk && !retire()) {
+            next = chunkStart(chunk);
+            allocated = 0;
+            return;
+        }
+        chunk = newChunk();
+        next = chunkStart(chunk);
+        limit = reinterpret_cast<char*>(chunk) + Nursery::CHUNK_SIZE;
+        allocated = 0;
+    }
+};
+
+thread_local NurseryState nursery = {nullptr, nullptr, nullptr, 0};
+
+struct NurseryExit {
+    ~NurseryExit() {
+        if (nursery.chunk && !nursery.retire()) freeChunk(nursery.chunk);
+        nursery.chunk = nullptr;
+    }
+};
+thread_local NurseryExit nurseryExit;
+
+} // namespace
+
+void* Nursery::Allocate(std::size_t bytes) {
+    constexpr std::size_t align = alignof(std::max_align_t);
+    if (Region* region = Region::Current()) return region->Allocate(bytes, align);
+    bytes = (bytes + align - 1) & ~(align - 1);
+    if (static_cast<std::size_t>(nursery.limit - nursery.next) < bytes) {
+        (void)&nurseryExit; // registers the thread's exit hook
+        nursery.refill();
+    }
+    void* p = nursery.next;
+    nursery.next += bytes;
+    nursery.allocated++;
+    return p;
+}
+
+void Nursery::Free(void* p) {
+    if (Region* region = Region::Current()) {
+        if (region->Owns(p)) return;
+    }
+    Region::CheckForeign(p);
+    auto chunk = reinterpret_cast<NurseryChunk*>(reinterpret_cast<std::uintptr_t>(p) & ~(CHUNK_SIZE - 1));
+    if (chunk == nursery.chunk) {
+        if (--nursery.allocated == 0) nursery.next = chunkStart(chunk);
+        return;
+    }
+    if (chunk->Live.fetch_sub(1) == 1) freeChunk(chunk);
+}
+
+namespace {
+
+Integer* makeSmallIntegers() {
+    auto memory = static_cast<Integer*>(::operator new(sizeof(Integer) * (SMALL_INT_MAX - SMALL_INT_MIN + 1)));
+    for (int64_t v = SMALL_INT_MIN; v <= SMALL_INT_MAX; ++v) {
+        auto integer = ::new (&memory[v - SMALL_INT_MIN]) Integer(v);
+        integer->MakeImmortal();
+    }
+    return memory;
+}
+
+} // namespace
+
+Integer* const SmallIntegers = makeSmallIntegers();
+
+namespace {
+
+BooleanObject* makeImmortalBoolean(bool value) {
+    // built on first use, which may come during a run in a region
+    Region::Outside outside;
+    return MakeImmortal<BooleanObject>(value).get();
+}
+
+} // namespace
+
+Ref<BooleanObject> MakeBoolean(bool value) {
+    static BooleanObject* const TRUE = makeImmortalBoolean(true);
+    static BooleanObject* const FALSE = makeImmortalBoolean(false);
+    return Ref<BooleanObject>(value ? TRUE : FALSE);
+}
+
+void Heap::Track(Environment* env) {
+    std::lock_guard<std::mutex> lock(heapMutex);
+    tracked.insert(env);
+}
+
+void Heap::Untrack(Environment* env) {
+    std::lock_guard<std::mutex> lock(heapMutex);
+    tracked.erase(env);
+}
+
+std::size_t Heap::Collect() {
+    auto start = std::chrono::steady_clock::now();
+    // destroyed once the lock is released, as destructors untrack
+    std::vector<std::unordered_map<std::string, ObjectRef>> stores;
+    std::vector<std::shared_ptr<Environment>> outers;
+    {
+        std::lock_guard<std::mutex> lock(heapMutex);
+        HeapGraph graph;
+        graph.Build();
+        graph.Mark();
+        for (auto& entry : graph.nodes) {
+            HeapNode& node = entry.second;
+            if (node.reached || !node.env) continue;
+            stores.push_back(std::move(node.env->store));
+            node.env->store.clear();
+            outers.push_back(std::move(node.env->outer));
+        }
+
+        std::chrono::duration<double, std::milli> pause = std::chrono::steady_clock::now() - start;
+        stats.Collections++;
+        stats.Visited = graph.nodes.size();
+        stats.Freed = stores.size();
+        stats.TotalFreed += stores.size();
+        stats.LastPauseMs = pause.count();
+    }
+    std::size_t freed = stores.size();
+    stores.clear();
+    outers.clear();
+    return freed;
+}
+
+HeapStats Heap::Stats() {
+    std::lock_guard<std::mutex> lock(heapMutex);
+    HeapStats result = stats;
+    result.Tracked = tracked.size();
+    result.NurseryChunks = nurseryChunks.load();
+    return result;
+}
+
+std::string HeapStats::String() const {
+    std::ostringstream out;
+    out << "tracked=" << Tracked << "\n"
+        << "collections=" << Collections << "\n"
+        << "visited=" << Visited << "\n"
+        << "freed=" << Freed << "\n"
+        << "total_freed=" << TotalFreed << "\n"
+        << "last_pause_ms=" << LastPauseMs << "\n"
+        << "nursery_chunks=" << NurseryChunks << "\n";
+    return out.str();
+}
+
+} // namespace YOXS_OBJECT
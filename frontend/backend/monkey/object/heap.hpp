@@ -0,0 +1,111 @@
+// heap.hpp
+#ifndef HEAP_H
+#define HEAP_H
+
+#include "object.hpp"
+#include <cstddef>
+#include <new>
+#include <string>
+#include <utility>
+
+namespace YOXS_OBJECT {
+
+struct HeapStats {
+    std::size_t Tracked = 0;     // environments the collector knows of now
+    std::size_t Collections = 0;
+    std::size_t Visited = 0;     // environments and objects the last collection looked at
+    std::size_t Freed = 0;       // environments the last collection freed
+    std::size_t TotalFreed = 0;
+    double LastPauseMs = 0;
+    std::size_t NurseryChunks = 0; // chunks the nursery holds on all threads
+
+    // one "name=value" per line, for export to a metrics endpoint or log
+    std::string String() const;
+};
+
+// Frees the reference cycles reference counting cannot: a function
+// stored in the environment it closes over (every recursive `let f =
+// fn...`), or in an array or hash that environment holds.
+//
+// Environments become known to the collector once something that can
+// hold references is stored in them, and every cycle runs through one of
+// those. Collect() starts from them and walks every environment and
+// object reachable from there (Object::Trace). Anything whose
+// use_count() is higher than the number of references found on the walk
+// is also referenced from outside: an evaluator's stacks, a local, a
+// caller's environment. That makes it a root. Environments that no root
+// reaches are garbage and their stores are cleared, which breaks the
+// cycles and lets reference counting free the rest.
+class Heap {
+public:
+    static void Track(Environment* env);
+    static void Untrack(Environment* env);
+
+    // Must not run while another thread is evaluating. Returns the number
+    // of environments freed.
+    static std::size_t Collect();
+    static HeapStats Stats();
+};
+
+// Bump allocation for the small objects evaluation makes and mostly
+// drops right away: integers, strings, arrays.
+//
+// Each thread allocates from its own aligned chunk by moving a pointer.
+// Frees on that thread, of objects in its current chunk, only count down;
+// once the count is back at zero every object in the chunk is dead and the
+// pointer goes back to the start, so a loop keeps reusing the same few
+// cache lines. A chunk that fills up while some of its objects are still
+// alive is left to them: those survivors are promoted in place, since a
+// referenced object cannot move, and the chunk is freed when the last
+// one dies, on whatever thread that happens. Because nothing moves, old
+// objects that store young ones need no write barrier.
+class Nursery {
+public:
+    static constexpr std::size_t CHUNK_SIZE = 32 * 1024;
+    static constexpr std::size_t MAX_OBJECT = 512; // larger ones go to operator new
+
+    static void* Allocate(std::size_t bytes);
+    static void Free(void* p);
+    // an object built in memory from Allocate, to be Freed when it dies
+    static void Adopt(const Object& object) { const_cast<Object&>(object).young = true; }
+};
+
+// MakeRef from the nursery
+template <typename T, typename... Args>
+Ref<T> MakeYoung(Args&&... args) {
+    if (sizeof(T) > Nursery::MAX_OBJECT || alignof(T) > alignof(std::max_align_t)) {
+        return MakeRef<T>(std::forward<Args>(args)...);
+    }
+    void* memory = Nursery::Allocate(sizeof(T));
+    T* object;
+    try {
+        object = ::new (memory) T(std::forward<Args>(args)...);
+    } catch (...) {
+        Nursery::Free(memory);
+        throw;
+    }
+    Nursery::Adopt(*object);
+    return Ref<T>(object);
+}
+
+// Integers from SMALL_INT_MIN to SMALL_INT_MAX are made once, immortal,
+// and handed out again: loop counters, indexes and lengths then cost
+// neither an allocation nor a reference count.
+constexpr int64_t SMALL_INT_MIN = -128;
+constexpr int64_t SMALL_INT_MAX = 1023;
+extern Integer* const SmallIntegers; // SmallIntegers[0] is SMALL_INT_MIN
+
+inline Ref<Integer> MakeInteger(int64_t value) {
+    if (value >= SMALL_INT_MIN && value <= SMALL_INT_MAX) {
+        return Ref<Integer>(&SmallIntegers[value - SMALL_INT_MIN]);
+    }
+    return MakeYoung<Integer>(value);
+}
+
+// The one immortal true and false, shared with ObjectConstants; made on
+// first use so that other static objects can ask for them
+Ref<BooleanObject> MakeBoolean(bool value);
+
+} // namespace YOXS_OBJECT
+
+#endif // HEAP_H
@@ -1,24 +1,314 @@
 // object.cpp
 #include "object.hpp"
+#include "heap.hpp"
 #include "../ast/ast.hpp"
+#include <algorithm>
+#include <set>
 #include <sstream>
+#include <unordered_set>
 
 namespace YOXS_OBJECT {
 
+void Object::destroy() const {
+    if (young) {
+        void* memory = dynamic_cast<void*>(const_cast<Object*>(this));
+        this->~Object();
+        Nursery::Free(memory);
+    } else {
+        delete this;
+    }
+}
+
+namespace {
+
+// Collects everything it is shown and what that reaches
+class Sharer : public Tracer {
+public:
+    std::vector<const Object*> objects;
+
+    void Visit(const ObjectRef& ref) override {
+        if (ref) Add(ref.get());
+    }
+    void Visit(const std::shared_ptr<Environment>& ref) override {
+        if (!ref || !seen.insert(ref.get()).second) return;
+        for (const auto& binding : ref->store) Visit(binding.second);
+        Visit(ref->outer);
+    }
+    void Add(const Object* object) {
+        if (!seen.insert(object).second) return;
+        objects.push_back(object);
+        object->Trace(*this);
+        if (auto function = dynamic_cast<const Function*>(object)) function->TraceCaptured(*this);
+    }
+
+private:
+    std::unordered_set<const void*> seen;
+};
+
+} // namespace
+
+void Object::Share() const {
+    Sharer sharer;
+    sharer.Add(this);
+    for (auto object : sharer.objects) {
+        uint8_t local = LOCAL;
+        object->sharing.compare_exchange_strong(local, SHARED, std::memory_order_relaxed);
+    }
+}
+
 std::string Function::Inspect() const {
     std::ostringstream out;
 
     std::vector<std::string> params;
-    for(const auto& param : Parameters) {
+    for(const auto& param : Parameters()) {
         params.push_back(param->String());
     }
 
     out << "fn(" << YOXS_AST::join(params, ", ") << ") {\n";
-    out << Body->String() << "\n}";
+    out << GetBody()->String() << "\n}";
 
     return out.str();
 }
 
+ArrayObject::ArrayObject(std::vector<ObjectRef> elms) : kind(ElementsKind::GENERIC) {
+    ObjectType first = elms.empty() ? INTEGER_OBJ : elms.front()->Type();
+    bool uniform = first == INTEGER_OBJ || first == BOOLEAN_OBJ;
+    for (std::size_t i = 1; uniform && i < elms.size(); ++i) uniform = elms[i]->Type() == first;
+    if (!uniform) {
+        elements = std::move(elms);
+    } else if (first == INTEGER_OBJ) {
+        kind = ElementsKind::PACKED_INT;
+        ints.reserve(elms.size());
+        for (const auto& e : elms) ints.push_back(static_cast<const Integer*>(e.get())->Value);
+    } else {
+        kind = ElementsKind::PACKED_BOOL;
+        bools.reserve(elms.size());
+        for (const auto& e : elms) bools.push_back(static_cast<const BooleanObject*>(e.get())->Value);
+    }
+}
+
+std::size_t ArrayObject::Size() const {
+    switch (kind) {
+        case ElementsKind::PACKED_INT: return ints.size();
+        case ElementsKind::PACKED_BOOL: return bools.size();
+        default: return elements.size();
+    }
+}
+
+ObjectRef ArrayObject::At(std::size_t i) const {
+    switch (kind) {
+        case ElementsKind::PACKED_INT: return MakeInteger(ints[i]);
+        case ElementsKind::PACKED_BOOL: return MakeBoolean(bools[i]);
+        default: return elements[i];
+    }
+}
+
+std::vector<ObjectRef> ArrayObject::Elements() const {
+    if (kind == ElementsKind::GENERIC) return elements;
+    std::vector<ObjectRef> result;
+    result.reserve(Size());
+    for (std::size_t i = 0; i < Size(); ++i) result.push_back(At(i));
+    return result;
+}
+
+Ref<ArrayObject> ArrayObject::Slice(std::size_t from, std::size_t spare) const {
+    auto slice = MakeYoung<ArrayObject>(std::vector<int64_t>());
+    slice->kind = kind;
+    slice->Reserve(Size() - from + spare);
+    switch (kind) {
+        case ElementsKind::PACKED_INT: slice->ints.assign(ints.begin() + from, ints.end()); break;
+        case ElementsKind::PACKED_BOOL: slice->bools.assign(bools.begin() + from, bools.end()); break;
+        default: slice->elements.assign(elements.begin() + from, elements.end()); break;
+    }
+    return slice;
+}
+
+void ArrayObject::Reserve(std::size_t size) {
+    switch (kind) {
+        case ElementsKind::PACKED_INT: ints.reserve(size); break;
+        case ElementsKind::PACKED_BOOL: bools.reserve(size); break;
+        default: elements.reserve(size); break;
+    }
+}
+
+void ArrayObject::Push(const ObjectRef& value) {
+    ObjectType type = value->Type();
+    // an empty array takes the kind of what goes in first
+    if (Empty() && kind != ElementsKind::GENERIC) {
+        if (type == INTEGER_OBJ) kind = ElementsKind::PACKED_INT;
+        else if (type == BOOLEAN_OBJ) kind = ElementsKind::PACKED_BOOL;
+    }
+    if (kind == ElementsKind::PACKED_INT && type == INTEGER_OBJ) {
+        ints.push_back(static_cast<const Integer*>(value.get())->Value);
+    } else if (kind == ElementsKind::PACKED_BOOL && type == BOOLEAN_OBJ) {
+        bools.push_back(static_cast<const BooleanObject*>(value.get())->Value);
+    } else {
+        generalize();
+        elements.push_back(value);
+    }
+}
+
+void ArrayObject::generalize() {
+    if (kind == ElementsKind::GENERIC) return;
+    std::vector<ObjectRef> boxed = Elements();
+    boxed.reserve(boxed.size() + 1);
+    elements = std::move(boxed);
+    ints = {};
+    bools = {};
+    kind = ElementsKind::GENERIC;
+}
+
+std::string ArrayObject::Inspect() const {
+    std::ostringstream out;
+
+    std::vector<std::string> parts;
+    for (std::size_t i = 0; i < Size(); ++i) {
+        switch (kind) {
+            case ElementsKind::PACKED_INT: parts.push_back(std::to_string(ints[i])); break;
+            case ElementsKind::PACKED_BOOL: parts.push_back(bools[i] ? "true" : "false"); break;
+            default: parts.push_back(elements[i]->Inspect()); break;
+        }
+    }
+
+    out << "[" << YOXS_AST::join(parts, ", ") << "]";
+    return out.str();
+}
+
+namespace {
+
+using namespace YOXS_AST;
+
+void collectFreeNames(const Node* node, const std::set<std::string>& bound, std::set<std::string>& out) {
+    if (!node) return;
+    if (auto n = dynamic_cast<const Identifier*>(node)) {
+        if (!bound.count(n->Value())) out.insert(n->Value());
+    } else if (auto n = dynamic_cast<const BlockStatement*>(node)) {
+        for (const auto& s : n->Statements) collectFreeNames(s.get(), bound, out);
+    } else if (auto n = dynamic_cast<const ExpressionStatement*>(node)) {
+        collectFreeNames(n->expr.get(), bound, out);
+    } else if (auto n = dynamic_cast<const ReturnStatement*>(node)) {
+        collectFreeNames(n->ReturnValue.get(), bound, out);
+    } else if (auto n = dynamic_cast<const LetStatement*>(node)) {
+        // a use before the let looks outside, so the name is not bound here
+        collectFreeNames(n->Value.get(), bound, out);
+    } else if (auto n = dynamic_cast<const PrefixExpression*>(node)) {
+        collectFreeNames(n->Right.get(), bound, out);
+    } else if (auto n = dynamic_cast<const InfixExpression*>(node)) {
+        collectFreeNames(n->Left.get(), bound, out);
+        collectFreeNames(n->Right.get(), bound, out);
+    } else if (auto n = dynamic_cast<const IfExpression*>(node)) {
+        collectFreeNames(n->Condition.get(), bound, out);
+        collectFreeNames(n->Consequence.get(), bound, out);
+        collectFreeNames(n->Alternative.get(), bound, out);
+    } else if (auto n = dynamic_cast<const FunctionLiteral*>(node)) {
+        auto inner = bound;
+        for (const auto& param : n->Parameters) inner.insert(param->Value());
+        collectFreeNames(n->GetBody().get(), inner, out);
+    } else if (auto n = dynamic_cast<const CallExpression*>(node)) {
+        collectFreeNames(n->Function.get(), bound, out);
+        for (const auto& arg : n->Arguments) collectFreeNames(arg.get(), bound, out);
+    } else if (auto n = dynamic_cast<const ArrayLiteral*>(node)) {
+        for (const auto& e : n->Elements) collectFreeNames(e.get(), bound, out);
+    } else if (auto n = dynamic_cast<const IndexExpression*>(node)) {
+        collectFreeNames(n->Left.get(), bound, out);
+        collectFreeNames(n->Index.get(), bound, out);
+    } else if (auto n = dynamic_cast<const HashLiteral*>(node)) {
+        for (const auto& pair : n->Pairs) {
+            collectFreeNames(pair.first.get(), bound, out);
+            collectFreeNames(pair.second.get(), bound, out);
+        }
+    }
+}
+
+void collectLetNames(const Node* node, std::vector<std::string>& out) {
+    if (!node) return;
+    if (auto n = dynamic_cast<const BlockStatement*>(node)) {
+        for (const auto& s : n->Statements) collectLetNames(s.get(), out);
+    } else if (auto n = dynamic_cast<const ExpressionStatement*>(node)) {
+        collectLetNames(n->expr.get(), out);
+    } else if (auto n = dynamic_cast<const ReturnStatement*>(node)) {
+        collectLetNames(n->ReturnValue.get(), out);
+    } else if (auto n = dynamic_cast<const LetStatement*>(node)) {
+        out.push_back(n->Name->Value());
+        collectLetNames(n->Value.get(), out);
+    } else if (auto n = dynamic_cast<const PrefixExpression*>(node)) {
+        collectLetNames(n->Right.get(), out);
+    } else if (auto n = dynamic_cast<const InfixExpression*>(node)) {
+        collectLetNames(n->Left.get(), out);
+        collectLetNames(n->Right.get(), out);
+    } else if (auto n = dynamic_cast<const IfExpression*>(node)) {
+        collectLetNames(n->Condition.get(), out);
+        collectLetNames(n->Consequence.get(), out);
+        collectLetNames(n->Alternative.get(), out);
+    } else if (auto n = dynamic_cast<const CallExpression*>(node)) {
+        collectLetNames(n->Function.get(), out);
+        for (const auto& arg : n->Arguments) collectLetNames(arg.get(), out);
+    } else if (auto n = dynamic_cast<const ArrayLiteral*>(node)) {
+        for (const auto& e : n->Elements) collectLetNames(e.get(), out);
+    } else if (auto n = dynamic_cast<const IndexExpression*>(node)) {
+        collectLetNames(n->Left.get(), out);
+        collectLetNames(n->Index.get(), out);
+    } else if (auto n = dynamic_cast<const HashLiteral*>(node)) {
+        for (const auto& pair : n->Pairs) {
+            collectLetNames(pair.first.get(), out);
+            collectLetNames(pair.second.get(), out);
+        }
+    }
+}
+
+} // namespace
+
+const std::vector<std::string>& FunctionPrototype::FreeNames() const {
+    std::call_once(freeNamesFound, [this] {
+        std::set<std::string> bound, found;
+        for (const auto& param : Literal->Parameters) bound.insert(param->Value());
+        collectFreeNames(Literal->GetBody().get(), bound, found);
+        freeNames.assign(found.begin(), found.end());
+    });
+    return freeNames;
+}
+
+const std::vector<std::string>& FunctionPrototype::LetNames() const {
+    std::call_once(letNamesFound, [this] {
+        collectLetNames(Literal->GetBody().get(), letNames);
+        std::sort(letNames.begin(), letNames.end());
+    });
+    return letNames;
+}
+
+// message templates, indexed by ErrorCode; each %s takes the next operand
+static const char* const errorFormats[] = {
+    "%s",
+    "type mismatch: %s %s %s",
+    "unknown operator: %s%s",
+    "unknown operator: %s %s %s",
+    "identifier not found: %s",
+    "not a function: %s",
+    "index operator not supported: %s",
+    "unusable as hash key: %s",
+    "could not parse function body: %s",
+    "wrong number of arguments. got=%s, want=%s",
+    "argument to `%s` not supported, got %s",
+    "argument to `%s` must be ARRAY, got %s",
+    "argument to `%s` must be ARRAY of INTEGER, got %s",
+    "arrays given to `%s` differ in length: %s and %s",
+    "integer overflow in `%s`",
+};
+
+std::string Error::Message() const {
+    std::string out;
+    std::size_t arg = 0;
+    for (const char* p = errorFormats[static_cast<int>(Code)]; *p; ++p) {
+        if (p[0] == '%' && p[1] == 's' && arg < 3) {
+            out += Args[arg++];
+            ++p;
+        } else {
+            out += *p;
+        }
+    }
+    return out;
+}
+
 std::string ObjectTypeToString(ObjectType type) {
     switch (type) {
         case NULL_OBJ: return "NULL";
@@ -8,14 +8,41 @@
 #include <sstream>
 #include <functional>
 #include <map>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
 #include "../ast/ast.hpp"
+#include "ref.hpp"
+#include "slab.hpp"
 
 namespace YOXS_OBJECT {
 
 class Environment;  // Forward declaration
 class Object;
+class Nursery;
 
-using BuiltinFunction = std::function<std::shared_ptr<Object>(const std::vector<std::shared_ptr<Object>>& args)>;
+using ObjectRef = Ref<Object>;
+
+// The argument values of one call, borrowed from the caller: they stay
+// valid until the call returns and must be copied to be kept.
+class ArgSpan {
+public:
+    ArgSpan() = default;
+    ArgSpan(const ObjectRef* data, std::size_t size) : values(data), count(size) {}
+    ArgSpan(const std::vector<ObjectRef>& v) : values(v.data()), count(v.size()) {}
+
+    std::size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const ObjectRef& operator[](std::size_t i) const { return values[i]; }
+    const ObjectRef* begin() const { return values; }
+    const ObjectRef* end() const { return values + count; }
+
+private:
+    const ObjectRef* values = nullptr;
+    std::size_t count = 0;
+};
+
+using BuiltinFunction = std::function<ObjectRef(ArgSpan args)>;
 
 enum ObjectType {
     NULL_OBJ,
@@ -66,21 +93,127 @@ public:
 
 };
 
-class Hashable {
+// Is handed every reference an object holds, see Object::Trace
+class Tracer {
 public:
-    virtual ~Hashable() = default;
-    virtual HashKey keyHash() const = 0;
-
+    virtual ~Tracer() = default;
+    virtual void Visit(const ObjectRef& ref) = 0;
+    virtual void Visit(const std::shared_ptr<Environment>& ref) = 0;
 };
 
+// Objects of these types can be hash keys, see Object::keyHash
+inline bool IsHashable(ObjectType type) {
+    return type == INTEGER_OBJ || type == BOOLEAN_OBJ || type == STRING_OBJ;
+}
+
+// Objects of these types can hold references, and so be part of a
+// reference cycle; see Heap
+inline bool HoldsReferences(ObjectType type) {
+    return type == FUNCTION_OBJ || type == ARRAY_OBJ || type == HASH_OBJ || type == RETURN_VALUE_OBJ;
+}
+
+#ifdef MONKEY_COUNT_REFS
+// Bench builds count, per thread, the references taken on and dropped from
+// counted objects; immortal ones, whose count never changes, are left out
+struct RefTraffic {
+    long Retains = 0;
+    long Releases = 0;
+};
+inline thread_local RefTraffic RefCounts;
+#endif
+
+// Objects count their own references, for Ref. The count is a plain
+// increment while only one thread can see the object, which is the case
+// for everything an evaluator makes; Share() switches an object graph to
+// atomic counting before it is handed to other threads that may copy
+// references to it at the same time. A sequential handoff (a value made
+// on a worker and read after the join) needs no Share(). Immortal objects
+// are not counted at all: every thread can copy handles to them without
+// writing to their cache line.
 class Object {
 public:
+    Object() = default;
+    Object(const Object&) {}
+    Object& operator=(const Object&) { return *this; }
     virtual ~Object() = default; // Virtual destructor
+
+    // from the slabs, sized by the dynamic type; see Slab
+    static void* operator new(std::size_t bytes) { return Slab::Allocate(bytes); }
+    static void operator delete(void* p, std::size_t bytes) { Slab::Free(p, bytes); }
     virtual ObjectType Type() const = 0;
     virtual std::string Inspect() const = 0;
+    // Visits the objects and environments this object holds. A reference
+    // that is not visited counts as one from outside the heap, which
+    // keeps what it points to alive.
+    virtual void Trace(Tracer&) const {}
+    // Only called on IsHashable types; the rest hash by identity
+    virtual HashKey keyHash() const { return {Type(), static_cast<int64_t>(reinterpret_cast<intptr_t>(this))}; }
+
+    long RefCount() const { return refs.load(std::memory_order_relaxed); }
+    bool IsShared() const { return sharing.load(std::memory_order_relaxed) != LOCAL; }
+    bool IsImmortal() const { return sharing.load(std::memory_order_relaxed) == IMMORTAL; }
+    // Makes this object, and every object and environment it reaches,
+    // safe to reference from several threads at once
+    void Share() const;
+    // Stops counting references: the object is never freed. Only for
+    // objects that live as long as the program.
+    void MakeImmortal() const { sharing.store(IMMORTAL, std::memory_order_relaxed); }
+
+private:
+    template <typename T> friend class Ref;
+    friend class Nursery;
+
+    enum Sharing : uint8_t { LOCAL, SHARED, IMMORTAL };
+
+    mutable std::atomic<uint32_t> refs{0};
+    mutable std::atomic<uint8_t> sharing{LOCAL};
+    bool young = false; // memory came from the Nursery
+
+    void retain() const noexcept {
+        auto mode = sharing.load(std::memory_order_relaxed);
+#ifdef MONKEY_COUNT_REFS
+        if (mode != IMMORTAL) RefCounts.Retains++;
+#endif
+        if (mode == LOCAL) {
+            refs.store(refs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        } else if (mode == SHARED) {
+            refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    // true when that was the last reference
+    bool release() const noexcept {
+        auto mode = sharing.load(std::memory_order_relaxed);
+#ifdef MONKEY_COUNT_REFS
+        if (mode != IMMORTAL) RefCounts.Releases++;
+#endif
+        if (mode == LOCAL) {
+            uint32_t left = refs.load(std::memory_order_relaxed) - 1;
+            refs.store(left, std::memory_order_relaxed);
+            return left == 0;
+        }
+        return mode == SHARED && refs.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+    void destroy() const;
 };
 
-class Integer : public Object, public Hashable {
+// MakeRef for objects every thread can reach from the start, such as
+// compile-time constants
+template <typename T, typename... Args>
+Ref<T> MakeGlobal(Args&&... args) {
+    auto object = MakeRef<T>(std::forward<Args>(args)...);
+    object->Share();
+    return object;
+}
+
+// MakeRef for objects that are never freed: singletons and builtins
+template <typename T, typename... Args>
+Ref<T> MakeImmortal(Args&&... args) {
+    T* object = new T(std::forward<Args>(args)...);
+    object->MakeImmortal();
+    return Ref<T>(object);
+}
+
+class Integer : public Object {
 public:
     int64_t Value;
 
@@ -92,7 +225,7 @@ public:
     }
 };
 
-class BooleanObject : public Object, public Hashable {
+class BooleanObject : public Object {
 public:
     bool Value;
 
@@ -110,35 +243,114 @@ public:
 
 class ReturnValue : public Object {
 public:
-    std::shared_ptr<Object> Value;
+    ObjectRef Value;
 
-    ReturnValue(std::shared_ptr<Object> value) : Value(value) {}
+    ReturnValue(ObjectRef value) : Value(value) {}
     ObjectType Type() const override { return RETURN_VALUE_OBJ; }
     std::string Inspect() const override { return Value->Inspect(); }
+    void Trace(Tracer& tracer) const override { tracer.Visit(Value); }
+};
+
+// Every error the interpreter raises has a code, whose message template
+// lives in a static table. An error keeps its operands and only builds the
+// message when someone asks for it, which most errors never get to.
+enum class ErrorCode {
+    CUSTOM,
+    TYPE_MISMATCH,
+    UNKNOWN_PREFIX_OPERATOR,
+    UNKNOWN_INFIX_OPERATOR,
+    IDENTIFIER_NOT_FOUND,
+    NOT_A_FUNCTION,
+    INDEX_NOT_SUPPORTED,
+    UNUSABLE_HASH_KEY,
+    UNPARSED_FUNCTION_BODY,
+    WRONG_ARGUMENT_COUNT,
+    ARGUMENT_NOT_SUPPORTED,
+    ARGUMENT_NOT_ARRAY,
+    ARGUMENT_NOT_INTEGER_ARRAY,
+    LENGTH_MISMATCH,
+    INTEGER_OVERFLOW
 };
 
 class Error : public Object {
 public:
-    std::string Message;
+    ErrorCode Code;
+    std::string Args[3];
 
-    Error(const std::string& message) : Message(message) {}
+    Error(const std::string& message) : Code(ErrorCode::CUSTOM), Args{message} {}
+    Error(ErrorCode code, std::string a = "", std::string b = "", std::string c = "")
+        : Code(code), Args{std::move(a), std::move(b), std::move(c)} {}
     ObjectType Type() const override { return ERROR_OBJ; }
-    std::string Inspect() const override { return "ERROR: " + Message; }
+    std::string Inspect() const override { return "ERROR: " + Message(); }
+    std::string Message() const;
+};
+
+// What every function value made from one literal has in common. It is
+// never changed once built, so any number of closures, on any number of
+// threads, share one.
+class FunctionPrototype {
+public:
+    const YOXS_AST::FunctionLiteral* Literal;
+    std::size_t Arity;
+
+    explicit FunctionPrototype(const YOXS_AST::FunctionLiteral& literal)
+        : Literal(&literal), Arity(literal.Parameters.size()) {}
+    virtual ~FunctionPrototype() = default;
+
+    const std::vector<std::shared_ptr<YOXS_AST::Identifier>>& Parameters() const { return Literal->Parameters; }
+    // the literal's body, parsed on demand; null if it did not parse
+    const std::shared_ptr<YOXS_AST::BlockStatement>& Body() const { return Literal->GetBody(); }
+
+    // Every name the body may look up outside the function, sorted: each
+    // identifier it uses that is not a parameter of this function or of
+    // the function literal it appears in. Found on first use.
+    const std::vector<std::string>& FreeNames() const;
+
+    // The name of every let that runs in a call's own environment, sorted,
+    // once per let: those in the body and in its if blocks, but not in
+    // the function literals inside it. Found on first use.
+    const std::vector<std::string>& LetNames() const;
+
+private:
+    mutable std::once_flag freeNamesFound;
+    mutable std::vector<std::string> freeNames;
+    mutable std::once_flag letNamesFound;
+    mutable std::vector<std::string> letNames;
 };
 
+// A closure: its prototype plus the environment it captured. The
+// prototype pointer also keeps the literal alive.
 class Function : public Object {
 public:
-    std::vector<std::shared_ptr<YOXS_AST::Identifier>> Parameters;
+    std::shared_ptr<const FunctionPrototype> Prototype;
     std::shared_ptr<Environment> Env;
-    std::shared_ptr<YOXS_AST::BlockStatement> Body;
 
-    Function(const std::vector<std::shared_ptr<YOXS_AST::Identifier>>& parameters, std::shared_ptr<Environment> env, std::shared_ptr<YOXS_AST::BlockStatement> body)
-        : Parameters(parameters), Env(env), Body(body) {}
+    Function(std::shared_ptr<const FunctionPrototype> prototype, std::shared_ptr<Environment> env)
+        : Prototype(std::move(prototype)), Env(std::move(env)) {}
+
+    const std::vector<std::shared_ptr<YOXS_AST::Identifier>>& Parameters() const { return Prototype->Parameters(); }
+    const std::shared_ptr<YOXS_AST::BlockStatement>& GetBody() const { return Prototype->Body(); }
+
     ObjectType Type() const override { return FUNCTION_OBJ; }
     std::string Inspect() const override;
+    void Trace(Tracer& tracer) const override { tracer.Visit(Env); }
+
+    // A function that runs its body some other way than the evaluator
+    // does, in a new environment on top of Env, calls itself here and
+    // returns true; see CompiledFunction
+    virtual bool Invoke(ArgSpan args, ObjectRef& result) const {
+        (void)args;
+        (void)result;
+        return false;
+    }
+
+    // Shows the tracer references the function holds outside Env, which
+    // Share() must reach but the cycle collector does not follow; see
+    // CompiledFunction
+    virtual void TraceCaptured(Tracer& tracer) const { (void)tracer; }
 };
 
-class String : public Object, public Hashable {
+class String : public Object {
 public:
     std::string Value;
     String(const std::string& val) : Value(val) {}
@@ -160,28 +372,52 @@ public:
     std::string Inspect() const override { return "builtin function"; }
 };
 
+// How an array stores its elements. An array whose elements are all
+// integers, or all booleans, keeps their values in one contiguous vector
+// with no object per element; anything else is GENERIC, a vector of
+// references. Arrays never change once made, except while being built: a
+// Push of a value of another kind turns the array GENERIC for good.
+enum class ElementsKind : uint8_t { PACKED_INT, PACKED_BOOL, GENERIC };
+
 class ArrayObject : public Object {
-public: 
-    std::vector<std::shared_ptr<Object>> Elements;
-    ArrayObject(const std::vector<std::shared_ptr<Object>>& elms) : Elements(elms) {}
+public:
+    // packs the elements when they are all of one kind
+    ArrayObject(std::vector<ObjectRef> elms);
+    ArrayObject(std::vector<int64_t> ints) : kind(ElementsKind::PACKED_INT), ints(std::move(ints)) {}
     ObjectType Type() const override { return ARRAY_OBJ; }
-    std::string Inspect() const override {
-        std::ostringstream out;
-
-        std::vector<std::string> elements; 
-        for(const auto& e : Elements){
-            elements.push_back(e->Inspect());
-        }
- 
-        out << "[" << YOXS_AST::join(elements, ", ") << "]";
-        return out.str();
+    void Trace(Tracer& tracer) const override {
+        for (const auto& e : elements) tracer.Visit(e);
     }
+    std::string Inspect() const override;
+
+    ElementsKind Kind() const { return kind; }
+    std::size_t Size() const;
+    bool Empty() const { return Size() == 0; }
+    // boxes a packed element; small integers and booleans cost nothing
+    ObjectRef At(std::size_t i) const;
+    // every element as a reference, boxing packed ones
+    std::vector<ObjectRef> Elements() const;
+    const std::vector<int64_t>& Ints() const { return ints; }      // PACKED_INT only
+    const std::vector<uint8_t>& Bools() const { return bools; }    // PACKED_BOOL only
+    // the elements from `from` on, in the same kind, with room for
+    // `spare` more
+    Ref<ArrayObject> Slice(std::size_t from, std::size_t spare = 0) const;
+    void Reserve(std::size_t size);
+    void Push(const ObjectRef& value);
+
+private:
+    ElementsKind kind;
+    std::vector<int64_t> ints;
+    std::vector<uint8_t> bools;
+    std::vector<ObjectRef> elements;
+
+    void generalize();
 };
 
 class HashPair {
 public:
-    std::shared_ptr<Object> Key;
-    std::shared_ptr<Object> Value;
+    ObjectRef Key;
+    ObjectRef Value;
 };
 
 class Hash : public Object {
@@ -189,6 +425,12 @@ public:
     Hash(const std::map<HashKey, HashPair>& p) : Pairs(p) {}
     std::map<HashKey, HashPair> Pairs;
     ObjectType Type() const override { return HASH_OBJ; }
+    void Trace(Tracer& tracer) const override {
+        for (const auto& pair : Pairs) {
+            tracer.Visit(pair.second.Key);
+            tracer.Visit(pair.second.Value);
+        }
+    }
     std::string Inspect() const override {
         std::ostringstream out; 
         
@@ -1,6 +1,7 @@
 #include "../lexer/lexer.hpp"
 #include "object.hpp"
 #include "environment.hpp"
+#include "heap.hpp"
 #include "../parser/parser.hpp"
 #include <string>
 #include <vector>
@@ -8,6 +9,7 @@
 #include <memory>
 #include <cassert>
 #include <variant>
+#include <thread>
 
 void TestStringHashKey() {
     YOXS_OBJECT::String hello1("Hello World");
@@ -64,9 +66,178 @@ void TestIntegerHashKey() {
 	}
 }
 
+void TestErrorMessages() {
+	YOXS_OBJECT::Error mismatch(YOXS_OBJECT::ErrorCode::TYPE_MISMATCH, "INTEGER", "+", "BOOLEAN");
+	if (mismatch.Message() != "type mismatch: INTEGER + BOOLEAN") {
+		std::cerr << "wrong error message: " << mismatch.Message() << "\n";
+	}
+
+	YOXS_OBJECT::Error prefix(YOXS_OBJECT::ErrorCode::UNKNOWN_PREFIX_OPERATOR, "-", "BOOLEAN");
+	if (prefix.Inspect() != "ERROR: unknown operator: -BOOLEAN") {
+		std::cerr << "wrong error inspect: " << prefix.Inspect() << "\n";
+	}
+
+	// a custom message is taken as is, % signs and all
+	YOXS_OBJECT::Error custom("100% %s broken");
+	if (custom.Message() != "100% %s broken") {
+		std::cerr << "custom error message changed: " << custom.Message() << "\n";
+	}
+}
+
+// counts the instances alive, to see when a Ref lets go
+class Counted : public YOXS_OBJECT::Object {
+public:
+	static int alive;
+	Counted() { alive++; }
+	~Counted() override { alive--; }
+	YOXS_OBJECT::ObjectType Type() const override { return YOXS_OBJECT::NULL_OBJ; }
+	std::string Inspect() const override { return "counted"; }
+};
+int Counted::alive = 0;
+
+void TestRefCounting() {
+	using namespace YOXS_OBJECT;
+	{
+		auto counted = MakeRef<Counted>();
+		ObjectRef copy = counted;
+		if (counted.use_count() != 2) {
+			std::cerr << "a copied ref has use_count " << counted.use_count() << "\n";
+		}
+		// a handle made from the raw pointer adds to the same count
+		ObjectRef again(copy.get());
+		ObjectRef moved = std::move(copy);
+		if (copy || counted.use_count() != 3) {
+			std::cerr << "a moved ref kept its count\n";
+		}
+		if (DynamicRefCast<Integer>(moved) || DynamicRefCast<Counted>(moved) != counted) {
+			std::cerr << "DynamicRefCast picked the wrong type\n";
+		}
+		counted.reset();
+		if (Counted::alive != 1) {
+			std::cerr << "an object died while refs to it were left\n";
+		}
+	}
+	if (Counted::alive != 0) {
+		std::cerr << "the last ref did not free its object\n";
+	}
+
+	// the count and flags fit next to the vtable pointer, and hashable
+	// objects carry no second one
+	if (sizeof(Integer) != 2 * sizeof(void*) + sizeof(int64_t)) {
+		std::cerr << "Integer is " << sizeof(Integer) << " bytes\n";
+	}
+
+	// sharing reaches what the object holds
+	auto element = MakeRef<String>("element");
+	auto array = MakeRef<ArrayObject>(std::vector<ObjectRef>{element});
+	if (element->IsShared() || array->IsShared()) {
+		std::cerr << "new objects start out shared\n";
+	}
+	array->Share();
+	if (!element->IsShared() || !array->IsShared()) {
+		std::cerr << "Share() missed part of an array\n";
+	}
+}
+
+void TestImmortalObjects() {
+	using namespace YOXS_OBJECT;
+	auto five = MakeInteger(5);
+	if (five != MakeInteger(5) || !five->IsImmortal()) {
+		std::cerr << "small integers are not shared immortals\n";
+	}
+	{
+		ObjectRef copies[4] = {five, five, five, five};
+		if (five.use_count() != 0 || copies[3].use_count() != 0) {
+			std::cerr << "handles to an immortal object were counted\n";
+		}
+	}
+	five->Share();
+	if (!five->IsImmortal()) {
+		std::cerr << "sharing an immortal object made it mortal\n";
+	}
+	if (MakeInteger(SMALL_INT_MIN)->Value != SMALL_INT_MIN || MakeInteger(SMALL_INT_MAX)->Value != SMALL_INT_MAX) {
+		std::cerr << "the small integer table is off by one\n";
+	}
+
+	auto big = MakeInteger(SMALL_INT_MAX + 1);
+	if (big->IsImmortal() || big == MakeInteger(SMALL_INT_MAX + 1) || big.use_count() != 1) {
+		std::cerr << "a large integer was not a fresh counted object\n";
+	}
+
+	auto singleton = MakeImmortal<NullObject>();
+	ObjectRef copy = singleton;
+	copy.reset();
+	if (!singleton->IsImmortal() || singleton.use_count() != 0) {
+		std::cerr << "MakeImmortal made a counted object\n";
+	}
+}
+
+YOXS_OBJECT::SlabClassStats slabStats(std::size_t size) {
+	for (const auto& stats : YOXS_OBJECT::Slab::Stats()) {
+		if (stats.ObjectSize >= size) return stats;
+	}
+	return {};
+}
+
+void TestSlabs() {
+	using namespace YOXS_OBJECT;
+	auto before = slabStats(sizeof(Integer));
+	std::vector<Ref<Integer>> integers;
+	for (int i = 0; i < 20000; ++i) {
+		integers.push_back(MakeRef<Integer>(SMALL_INT_MAX + i));
+	}
+	auto during = slabStats(sizeof(Integer));
+	if (during.Live != before.Live + integers.size() || during.Pages < integers.size() * during.ObjectSize / Slab::PAGE_SIZE) {
+		std::cerr << "slab stats missed allocations: live " << during.Live << ", pages " << during.Pages << "\n";
+	}
+	if (during.PeakBytes < during.Bytes) {
+		std::cerr << "slab peak is below the current size\n";
+	}
+
+	// half the objects die on another thread, the rest on this one
+	std::vector<Ref<Integer>> half(integers.begin(), integers.begin() + integers.size() / 2);
+	integers.erase(integers.begin(), integers.begin() + integers.size() / 2);
+	std::thread([moved = std::move(half)]() mutable { moved.clear(); }).join();
+	// allocating takes the remote frees back onto this thread
+	auto reused = MakeRef<Integer>(-SMALL_INT_MAX);
+	integers.clear();
+	reused.reset();
+	Slab::Trim();
+
+	auto after = slabStats(sizeof(Integer));
+	if (after.Live != before.Live || after.Pages > before.Pages) {
+		std::cerr << "slab pages were not handed back: live " << after.Live << ", pages " << after.Pages << "\n";
+	}
+
+	// objects that outlive the thread that made them keep its pages until
+	// they are freed here
+	std::vector<Ref<Integer>> orphans;
+	std::thread([&orphans] {
+		for (int i = 0; i < 20000; ++i) orphans.push_back(MakeRef<Integer>(SMALL_INT_MAX + i));
+	}).join();
+	if (slabStats(sizeof(Integer)).Pages <= before.Pages) {
+		std::cerr << "slab pages of an exited thread were freed while in use\n";
+	}
+	orphans.clear();
+	after = slabStats(sizeof(Integer));
+	if (after.Live != before.Live || after.Pages > before.Pages) {
+		std::cerr << "slab pages of an exited thread were not handed back: live " << after.Live << ", pages " << after.Pages << "\n";
+	}
+
+	auto env = MakeEnvironment(MakeEnvironment());
+	env->Set("x", MakeRef<String>("x"));
+	if (env->outer == nullptr || env->Get("x")->Inspect() != "x") {
+		std::cerr << "an environment from the slabs lost its contents\n";
+	}
+}
+
 int main() {
     TestStringHashKey();
     TestIntegerHashKey();
     TestIntegerHashKey();
+    TestErrorMessages();
+    TestRefCounting();
+    TestImmortalObjects();
+    TestSlabs();
     std::cout << "object tests have finished!\n";
 }
\ No newline at end of file
@@ -0,0 +1,117 @@
+// ref.hpp
+#ifndef REF_H
+#define REF_H
+
+#include <cstddef>
+#include <ostream>
+#include <type_traits>
+#include <utility>
+
+namespace YOXS_OBJECT {
+
+// An owning handle to an Object, counted in the object itself. It has
+// the part of std::shared_ptr's interface the interpreter uses; there are
+// no weak references, and Ref(T*) adopts the object by adding a count, so
+// a handle can be made again from any raw pointer to a live object.
+template <typename T>
+class Ref {
+public:
+    using element_type = T;
+
+    constexpr Ref() noexcept = default;
+    constexpr Ref(std::nullptr_t) noexcept {}
+    explicit Ref(T* object) noexcept : ptr(object) { retain(); }
+    Ref(const Ref& other) noexcept : ptr(other.ptr) { retain(); }
+    Ref(Ref&& other) noexcept : ptr(other.ptr) { other.ptr = nullptr; }
+    template <typename U, typename = std::enable_if_t<std::is_convertible<U*, T*>::value>>
+    Ref(const Ref<U>& other) noexcept : ptr(other.get()) { retain(); }
+    template <typename U, typename = std::enable_if_t<std::is_convertible<U*, T*>::value>>
+    Ref(Ref<U>&& other) noexcept : ptr(other.Detach()) {}
+    ~Ref() { drop(); }
+
+    Ref& operator=(const Ref& other) noexcept {
+        Ref(other).swap(*this);
+        return *this;
+    }
+    Ref& operator=(Ref&& other) noexcept {
+        Ref(std::move(other)).swap(*this);
+        return *this;
+    }
+    template <typename U, typename = std::enable_if_t<std::is_convertible<U*, T*>::value>>
+    Ref& operator=(const Ref<U>& other) noexcept {
+        Ref(other).swap(*this);
+        return *this;
+    }
+    template <typename U, typename = std::enable_if_t<std::is_convertible<U*, T*>::value>>
+    Ref& operator=(Ref<U>&& other) noexcept {
+        Ref(std::move(other)).swap(*this);
+        return *this;
+    }
+    Ref& operator=(std::nullptr_t) noexcept {
+        reset();
+        return *this;
+    }
+
+    void reset() noexcept { Ref().swap(*this); }
+    void swap(Ref& other) noexcept { std::swap(ptr, other.ptr); }
+
+    T* get() const noexcept { return ptr; }
+    T& operator*() const noexcept { return *ptr; }
+    T* operator->() const noexcept { return ptr; }
+    explicit operator bool() const noexcept { return ptr != nullptr; }
+    long use_count() const noexcept { return ptr ? ptr->RefCount() : 0; }
+
+    // gives up the count without releasing it
+    T* Detach() noexcept {
+        T* object = ptr;
+        ptr = nullptr;
+        return object;
+    }
+
+private:
+    T* ptr = nullptr;
+
+    void retain() const noexcept {
+        if (ptr) ptr->retain();
+    }
+    void drop() noexcept {
+        if (ptr && ptr->release()) ptr->destroy();
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const Ref<T>& a, const Ref<U>& b) noexcept { return a.get() == b.get(); }
+template <typename T, typename U>
+bool operator!=(const Ref<T>& a, const Ref<U>& b) noexcept { return a.get() != b.get(); }
+template <typename T>
+bool operator==(const Ref<T>& a, std::nullptr_t) noexcept { return !a; }
+template <typename T>
+bool operator==(std::nullptr_t, const Ref<T>& a) noexcept { return !a; }
+template <typename T>
+bool operator!=(const Ref<T>& a, std::nullptr_t) noexcept { return static_cast<bool>(a); }
+template <typename T>
+bool operator!=(std::nullptr_t, const Ref<T>& a) noexcept { return static_cast<bool>(a); }
+
+template <typename Char, typename Traits, typename T>
+std::basic_ostream<Char, Traits>& operator<<(std::basic_ostream<Char, Traits>& out, const Ref<T>& ref) {
+    return out << ref.get();
+}
+
+template <typename T, typename... Args>
+Ref<T> MakeRef(Args&&... args) {
+    return Ref<T>(new T(std::forward<Args>(args)...));
+}
+
+template <typename T, typename U>
+Ref<T> DynamicRefCast(const Ref<U>& ref) noexcept {
+    return Ref<T>(dynamic_cast<T*>(ref.get()));
+}
+
+template <typename T, typename U>
+Ref<T> StaticRefCast(const Ref<U>& ref) noexcept {
+    return Ref<T>(static_cast<T*>(ref.get()));
+}
+
+} // namespace YOXS_OBJECT
+
+#endif // REF_H
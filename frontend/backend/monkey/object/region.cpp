@@ -0,0 +1,244 @@
+// region.cpp
+#include "region.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#ifndef NDEBUG
+#include <atomic>
+#include <cassert>
+#include <mutex>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace YOXS_OBJECT {
+
+namespace {
+
+constexpr std::size_t FIRST_CHUNK = 64 * 1024;
+constexpr std::size_t MAX_CHUNK = 4 * 1024 * 1024;
+
+thread_local Region* current = nullptr;
+
+char* alignUp(char* p, std::size_t align) {
+    auto address = reinterpret_cast<std::uintptr_t>(p);
+    return reinterpret_cast<char*>((address + align - 1) & ~(std::uintptr_t(align) - 1));
+}
+
+#ifndef NDEBUG
+// The chunks of every region there has been. A dropped region's chunks
+// keep their addresses, mapped again with no access, so that no later
+// allocation can land in a range listed here.
+// Never destroyed, for deletes made during static destruction.
+std::mutex everyChunkMutex;
+Region::Spans& everyChunk = *new Region::Spans;
+std::atomic<bool> anyChunk{false};
+
+void* newChunk(std::size_t size) {
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return nullptr;
+    std::lock_guard<std::mutex> lock(everyChunkMutex);
+    everyChunk.Insert(memory, size);
+    anyChunk.store(true, std::memory_order_release);
+    return memory;
+}
+
+void dropChunk(void* chunk, std::size_t size) {
+    mmap(chunk, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+}
+
+std::size_t chunkSize(std::size_t size) {
+    static const std::size_t page = sysconf(_SC_PAGESIZE);
+    return (size + page - 1) & ~(page - 1);
+}
+#else
+void* newChunk(std::size_t size) {
+    return std::malloc(size);
+}
+
+void dropChunk(void* chunk, std::size_t) {
+    std::free(chunk);
+}
+
+std::size_t chunkSize(std::size_t size) {
+    return size;
+}
+#endif
+
+} // namespace
+
+Region::Spans::~Spans() {
+    std::free(spans);
+}
+
+void Region::Spans::Insert(const void* start, std::size_t size) {
+    if (count == capacity) {
+        std::size_t grown = capacity ? capacity * 2 : 16;
+        auto moved = static_cast<Span*>(std::realloc(spans, grown * sizeof(Span)));
+        if (!moved) throw std::bad_alloc();
+        spans = moved;
+        capacity = grown;
+    }
+    Span span{static_cast<const char*>(start), static_cast<const char*>(start) + size};
+    Span* at = std::upper_bound(spans, spans + count, span,
+                                [](const Span& a, const Span& b) { return a.start < b.start; });
+    std::move_backward(at, spans + count, spans + count + 1);
+    *at = span;
+    ++count;
+}
+
+bool Region::Spans::Contains(const void* p) const {
+    auto address = static_cast<const char*>(p);
+    // the last span starting at or before p
+    Span* after = std::upper_bound(spans, spans + count, address,
+                                   [](const char* a, const Span& b) { return a < b.start; });
+    return after != spans && address < (after - 1)->end;
+}
+
+Region::~Region() {
+    while (chunks) {
+        Chunk* next = chunks->next;
+        dropChunk(chunks, chunks->size);
+        chunks = next;
+    }
+}
+
+void* Region::Allocate(std::size_t bytes, std::size_t align) {
+    if (bytes == 0) bytes = 1;
+    char* p = alignUp(next, align);
+    if (!next || bytes > static_cast<std::size_t>(limit - p)) {
+        grow(bytes, align);
+        p = alignUp(next, align);
+    }
+    next = p + bytes;
+    allocated += bytes;
+    return p;
+}
+
+void Region::grow(std::size_t bytes, std::size_t align) {
+    std::size_t size = chunks ? std::min(chunks->size * 2, MAX_CHUNK) : FIRST_CHUNK;
+    size = chunkSize(std::max(size, sizeof(Chunk) + align + bytes));
+    auto chunk = static_cast<Chunk*>(newChunk(size));
+    if (!chunk) throw std::bad_alloc();
+    chunk->next = chunks;
+    chunk->size = size;
+    chunks = chunk;
+    spans.Insert(chunk, size);
+    next = reinterpret_cast<char*>(chunk) + sizeof(Chunk);
+    limit = reinterpret_cast<char*>(chunk) + size;
+}
+
+// Most deletes are of recent allocations, so the newest chunk is tried
+// before the search
+bool Region::Owns(const void* p) const {
+    if (!chunks) return false;
+    auto address = static_cast<const char*>(p);
+    auto newest = reinterpret_cast<const char*>(chunks);
+    if (address >= newest && address < newest + chunks->size) return true;
+    return spans.Contains(p);
+}
+
+std::size_t Region::Chunks() const {
+    std::size_t count = 0;
+    for (Chunk* chunk = chunks; chunk; chunk = chunk->next) ++count;
+    return count;
+}
+
+Region* Region::Current() {
+    return current;
+}
+
+#ifndef NDEBUG
+void Region::CheckForeign(const void* p) {
+    if (!p || !anyChunk.load(std::memory_order_acquire)) return;
+    std::lock_guard<std::mutex> lock(everyChunkMutex);
+    assert(!everyChunk.Contains(p) && "region memory deleted outside its region's Scope, or after the region");
+}
+#endif
+
+Region::Scope::Scope(Region& region) : previous(current) {
+    current = &region;
+}
+
+Region::Scope::~Scope() {
+    current = previous;
+}
+
+Region::Outside::Outside() : previous(current) {
+    current = nullptr;
+}
+
+Region::Outside::~Outside() {
+    current = previous;
+}
+
+} // namespace YOXS_OBJECT
+
+// The replaceable allocation functions. Outside a region they behave like
+// the standard ones; inside, they allocate from it and ignore deletes of
+// its memory.
+namespace {
+
+using YOXS_OBJECT::Region;
+using YOXS_OBJECT::current;
+
+void* allocate(std::size_t bytes, std::size_t align) {
+    if (current) return current->Allocate(bytes, align);
+    if (bytes == 0) bytes = 1;
+    while (true) {
+        void* p = align > __STDCPP_DEFAULT_NEW_ALIGNMENT__
+            ? std::aligned_alloc(align, (bytes + align - 1) & ~(align - 1))
+            : std::malloc(bytes);
+        if (p) return p;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+}
+
+void* allocateNothrow(std::size_t bytes, std::size_t align) noexcept {
+    try {
+        return allocate(bytes, align);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void release(void* p) noexcept {
+    if (current && current->Owns(p)) return;
+    Region::CheckForeign(p);
+    std::free(p);
+}
+
+} // namespace
+
+void* operator new(std::size_t bytes) { return allocate(bytes, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new[](std::size_t bytes) { return allocate(bytes, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new(std::size_t bytes, std::align_val_t align) { return allocate(bytes, std::size_t(align)); }
+void* operator new[](std::size_t bytes, std::align_val_t align) { return allocate(bytes, std::size_t(align)); }
+void* operator new(std::size_t bytes, const std::nothrow_t&) noexcept {
+    return allocateNothrow(bytes, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void* operator new[](std::size_t bytes, const std::nothrow_t&) noexcept {
+    return allocateNothrow(bytes, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void* operator new(std::size_t bytes, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return allocateNothrow(bytes, std::size_t(align));
+}
+void* operator new[](std::size_t bytes, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return allocateNothrow(bytes, std::size_t(align));
+}
+
+void operator delete(void* p) noexcept { release(p); }
+void operator delete[](void* p) noexcept { release(p); }
+void operator delete(void* p, std::size_t) noexcept { release(p); }
+void operator delete[](void* p, std::size_t) noexcept { release(p); }
+void operator delete(void* p, std::align_val_t) noexcept { release(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { release(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { release(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { release(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { release(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { release(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { release(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { release(p); }
@@ -0,0 +1,115 @@
+// region.hpp
+#ifndef REGION_H
+#define REGION_H
+
+#include <cstddef>
+
+namespace YOXS_OBJECT {
+
+// One run's worth of memory, released all at once.
+//
+// While a Scope is open on a thread, every allocation that thread makes
+// comes from the region: operator new is replaced to ask Region::Current()
+// first, and the nursery does the same. Memory is handed out by moving a
+// pointer through chunks that double in size, and operator delete on it
+// does nothing. The destructor frees the chunks; nothing allocated in the
+// region is destroyed, so AST nodes, environments and objects can be
+// dropped without walking their shared_ptrs. Anything that must outlive
+// the region has to be copied out first, by value, after its Scope has
+// closed.
+//
+// Memory freed during the run is not reused, so a region suits runs whose
+// total allocation is bounded, not long-running loops. State that lives
+// on past a run (per-thread caches and the like) opens an Outside while it
+// allocates.
+//
+// Deleting region memory while the region is not current is undefined:
+// it would hand the inside of a chunk to free. Debug builds (no NDEBUG)
+// keep every chunk's address range, a dropped region's included, and fail
+// an assertion on such a delete instead.
+class Region {
+public:
+    Region() = default;
+    ~Region();
+    Region(const Region&) = delete;
+    Region& operator=(const Region&) = delete;
+
+    void* Allocate(std::size_t bytes, std::size_t align);
+    bool Owns(const void* p) const;
+
+    std::size_t Chunks() const;
+    std::size_t BytesAllocated() const { return allocated; }
+
+    // the region the calling thread allocates from, or nullptr
+    static Region* Current();
+    // for deletes of memory the current region, if any, does not own: in
+    // debug builds, asserts that no other region, live or dropped, owns it
+#ifdef NDEBUG
+    static void CheckForeign(const void*) {}
+#else
+    static void CheckForeign(const void* p);
+#endif
+
+    class Scope {
+    public:
+        explicit Scope(Region& region);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        Region* previous;
+    };
+
+    // allocates from the ordinary heap again until it closes
+    class Outside {
+    public:
+        Outside();
+        ~Outside();
+        Outside(const Outside&) = delete;
+        Outside& operator=(const Outside&) = delete;
+
+    private:
+        Region* previous;
+    };
+
+    // Address ranges sorted by start, kept in memory from malloc so that
+    // growing them never allocates from a region
+    class Spans {
+    public:
+        Spans() = default;
+        ~Spans();
+        Spans(const Spans&) = delete;
+        Spans& operator=(const Spans&) = delete;
+
+        void Insert(const void* start, std::size_t size);
+        bool Contains(const void* p) const;
+
+    private:
+        struct Span {
+            const char* start;
+            const char* end;
+        };
+        Span* spans = nullptr;
+        std::size_t count = 0;
+        std::size_t capacity = 0;
+    };
+
+private:
+    struct Chunk {
+        Chunk* next;
+        std::size_t size;
+    };
+
+    Chunk* chunks = nullptr; // newest first
+    Spans spans;             // of the chunks, for Owns
+    char* next = nullptr;
+    char* limit = nullptr;
+    std::size_t allocated = 0;
+
+    void grow(std::size_t bytes, std::size_t align);
+};
+
+} // namespace YOXS_OBJECT
+
+#endif // REGION_H
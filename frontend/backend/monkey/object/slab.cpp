@@ -0,0 +1,367 @@
+// slab.cpp
+#include "slab.hpp"
+#include "region.hpp"
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <sstream>
+
+namespace YOXS_OBJECT {
+
+namespace {
+
+// 8 to 128 bytes in steps of 8, then coarser steps up to MAX_OBJECT
+constexpr std::size_t CLASS_SIZES[] = {
+    8, 16, 24, 32, 40, 48, 56, 64, 72, 80, 88, 96, 104, 112, 120, 128,
+    160, 192, 224, 256, 320, 384, 448, 512,
+};
+constexpr std::size_t CLASSES = sizeof(CLASS_SIZES) / sizeof(CLASS_SIZES[0]);
+
+std::size_t classOf(std::size_t bytes) {
+    if (bytes <= 128) return bytes == 0 ? 0 : (bytes - 1) / 8;
+    std::size_t cls = 16;
+    while (CLASS_SIZES[cls] < bytes) ++cls;
+    return cls;
+}
+
+struct FreeNode {
+    FreeNode* next;
+};
+
+struct ThreadSlabs;
+
+// Same scheme as a nursery chunk: Live starts at UNRETIRED, frees from
+// other threads subtract from it, and when the owner lets go of the page
+// it adds what it still counts as in use, minus UNRETIRED. Whoever brings
+// it to zero frees the page.
+constexpr long UNRETIRED = LONG_MAX / 2;
+
+struct alignas(16) SlabPage {
+    std::atomic<ThreadSlabs*> owner;
+    std::atomic<FreeNode*> remote; // freed on other threads
+    std::atomic<long> live;
+    SlabPage* prev;                // in the owner's list for the class
+    SlabPage* next;
+    FreeNode* free;                // freed on the owner, ready for reuse
+    char* bump;                    // start of the part never handed out
+    long used;                     // handed out minus freed on the owner
+    std::uint32_t cls;
+    bool retired;                  // in `retiredPages` rather than an owner's list
+};
+
+char* pageStart(SlabPage* page) {
+    return reinterpret_cast<char*>(page) + sizeof(SlabPage);
+}
+
+char* pageEnd(SlabPage* page) {
+    return reinterpret_cast<char*>(page) + Slab::PAGE_SIZE;
+}
+
+SlabPage* pageOf(void* p) {
+    return reinterpret_cast<SlabPage*>(reinterpret_cast<std::uintptr_t>(p) & ~(Slab::PAGE_SIZE - 1));
+}
+
+// What every thread has counted, for Stats. Threads that have exited are
+// folded into `retired`; frees from other threads go to `remoteFreed`.
+struct Counts {
+    std::atomic<long> allocated[CLASSES];
+    std::atomic<long> freed[CLASSES];
+};
+
+void bump(std::atomic<long>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+std::atomic<long> pageCount[CLASSES];
+std::atomic<long> peakPages[CLASSES];
+
+SlabPage* newPage(std::size_t cls, ThreadSlabs* owner) {
+    void* memory = std::aligned_alloc(Slab::PAGE_SIZE, Slab::PAGE_SIZE);
+    if (!memory) throw std::bad_alloc();
+    auto page = new (memory) SlabPage{};
+    page->owner.store(owner, std::memory_order_relaxed);
+    page->live.store(UNRETIRED, std::memory_order_relaxed);
+    page->bump = pageStart(page);
+    page->cls = static_cast<std::uint32_t>(cls);
+
+    long pages = pageCount[cls].fetch_add(1, std::memory_order_relaxed) + 1;
+    long peak = peakPages[cls].load(std::memory_order_relaxed);
+    while (pages > peak && !peakPages[cls].compare_exchange_weak(peak, pages, std::memory_order_relaxed)) {}
+    return page;
+}
+
+// Pages whose thread has exited but that still hold objects, immortal
+// ones included. Only the page's last free needs them, but keeping them
+// listed leaves them reachable, so leak checkers don't count them lost.
+std::mutex retiredMutex;
+SlabPage* retiredPages = nullptr;
+
+void unlinkRetired(SlabPage* page) {
+    std::lock_guard<std::mutex> lock(retiredMutex);
+    if (page->prev) page->prev->next = page->next;
+    else retiredPages = page->next;
+    if (page->next) page->next->prev = page->prev;
+}
+
+void freePage(SlabPage* page) {
+    if (page->retired) unlinkRetired(page);
+    pageCount[page->cls].fetch_sub(1, std::memory_order_relaxed);
+    page->~SlabPage();
+    std::free(page);
+}
+
+// Trivially destructible, so it stays usable while the thread exits
+struct ThreadSlabs {
+    SlabPage* pages[CLASSES]; // the current page first
+    Counts counts;
+    bool registered;
+    bool exited; // pages made from here on have no owner
+    ThreadSlabs* prevThread;
+    ThreadSlabs* nextThread;
+
+    void* allocate(std::size_t cls);
+    void release(SlabPage* page, void* p);
+    void trim();
+    void retire();
+
+private:
+    void reclaim(SlabPage* page);
+    bool empty(SlabPage* page);
+    void* take(SlabPage* page);
+    void unlink(SlabPage* page);
+};
+
+thread_local ThreadSlabs slabs = {};
+
+// A list rather than a container, to be ready for objects made during
+// static initialization
+std::mutex registryMutex;
+ThreadSlabs* registry = nullptr;
+Counts retired;
+std::atomic<long> remoteFreed[CLASSES];
+
+struct SlabExit {
+    ~SlabExit() { slabs.retire(); }
+};
+thread_local SlabExit slabExit;
+
+void ThreadSlabs::reclaim(SlabPage* page) {
+    if (!page->remote.load(std::memory_order_relaxed)) return;
+    // the remote frees become this thread's: move them from `live` over
+    // to `used`
+    FreeNode* node = page->remote.exchange(nullptr, std::memory_order_acquire);
+    long count = 0;
+    FreeNode* last = node;
+    for (FreeNode* n = node; n; n = n->next) {
+        ++count;
+        last = n;
+    }
+    last->next = page->free;
+    page->free = node;
+    page->live.fetch_add(count, std::memory_order_relaxed);
+    page->used -= count;
+}
+
+bool ThreadSlabs::empty(SlabPage* page) {
+    return page->used + page->live.load(std::memory_order_acquire) - UNRETIRED == 0;
+}
+
+void* ThreadSlabs::take(SlabPage* page) {
+    if (!page->free) reclaim(page);
+    FreeNode* node = page->free;
+    if (node) {
+        page->free = node->next;
+        page->used++;
+        return node;
+    }
+    std::size_t size = CLASS_SIZES[page->cls];
+    if (page->bump + size <= pageEnd(page)) {
+        void* p = page->bump;
+        page->bump += size;
+        page->used++;
+        return p;
+    }
+    return nullptr;
+}
+
+void ThreadSlabs::unlink(SlabPage* page) {
+    if (page->prev) page->prev->next = page->next;
+    else pages[page->cls] = page->next;
+    if (page->next) page->next->prev = page->prev;
+    page->prev = page->next = nullptr;
+}
+
+void* ThreadSlabs::allocate(std::size_t cls) {
+    bump(counts.allocated[cls]);
+    SlabPage* current = pages[cls];
+    if (current) {
+        if (void* p = take(current)) return p;
+        // the first page with room becomes the current one
+        for (SlabPage* page = current->next; page; page = page->next) {
+            if (void* p = take(page)) {
+                unlink(page);
+                page->next = pages[cls];
+                pages[cls]->prev = page;
+                pages[cls] = page;
+                return p;
+            }
+        }
+    }
+    if (!registered && !exited) {
+        (void)&slabExit; // registers the thread's exit hook
+        std::lock_guard<std::mutex> lock(registryMutex);
+        nextThread = registry;
+        if (registry) registry->prevThread = this;
+        registry = this;
+        registered = true;
+    }
+    // after the exit hook (another thread_local's destructor allocating),
+    // the page is left ownerless: every free of it then goes the remote way
+    SlabPage* page = newPage(cls, exited ? nullptr : this);
+    page->next = current;
+    if (current) current->prev = page;
+    pages[cls] = page;
+    return take(page);
+}
+
+void ThreadSlabs::release(SlabPage* page, void* p) {
+    auto node = static_cast<FreeNode*>(p);
+    node->next = page->free;
+    page->free = node;
+    page->used--;
+    bump(counts.freed[page->cls]);
+    if (page != pages[page->cls] && empty(page)) {
+        unlink(page);
+        freePage(page);
+    }
+}
+
+void ThreadSlabs::trim() {
+    for (std::size_t cls = 0; cls < CLASSES; ++cls) {
+        SlabPage* page = pages[cls];
+        while (page) {
+            SlabPage* next = page->next;
+            reclaim(page);
+            if (empty(page)) {
+                unlink(page);
+                freePage(page);
+            }
+            page = next;
+        }
+    }
+}
+
+void ThreadSlabs::retire() {
+    exited = true;
+    for (std::size_t cls = 0; cls < CLASSES; ++cls) {
+        while (SlabPage* page = pages[cls]) {
+            pages[cls] = page->next;
+            // a later thread that happens to get the same address for its
+            // slabs must not take the page for its own
+            page->owner.store(nullptr, std::memory_order_relaxed);
+            // listed before `live` can reach zero, so the free that gets
+            // it there finds the page to unlink
+            {
+                std::lock_guard<std::mutex> lock(retiredMutex);
+                page->prev = nullptr;
+                page->next = retiredPages;
+                if (retiredPages) retiredPages->prev = page;
+                retiredPages = page;
+                page->retired = true;
+            }
+            long used = page->used;
+            if (page->live.fetch_add(used - UNRETIRED, std::memory_order_acq_rel) + used - UNRETIRED == 0) {
+                freePage(page);
+            }
+        }
+    }
+    if (registered) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (std::size_t cls = 0; cls < CLASSES; ++cls) {
+            retired.allocated[cls] += counts.allocated[cls].load(std::memory_order_relaxed);
+            retired.freed[cls] += counts.freed[cls].load(std::memory_order_relaxed);
+            counts.allocated[cls].store(0, std::memory_order_relaxed);
+            counts.freed[cls].store(0, std::memory_order_relaxed);
+        }
+        if (prevThread) prevThread->nextThread = nextThread;
+        else registry = nextThread;
+        if (nextThread) nextThread->prevThread = prevThread;
+        registered = false;
+    }
+}
+
+} // namespace
+
+void* Slab::Allocate(std::size_t bytes) {
+    if (Region* region = Region::Current()) return region->Allocate(bytes, ALIGN);
+    if (bytes > MAX_OBJECT) return ::operator new(bytes);
+    return slabs.allocate(classOf(bytes));
+}
+
+void Slab::Free(void* p, std::size_t bytes) {
+    if (!p) return;
+    if (Region* region = Region::Current()) {
+        if (region->Owns(p)) return;
+    }
+    if (bytes > MAX_OBJECT) {
+        ::operator delete(p);
+        return;
+    }
+    Region::CheckForeign(p);
+    SlabPage* page = pageOf(p);
+    if (page->owner.load(std::memory_order_relaxed) == &slabs) {
+        slabs.release(page, p);
+        return;
+    }
+    remoteFreed[page->cls].fetch_add(1, std::memory_order_relaxed);
+    auto node = static_cast<FreeNode*>(p);
+    node->next = page->remote.load(std::memory_order_relaxed);
+    while (!page->remote.compare_exchange_weak(node->next, node, std::memory_order_release,
+                                               std::memory_order_relaxed)) {}
+    if (page->live.fetch_sub(1, std::memory_order_acq_rel) == 1) freePage(page);
+}
+
+void Slab::Trim() {
+    slabs.trim();
+}
+
+std::vector<SlabClassStats> Slab::Stats() {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    std::vector<SlabClassStats> result;
+    for (std::size_t cls = 0; cls < CLASSES; ++cls) {
+        long peak = peakPages[cls].load(std::memory_order_relaxed);
+        if (peak == 0) continue;
+        long live = retired.allocated[cls].load(std::memory_order_relaxed)
+                  - retired.freed[cls].load(std::memory_order_relaxed)
+                  - remoteFreed[cls].load(std::memory_order_relaxed);
+        for (ThreadSlabs* thread = registry; thread; thread = thread->nextThread) {
+            live += thread->counts.allocated[cls].load(std::memory_order_relaxed)
+                  - thread->counts.freed[cls].load(std::memory_order_relaxed);
+        }
+        SlabClassStats stats;
+        stats.ObjectSize = CLASS_SIZES[cls];
+        stats.Live = live > 0 ? live : 0;
+        stats.Pages = pageCount[cls].load(std::memory_order_relaxed);
+        stats.Bytes = stats.Pages * PAGE_SIZE;
+        stats.PeakBytes = peak * PAGE_SIZE;
+        result.push_back(stats);
+    }
+    return result;
+}
+
+std::string Slab::StatsString() {
+    std::ostringstream out;
+    for (const auto& stats : Stats()) {
+        std::string prefix = "slab_" + std::to_string(stats.ObjectSize) + "_";
+        out << prefix << "live=" << stats.Live << "\n"
+            << prefix << "pages=" << stats.Pages << "\n"
+            << prefix << "bytes=" << stats.Bytes << "\n"
+            << prefix << "peak_bytes=" << stats.PeakBytes << "\n";
+    }
+    return out.str();
+}
+
+} // namespace YOXS_OBJECT
@@ -0,0 +1,87 @@
+// slab.hpp
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace YOXS_OBJECT {
+
+struct SlabClassStats {
+    std::size_t ObjectSize = 0; // every allocation in the class gets this many bytes
+    std::size_t Live = 0;       // allocations not yet freed
+    std::size_t Pages = 0;
+    std::size_t Bytes = 0;      // held from the system, in pages
+    std::size_t PeakBytes = 0;
+};
+
+// Pools for objects and environments that outlive the nursery: every
+// Object made with new (MakeRef, MakeImmortal) and every environment from
+// MakeEnvironment.
+//
+// Sizes are rounded up to one of a few size classes. Each thread keeps,
+// per class, a list of aligned pages it owns, each with its own free list;
+// allocating pops from the current page, and freeing on the owning thread
+// pushes back onto it, with no locks or atomic read-modify-writes. Frees
+// from other threads go onto a separate per-page list that the owner takes
+// over when the page runs dry. A page is handed back to the system as soon
+// as the owner frees the last thing in it (a thread keeps its current page
+// for each class), or by Trim when the last frees came from elsewhere; pages
+// still in use when their thread exits go on a global list, and are freed
+// by whichever thread frees their last object.
+//
+// Larger allocations go to operator new, as do types aligned to more than
+// ALIGN, which no object or environment is. Inside a Region everything comes
+// from the region instead.
+class Slab {
+public:
+    static constexpr std::size_t PAGE_SIZE = 64 * 1024;
+    static constexpr std::size_t MAX_OBJECT = 512;
+    static constexpr std::size_t ALIGN = 8; // of everything Allocate returns
+
+    static void* Allocate(std::size_t bytes);
+    // bytes must be what was asked of Allocate
+    static void Free(void* p, std::size_t bytes);
+    // hands back the calling thread's pages that hold nothing, current
+    // ones included
+    static void Trim();
+
+    // one entry per size class that has ever held a page
+    static std::vector<SlabClassStats> Stats();
+    // "slab_<size>_<field>=value" lines, like HeapStats::String
+    static std::string StatsString();
+};
+
+template <typename T>
+class SlabAllocator {
+public:
+    using value_type = T;
+
+    SlabAllocator() = default;
+    template <typename U>
+    SlabAllocator(const SlabAllocator<U>&) {}
+
+    T* allocate(std::size_t n) {
+        if (alignof(T) > Slab::ALIGN) return static_cast<T*>(::operator new(n * sizeof(T)));
+        return static_cast<T*>(Slab::Allocate(n * sizeof(T)));
+    }
+    void deallocate(T* p, std::size_t n) {
+        if (alignof(T) > Slab::ALIGN) {
+            ::operator delete(p);
+        } else {
+            Slab::Free(p, n * sizeof(T));
+        }
+    }
+
+    template <typename U>
+    bool operator==(const SlabAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const SlabAllocator<U>&) const { return false; }
+};
+
+} // namespace YOXS_OBJECT
+
+#endif // SLAB_H
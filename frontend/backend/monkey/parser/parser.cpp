@@ -1,4 +1,6 @@
 #include "parser.hpp"
+#include <algorithm>
+#include <charconv>
 
 std::unordered_map<TokenType, Precedence> precedences = {
     { TokenType::EQ, EQUALS },
@@ -14,7 +16,7 @@ std::unordered_map<TokenType, Precedence> precedences = {
 
 };
 
-Parser::Parser(Lexer& l) : lexer(&l) {
+Parser::Parser(Lexer& l, int maxNestingDepth) : lexer(&l), maxNestingDepth(maxNestingDepth), nestingDepth(0), nestingLimitHit(false) {
     // Initialize errors
     errors = std::vector<std::string>();
 
@@ -121,6 +123,8 @@ bool Parser::expectPeek(TokenType t) {
     if(peekTokenIs(t)) {
         nextToken();
         return true;
+    } else if(nestingLimitHit) {
+        return false;
     } else{
         peekError(t);
         return false;
@@ -139,6 +143,13 @@ void Parser::noPrefixParseFnError(TokenType t) {
     errors.push_back(oss.str());
 }
 
+void Parser::nestingLimitError() {
+    std::ostringstream oss;
+    oss << "expression nested too deeply (limit " << maxNestingDepth << ")";
+    errors.push_back(oss.str());
+    nestingLimitHit = true;
+}
+
 
 int Parser::peekPrecedence() const {
     auto it = precedences.find(peekToken.Type);
@@ -162,15 +173,203 @@ std::shared_ptr<Program> Parser::ParseProgram() {
     auto program = std::make_shared<Program>();
     program->Statements = std::vector<std::shared_ptr<Statement>>();
 
-    while(!curTokenIs(TokenType::EOF_TOKEN)) {
-        auto stmt = parseStatement();
-        if(stmt) program->Statements.push_back(stmt);
+    while(!AtEnd()) {
+        auto begin = curToken.Position;
+        auto stmt = ParseNextStatement();
+        if(stmt) {
+            program->Statements.push_back(stmt);
+            program->Spans.push_back({begin, curToken.Position});
+        }
+    }
+    if (!errors.empty()) program->Spans.clear();
+
+    return program;
+}
+
+std::shared_ptr<Program> Parser::ReparseProgram(const Program& old, const std::vector<SourceEdit>& edits) {
+    auto src = lexer->Source();
+    const auto& spans = old.Spans;
+    if (!src || spans.empty() || spans.size() != old.Statements.size() || !errors.empty()) {
+        return ParseProgram();
+    }
+
+    // Fold the edits into one dirty range [lo, hi) of the new source, and
+    // the overall growth of the source.
+    using size_type = std::string::size_type;
+    size_type lo = 0, hi = 0;
+    long long delta = 0;
+    for (std::size_t k = 0; k < edits.size(); ++k) {
+        const auto& e = edits[k];
+        if (k == 0) {
+            lo = e.Offset;
+            hi = e.Offset + e.Inserted;
+        } else {
+            hi = hi >= e.Offset + e.Removed ? hi + e.Inserted - e.Removed : e.Offset + e.Inserted;
+            hi = std::max(hi, e.Offset + e.Inserted);
+            lo = std::min(lo, e.Offset);
+        }
+        delta += static_cast<long long>(e.Inserted) - static_cast<long long>(e.Removed);
+    }
+
+    // The first statement touching the dirty range, and one more before
+    // it: a statement can end on what the next one starts with ("a !b" vs
+    // "a != b"), so an edit inside the next statement's first token can
+    // change it.
+    auto first = std::lower_bound(spans.begin(), spans.end(), lo,
+        [](const SourceSpan& span, size_type pos) { return span.End < pos; });
+    std::size_t i = first - spans.begin();
+    if (i == spans.size()) i--;
+    if (i > 0) i--;
+
+    auto program = std::make_shared<Program>();
+    program->Statements.assign(old.Statements.begin(), old.Statements.begin() + i);
+    program->Spans.assign(spans.begin(), spans.begin() + i);
+
+    Lexer tail(src, i == 0 ? 0 : spans[i].Begin, src->size());
+    Lexer* whole = lexer;
+    lexer = &tail;
+    nextToken();
+    nextToken();
+
+    // Past the dirty range the new source is the old one shifted by delta,
+    // so once a statement starts where an old one did, the rest of the
+    // old program can be reused as is.
+    std::size_t j = i;
+    while (!AtEnd()) {
+        auto begin = curToken.Position;
+        if (begin >= hi) {
+            size_type oldBegin = begin - delta;
+            while (j < spans.size() && spans[j].Begin < oldBegin) j++;
+            if (j < spans.size() && spans[j].Begin == oldBegin) {
+                program->Statements.insert(program->Statements.end(), old.Statements.begin() + j, old.Statements.end());
+                for (; j < spans.size(); ++j) {
+                    program->Spans.push_back({spans[j].Begin + delta, spans[j].End + delta});
+                }
+                break;
+            }
+        }
+        auto stmt = ParseNextStatement();
+        if (stmt) {
+            program->Statements.push_back(stmt);
+            program->Spans.push_back({begin, curToken.Position});
+        }
+    }
+    if (!errors.empty()) program->Spans.clear();
+
+    // leave the parser at the end of the input
+    curToken = peekToken = Token(TokenType::EOF_TOKEN, "");
+    curToken.Position = peekToken.Position = src->size();
+    lexer = whole;
+    return program;
+}
+
+void Parser::SetLazyFunctionBodies(bool lazy) {
+    lazySource = lazy ? lexer->Source() : nullptr;
+}
+
+std::shared_ptr<Program> Parser::ParseProgram(ThreadPool& pool) {
+    auto program = std::make_shared<Program>();
+    if (AtEnd()) return program;
+
+    // drain the lexer; the parser has already pulled two tokens from it
+    auto tokens = std::make_shared<std::vector<Token>>();
+    tokens->push_back(curToken);
+    while (tokens->back().Type != TokenType::EOF_TOKEN) {
+        tokens->push_back(peekToken);
         nextToken();
     }
+    tokens->pop_back(); // each batch gets its own EOF
+
+    // Group consecutive statements into a few batches per thread, so that
+    // every batch is worth a task even when the statements are tiny.
+    auto starts = statementStarts(*tokens);
+    std::size_t target = tokens->size() / (pool.Size() * 4) + 1;
+    std::vector<std::size_t> bounds{0};
+    for (auto start : starts) {
+        if (start - bounds.back() >= target) bounds.push_back(start);
+    }
+    bounds.push_back(tokens->size());
+
+    std::shared_ptr<const std::vector<Token>> shared = tokens;
+    std::size_t batches = bounds.size() - 1;
+    std::vector<std::shared_ptr<Program>> parts(batches);
+    std::vector<std::vector<std::string>> partErrors(batches);
+    std::vector<char> partLimitHit(batches);
+    pool.ParallelFor(batches, [&](std::size_t i) {
+        Lexer l(shared, bounds[i], bounds[i + 1], lexer->Source());
+        Parser p(l, maxNestingDepth);
+        p.lazySource = lazySource;
+        parts[i] = p.ParseProgram();
+        partErrors[i] = std::move(p.errors);
+        partLimitHit[i] = p.nestingLimitHit;
+    });
+
+    // A broken statement can end somewhere else than the split assumed:
+    // an expression missing its right side takes the let or return after
+    // it as that side. Batches then disagree with a sequential parse about
+    // the errors, so any error has the tokens parsed again in one go.
+    for (std::size_t i = 0; i < batches; ++i) {
+        if (!partErrors[i].empty() || partLimitHit[i]) {
+            Lexer l(shared, 0, shared->size(), lexer->Source());
+            Parser p(l, maxNestingDepth);
+            p.lazySource = lazySource;
+            auto whole = p.ParseProgram();
+            errors.insert(errors.end(), p.errors.begin(), p.errors.end());
+            nestingLimitHit = p.nestingLimitHit;
+            return whole;
+        }
+    }
 
+    for (std::size_t i = 0; i < batches; ++i) {
+        auto& stmts = parts[i]->Statements;
+        program->Statements.insert(program->Statements.end(), stmts.begin(), stmts.end());
+    }
     return program;
 }
 
+// Token indexes where a new top-level statement begins: after a ';' or
+// before a 'let' or 'return', as long as no bracket of any kind is open.
+// Unbalanced closing brackets make the split unreliable, so then the whole
+// input is treated as one statement run.
+std::vector<std::size_t> Parser::statementStarts(const std::vector<Token>& tokens) const {
+    std::vector<std::size_t> starts;
+    int depth = 0;
+    for (std::size_t i = 0; i < tokens.size(); ++i) {
+        switch (tokens[i].Type) {
+        case TokenType::LPAREN:
+        case TokenType::LBRACE:
+        case TokenType::LBRACKET:
+            depth++;
+            break;
+        case TokenType::RPAREN:
+        case TokenType::RBRACE:
+        case TokenType::RBRACKET:
+            if (--depth < 0) return {};
+            break;
+        case TokenType::SEMICOLON:
+            if (depth == 0 && i + 1 < tokens.size()) starts.push_back(i + 1);
+            break;
+        case TokenType::LET:
+        case TokenType::RETURN:
+            if (depth == 0 && i > 0 && (starts.empty() || starts.back() != i)) starts.push_back(i);
+            break;
+        default:
+            break;
+        }
+    }
+    return starts;
+}
+
+bool Parser::AtEnd() const {
+    return curTokenIs(TokenType::EOF_TOKEN) || nestingLimitHit;
+}
+
+std::shared_ptr<Statement> Parser::ParseNextStatement() {
+    auto stmt = parseStatement();
+    nextToken();
+    return stmt;
+}
+
 std::shared_ptr<Statement> Parser::parseStatement(){
     switch (curToken.Type)
     {
@@ -238,26 +437,36 @@ std::shared_ptr<ExpressionStatement> Parser::parseExpressionStatement(){
 }
 
 std::shared_ptr<Expression> Parser::parseExpression(Precedence pVal){
+    //every recursive path in the grammar (groups, blocks, calls, literals)
+    //passes through here, so this is the one place nesting is counted
+    if (nestingLimitHit) return nullptr;
+    if (nestingDepth >= maxNestingDepth) {
+        nestingLimitError();
+        return nullptr;
+    }
+
     auto prefixIt = prefixParseFns.find(curToken.Type);
     if (prefixIt == prefixParseFns.end()) {
         noPrefixParseFnError(curToken.Type);
         return nullptr;
     }
-    auto prefix = prefixIt->second;
+    auto& prefix = prefixIt->second;
+    nestingDepth++;
     std::shared_ptr<Expression> leftExp = (prefix)();
     //here we are calling prefix like a function and the parentheses after prefix 
     //are invoking the callable object. if prefix is a lambda or std::function
     //wrapping a lambda it will invoke the lambdas code. 
     //The result is stored in leftExp
 
-    while(!peekTokenIs(TokenType::SEMICOLON) && pVal < peekPrecedence()) {
+    while(!nestingLimitHit && !peekTokenIs(TokenType::SEMICOLON) && pVal < peekPrecedence()) {
         auto infixIt = infixParseFns.find(peekToken.Type);
-        if (infixIt == infixParseFns.end()) return leftExp;
+        if (infixIt == infixParseFns.end()) break;
         nextToken();
 
-        auto infix = infixIt->second;
+        auto& infix = infixIt->second;
         leftExp = (infix)(leftExp);    }
 
+    nestingDepth--;
     return leftExp;
 
 }
@@ -269,10 +478,9 @@ std::shared_ptr<Identifier>  Parser::parseIdentifier(){
 std::shared_ptr<IntegerLiteral>  Parser::parseIntegerLiteral(){
     auto lit = std::make_shared<IntegerLiteral>(curToken);
 
-    try {
-        //stoi can throw an exception if conversion fails
-        lit->Value = std::stoll(curToken.Literal);
-    } catch (const std::exception& e){
+    const auto& text = curToken.Literal;
+    auto res = std::from_chars(text.data(), text.data() + text.size(), lit->Value);
+    if (res.ec != std::errc() || res.ptr != text.data() + text.size()) {
         std::string msg = "could not parse \"" + curToken.Literal + "\" as integer";
         errors.push_back(msg);
         return nullptr;
@@ -360,7 +568,7 @@ std::shared_ptr<BlockStatement> Parser::parseBlockStatement(){
 
     nextToken();
 
-    while (!curTokenIs(TokenType::RBRACE) && !curTokenIs(TokenType::EOF_TOKEN)) {
+    while (!curTokenIs(TokenType::RBRACE) && !curTokenIs(TokenType::EOF_TOKEN) && !nestingLimitHit) {
         auto stmt = parseStatement();
         if (stmt) {
             block->Statements.push_back(stmt);
@@ -384,10 +592,42 @@ std::shared_ptr<FunctionLiteral> Parser::parseFunctionLiteral(){
         return nullptr;
     }
 
-    lit->Body = parseBlockStatement();
+    if (lazySource) {
+        skipFunctionBody(*lit);
+    } else {
+        lit->Body = parseBlockStatement();
+    }
 
     return lit;
 }
+
+// Steps over a body by matching braces only, and leaves the literal a way
+// to parse that stretch of source later with the same nesting depth. Like
+// parseBlockStatement, a missing closing brace runs the body to EOF.
+void Parser::skipFunctionBody(FunctionLiteral& lit) {
+    auto begin = curToken.Position;
+    int braces = 1;
+    while (braces > 0) {
+        nextToken();
+        if (curTokenIs(TokenType::EOF_TOKEN)) break;
+        if (curTokenIs(TokenType::LBRACE)) braces++;
+        else if (curTokenIs(TokenType::RBRACE)) braces--;
+    }
+    auto end = curTokenIs(TokenType::EOF_TOKEN) ? lazySource->size() : curToken.Position + 1;
+
+    auto src = lazySource;
+    int depth = nestingDepth;
+    int maxDepth = maxNestingDepth;
+    lit.DeferredBody = [src, begin, end, depth, maxDepth](std::vector<std::string>& errs) {
+        Lexer l(src, begin, end);
+        Parser p(l, maxDepth);
+        p.lazySource = src;
+        p.nestingDepth = depth;
+        auto body = p.parseBlockStatement();
+        errs = p.errors;
+        return body;
+    };
+}
 std::vector<std::shared_ptr<Identifier>>  Parser::parseFunctionParameters() {
     std::vector<std::shared_ptr<Identifier>> identifiers;
 
@@ -449,11 +689,77 @@ std::vector<std::shared_ptr<Expression>> Parser::parseExpressionList(const Token
     return list;
 }
 
-std::shared_ptr<ArrayLiteral> Parser::parseArrayLiteral(){
-    auto array = std::make_shared<ArrayLiteral>(curToken);
+// Scalars that can go into a packed literal. Integers with leading zeros
+// are left out so the node still prints the way it was written.
+bool Parser::constantToken(const Token& tok, ConstantValue& out) {
+    out.Kind = tok.Type;
+    switch (tok.Type) {
+    case TokenType::INT: {
+        const auto& text = tok.Literal;
+        if (text.size() > 1 && text[0] == '0') return false;
+        auto res = std::from_chars(text.data(), text.data() + text.size(), out.Int);
+        return res.ec == std::errc() && res.ptr == text.data() + text.size();
+    }
+    case TokenType::STRING:
+        out.Str = tok.Literal;
+        return true;
+    case TokenType::TRUE:
+    case TokenType::FALSE:
+        return true;
+    default:
+        return false;
+    }
+}
 
-    array->Elements = parseExpressionList(TokenType::RBRACKET);
+// Integer-only arrays are read straight into a packed node. As soon as an
+// element turns out not to be a plain integer, the values read so far are
+// turned back into nodes and the rest is parsed the normal way.
+std::shared_ptr<Expression> Parser::parseArrayLiteral(){
+    auto open = curToken;
+    std::vector<int64_t> values;
+    ConstantValue c;
+    bool atElement = false; // stopped with the current token starting an element
 
+    while (peekTokenIs(TokenType::INT)) {
+        nextToken();
+        if (!(peekTokenIs(TokenType::COMMA) || peekTokenIs(TokenType::RBRACKET)) || !constantToken(curToken, c)) {
+            atElement = true;
+            break;
+        }
+        values.push_back(c.Int);
+        nextToken();
+        if (curTokenIs(TokenType::RBRACKET)) {
+            if (values.size() >= PACKED_LITERAL_MIN_ELEMENTS) {
+                return std::make_shared<IntegerArrayLiteral>(open, std::move(values));
+            }
+            break;
+        }
+    }
+
+    auto array = std::make_shared<ArrayLiteral>(open);
+    if (values.empty() && !atElement) {
+        array->Elements = parseExpressionList(TokenType::RBRACKET);
+        return array;
+    }
+
+    c.Kind = TokenType::INT;
+    array->Elements.reserve(values.size());
+    for (auto v : values) {
+        c.Int = v;
+        array->Elements.push_back(c.ToExpression());
+    }
+    if (curTokenIs(TokenType::RBRACKET)) return array; // short, but complete
+
+    if (!atElement) nextToken();
+    array->Elements.push_back(parseExpression(Precedence::LOWEST));
+    while(peekTokenIs(TokenType::COMMA)){
+        nextToken();
+        nextToken();
+        array->Elements.push_back(parseExpression(Precedence::LOWEST));
+    }
+    if(!expectPeek(TokenType::RBRACKET)){
+        array->Elements.clear();
+    }
     return array;
 }
 
@@ -467,8 +773,54 @@ std::shared_ptr<IndexExpression> Parser::parseIndexExpression(std::shared_ptr<Ex
     return exp;
 }
 
-std::shared_ptr<HashLiteral> Parser::parseHashLiteral(){
-    auto hash = std::make_shared<HashLiteral>(curToken);
+// Like arrays, hashes of constants are read into a packed node, falling
+// back to the general parse at whichever point of a pair it stops.
+std::shared_ptr<Expression> Parser::parseHashLiteral(){
+    auto open = curToken;
+    std::vector<std::pair<ConstantValue, ConstantValue>> pairs;
+    ConstantValue key, value;
+    enum { KeyAtPeek, KeyAtCur, ValueAtPeek, ValueAtCur } resume = KeyAtPeek;
+
+    while (true) {
+        if (peekTokenIs(TokenType::RBRACE) && !pairs.empty()) {
+            nextToken();
+            if (pairs.size() >= PACKED_LITERAL_MIN_ELEMENTS) {
+                return std::make_shared<ConstantHashLiteral>(open, std::move(pairs));
+            }
+            break;
+        }
+        if (!constantToken(peekToken, key)) break;
+        nextToken();
+        if (!peekTokenIs(TokenType::COLON)) { resume = KeyAtCur; break; }
+        nextToken();
+        if (!constantToken(peekToken, value)) { resume = ValueAtPeek; break; }
+        nextToken();
+        if (!peekTokenIs(TokenType::COMMA) && !peekTokenIs(TokenType::RBRACE)) { resume = ValueAtCur; break; }
+        pairs.emplace_back(key, value);
+        if (peekTokenIs(TokenType::COMMA)) nextToken();
+    }
+
+    auto hash = std::make_shared<HashLiteral>(open);
+    for (const auto& pair : pairs) {
+        hash->Pairs[pair.first.ToExpression()] = pair.second.ToExpression();
+    }
+    if (curTokenIs(TokenType::RBRACE)) return hash; // short, but complete
+
+    if (resume != KeyAtPeek) {
+        std::shared_ptr<Expression> keyExp;
+        if (resume == KeyAtCur) {
+            keyExp = parseExpression(Precedence::LOWEST);
+            if(!expectPeek(TokenType::COLON)) return nullptr;
+            nextToken();
+        } else {
+            keyExp = key.ToExpression();
+            if (resume == ValueAtPeek) nextToken();
+        }
+        hash->Pairs[keyExp] = parseExpression(Precedence::LOWEST);
+
+        if(!peekTokenIs(TokenType::RBRACE) && !expectPeek(TokenType::COMMA)) return nullptr;
+    }
+
     while(!peekTokenIs(TokenType::RBRACE)) {
         nextToken();
         auto key = parseExpression(Precedence::LOWEST);
@@ -10,6 +10,7 @@
 #include "../lexer/lexer.hpp"
 #include "../token/token.hpp"
 #include "../ast/ast.hpp"
+#include "../util/thread_pool.hpp"
 
 using namespace YOXS_AST;
 
@@ -26,12 +27,47 @@ enum Precedence {
 
 extern std::unordered_map<TokenType, Precedence> precedences;
 
+// How deeply expressions and blocks may nest before the parser gives up.
+// Every level of nesting costs a few native stack frames, so this bounds
+// the stack the parser (and later the evaluator) can use on hostile input.
+const int DEFAULT_MAX_NESTING_DEPTH = 1024;
+
+// One change made in an editor: Removed bytes at Offset were replaced by
+// Inserted bytes. Offset is in the source as it was after the edits
+// before this one.
+struct SourceEdit {
+    std::string::size_type Offset = 0;
+    std::string::size_type Removed = 0;
+    std::string::size_type Inserted = 0;
+};
+
 class Parser {
 public:
-    Parser(Lexer& l);
+    Parser(Lexer& l, int maxNestingDepth = DEFAULT_MAX_NESTING_DEPTH);
 
     std::vector<std::string> Errors() const; 
+
+    // In lazy mode function bodies are only brace-matched; each literal
+    // parses its body the first time something asks for it. Needs a lexer
+    // that holds the whole source, otherwise bodies are parsed eagerly.
+    void SetLazyFunctionBodies(bool lazy);
     std::shared_ptr<Program> ParseProgram();
+    // Splits the remaining tokens into top-level statements (at bracket
+    // depth zero) and parses batches of them on the pool. The program and
+    // errors are the same as ParseProgram's, in source order; when a batch
+    // has errors, the tokens are parsed again sequentially to get them.
+    std::shared_ptr<Program> ParseProgram(ThreadPool& pool);
+    // Parses the lexer's source, which is old's source with edits applied,
+    // by reparsing only the top-level statements around the edits and
+    // reusing old's statements before and after them. Falls back to
+    // ParseProgram when old has no statement spans.
+    std::shared_ptr<Program> ReparseProgram(const Program& old, const std::vector<SourceEdit>& edits);
+
+    // Statement-at-a-time parsing, for running a program while the rest of
+    // it is still being read. ParseNextStatement returns nullptr for a
+    // statement that failed to parse, so check Errors() after each call.
+    bool AtEnd() const;
+    std::shared_ptr<Statement> ParseNextStatement();
 
 private:
     Lexer* lexer;
@@ -46,6 +82,15 @@ private:
     //curToken doesn’t give us enough information.
     std::vector<std::string> errors;
 
+    int maxNestingDepth;
+    int nestingDepth;
+    //once the nesting limit is hit we stop recording errors and unwind,
+    //otherwise every enclosing level would add its own "expected )" error
+    bool nestingLimitHit;
+
+    // set while function bodies are being deferred
+    std::shared_ptr<const std::string> lazySource;
+
     using prefixParseFn = std::function<std::shared_ptr<Expression>(void)>;
     using infixParseFn = std::function<std::shared_ptr<Expression>(std::shared_ptr<Expression>)>;
 
@@ -61,6 +106,8 @@ private:
     bool expectPeek(TokenType t);
     void peekError(TokenType t);
     void noPrefixParseFnError(TokenType t);
+    void nestingLimitError();
+    std::vector<std::size_t> statementStarts(const std::vector<Token>& tokens) const;
     int peekPrecedence() const;
     int curPrecedence() const;
 
@@ -84,12 +131,14 @@ private:
     std::shared_ptr<IfExpression> parseIfExpression();
     std::shared_ptr<BlockStatement> parseBlockStatement();
     std::shared_ptr<FunctionLiteral> parseFunctionLiteral();
+    void skipFunctionBody(FunctionLiteral& lit);
     std::vector<std::shared_ptr<Identifier>> parseFunctionParameters();     
     std::shared_ptr<CallExpression> parseCallExpression(std::shared_ptr<Expression> function);
     std::vector<std::shared_ptr<Expression>> parseExpressionList(const TokenType& end);
-    std::shared_ptr<ArrayLiteral> parseArrayLiteral();
+    std::shared_ptr<Expression> parseArrayLiteral();
     std::shared_ptr<IndexExpression> parseIndexExpression(std::shared_ptr<Expression> left);
-    std::shared_ptr<HashLiteral> parseHashLiteral();
+    std::shared_ptr<Expression> parseHashLiteral();
+    static bool constantToken(const Token& tok, ConstantValue& out);
     
 
 };
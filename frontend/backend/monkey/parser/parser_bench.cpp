@@ -0,0 +1,72 @@
+#include "parser.hpp"
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//Parser Benchmark: times a full parse of a 5000 line program against an
+//incremental reparse after typing one character in the middle of it.
+
+// identifiers are letters only, so spell the number with them
+std::string name(const char* prefix, size_t i) {
+    std::string n = prefix;
+    for (char c : std::to_string(i)) n += static_cast<char>('a' + (c - '0'));
+    return n;
+}
+
+std::string generateInput(size_t lines) {
+    std::string src;
+    for (size_t i = 0; i < lines; ++i) {
+        switch (i % 4) {
+        case 0: src += "let " + name("v", i) + " = " + std::to_string(i) + " * 2 + 1;\n"; break;
+        case 1: src += "let " + name("f", i) + " = fn(a, b) { if (a < b) { a } else { b } };\n"; break;
+        case 2: src += "let " + name("s", i) + " = [\"x\", \"y\", " + std::to_string(i) + "][1];\n"; break;
+        default: src += name("f", i - 2) + "(" + name("v", i - 3) + ", 10);\n"; break;
+        }
+    }
+    return src;
+}
+
+template <typename F>
+double timeUs(F&& f, int runs) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; ++i) f();
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / runs;
+}
+
+int main() {
+    const int runs = 50;
+    std::string input = generateInput(5000);
+
+    Lexer l(input);
+    Parser p(l);
+    auto old = p.ParseProgram();
+    if (!p.Errors().empty()) {
+        std::cerr << "generated program does not parse: " << p.Errors()[0] << std::endl;
+        return 1;
+    }
+    std::cout << "input: " << input.size() / 1024 << " KB, " << old->Statements.size() << " statements" << std::endl;
+
+    double full = timeUs([&] {
+        Lexer l(input);
+        Parser p(l);
+        p.ParseProgram();
+    }, runs);
+    std::cout << "full parse: " << full << " us" << std::endl;
+
+    // type a digit into the literal of a let in the middle of the program
+    std::string edited = input;
+    auto offset = edited.find(" = 2500 ") + 4;
+    edited.insert(offset, "7");
+    std::vector<SourceEdit> edits = {{offset, 0, 1}};
+    auto source = std::make_shared<const std::string>(edited);
+
+    double incremental = timeUs([&] {
+        Lexer l(source, 0, source->size());
+        Parser p(l);
+        p.ReparseProgram(*old, edits);
+    }, runs);
+    std::cout << "incremental reparse: " << incremental << " us (x" << full / incremental << ")" << std::endl;
+    return 0;
+}
@@ -834,6 +834,254 @@ void TestHashLiteralExpression() {
     assert(value != nullptr && value->String() == "value");
 }
 
+void TestParallelParsing() {
+    std::string valid;
+    for (int i = 0; i < 200; i++) {
+        // identifiers take letters only
+        std::string n = std::to_string(i);
+        std::string name = "f" + std::string(1, char('a' + i / 26)) + std::string(1, char('a' + i % 26));
+        valid += "let " + name + " = fn(x) { if (x > " + n + ") { return [x, {\"k\": x}]; } x * " + n + " };\n";
+        valid += name + "(1) + 2\n";
+    }
+    // broken expressions that swallow the let or return after them,
+    // repeated so that some batch starts at one
+    std::string swallowedLet, swallowedReturn;
+    for (int i = 0; i < 40; i++) {
+        swallowedLet += "let x = 1 + let y = 2;\n";
+        swallowedReturn += "let a = 1 + \nreturn 5;\n";
+    }
+    // with broken statements, whose errors must come out in source order
+    std::vector<std::string> inputs = {
+        valid,
+        valid + "let = 5; let y 1; (1;\n let z = 3;",
+        valid + swallowedLet + valid,
+        valid + swallowedReturn + valid,
+        valid + "1 + ; ;\n" + valid,
+    };
+
+    ThreadPool pool(4);
+    for (std::size_t i = 0; i < inputs.size(); i++) {
+        Lexer l1(inputs[i]);
+        Parser sequential(l1);
+        auto want = sequential.ParseProgram();
+
+        Lexer l2(inputs[i]);
+        Parser parallel(l2);
+        auto got = parallel.ParseProgram(pool);
+
+        assert(got->Statements.size() == want->Statements.size());
+        assert(parallel.Errors() == sequential.Errors());
+        assert(parallel.Errors().empty() == (i == 0));
+        // a broken infix expression may have no right side to print
+        if (i == 0) assert(got->String() == want->String());
+    }
+}
+
+void TestPackedLiterals() {
+    std::string ints;
+    std::vector<std::string> elems;
+    for (int i = 0; i < 20; i++) elems.push_back(std::to_string(i * 1000));
+    ints = join(elems, ", ");
+
+    // all-integer arrays are packed
+    {
+        Lexer l("[" + ints + "]");
+        Parser p(l);
+        auto program = p.ParseProgram();
+        checkParserErrors(p);
+        auto stmt = std::dynamic_pointer_cast<ExpressionStatement>(program->Statements[0]);
+        auto packed = std::dynamic_pointer_cast<IntegerArrayLiteral>(stmt->expr);
+        assert(packed != nullptr);
+        assert(packed->Values.size() == 20 && packed->Values[19] == 19000);
+        assert(program->String() == "[" + ints + "]");
+    }
+
+    // one non-constant element anywhere falls back to a normal array
+    for (const std::string& input : std::vector<std::string>{"[" + ints + ", 1 + 2]", "[1 + 2, " + ints + "]", "[" + ints + ", x]", "[" + ints + ", 007]"}) {
+        Lexer l(input);
+        Parser p(l);
+        auto program = p.ParseProgram();
+        checkParserErrors(p);
+        auto stmt = std::dynamic_pointer_cast<ExpressionStatement>(program->Statements[0]);
+        auto array = std::dynamic_pointer_cast<ArrayLiteral>(stmt->expr);
+        assert(array != nullptr);
+        assert(array->Elements.size() == 21);
+    }
+
+    // errors are the same as without the fast path
+    {
+        Lexer l("[1, 2,]");
+        Parser p(l);
+        p.ParseProgram();
+        assert(p.Errors().size() == 2);
+        assert(p.Errors()[0] == "no prefix parse function for ] found");
+        assert(p.Errors()[1] == "expected next token to be ], got EOF instead");
+    }
+
+    std::string pairs;
+    for (int i = 0; i < 20; i++) pairs += "\"k" + std::to_string(i) + "\": " + std::to_string(i) + ", ";
+    pairs += "true: false, 5: \"five\"";
+    {
+        Lexer l("{" + pairs + "}");
+        Parser p(l);
+        auto program = p.ParseProgram();
+        checkParserErrors(p);
+        auto stmt = std::dynamic_pointer_cast<ExpressionStatement>(program->Statements[0]);
+        auto packed = std::dynamic_pointer_cast<ConstantHashLiteral>(stmt->expr);
+        assert(packed != nullptr);
+        assert(packed->Pairs.size() == 22);
+        assert(packed->Pairs[20].first.Kind == TokenType::TRUE);
+        assert(packed->Pairs[21].second.Str == "five");
+    }
+
+    // the fallback can resume at any point of a pair
+    for (const std::string tail : {"x: 1", "\"a\" + \"b\": 1", "\"a\": y", "\"a\": 1 + 1"}) {
+        Lexer l("{" + pairs + ", " + tail + ", \"z\": 0}");
+        Parser p(l);
+        auto program = p.ParseProgram();
+        checkParserErrors(p);
+        auto stmt = std::dynamic_pointer_cast<ExpressionStatement>(program->Statements[0]);
+        auto hash = std::dynamic_pointer_cast<HashLiteral>(stmt->expr);
+        assert(hash != nullptr);
+        assert(hash->Pairs.size() == 24);
+    }
+}
+
+std::shared_ptr<Program> reparse(const Program& old, std::string& src, std::vector<SourceEdit> edits,
+                                 const std::vector<std::string>& texts, std::vector<std::string>& errors) {
+    for (size_t k = 0; k < edits.size(); ++k) {
+        src.replace(edits[k].Offset, edits[k].Removed, texts[k]);
+        edits[k].Inserted = texts[k].size();
+    }
+    Lexer l(src);
+    Parser p(l);
+    auto program = p.ReparseProgram(old, edits);
+    errors = p.Errors();
+    return program;
+}
+
+void TestIncrementalReparse() {
+    std::string src = "let a = 1;\nlet b = a + 2;\nlet c = fn(x) { x * b };\nc(a)\n!b\n";
+    Lexer l(src);
+    Parser p(l);
+    auto old = p.ParseProgram();
+    checkParserErrors(p);
+    assert(old->Spans.size() == 5);
+    assert(old->Spans[0].Begin == 0 && old->Spans[0].End == 11 && old->Spans[4].End == src.size());
+
+    struct Test {
+        std::vector<SourceEdit> edits;
+        std::vector<std::string> texts;
+    };
+    std::vector<Test> tests = {
+        {{{23, 1, 0}}, {"20"}},                        // change a literal in the second statement
+        {{{src.size() - 2, 0, 0}}, {"="}},              // "c(a)\n!b" turns into one statement
+        {{{11, 15, 0}}, {""}},                         // delete a whole statement
+        {{{src.size(), 0, 0}}, {"let d = c(b);"}},     // append at the end
+        {{{0, 0, 0}, {57, 0, 0}}, {"let z = 0;", " + 1"}}, // two edits
+        {{}, {}},
+    };
+
+    for (const auto& tt : tests) {
+        std::string edited = src;
+        std::vector<std::string> errors;
+        auto program = reparse(*old, edited, tt.edits, tt.texts, errors);
+        assert(errors.empty());
+
+        Lexer fl(edited);
+        Parser fp(fl);
+        auto want = fp.ParseProgram();
+        if (program->String() != want->String()) {
+            std::cerr << "reparse wrong. expected=" << want->String() << ", got=" << program->String() << std::endl;
+            assert(false);
+        }
+        assert(program->Spans.size() == want->Spans.size());
+        for (size_t i = 0; i < want->Spans.size(); ++i) {
+            assert(program->Spans[i].Begin == want->Spans[i].Begin && program->Spans[i].End == want->Spans[i].End);
+        }
+    }
+
+    // statements after an edit are reused, not reparsed
+    std::string edited = src;
+    std::vector<std::string> errors;
+    auto program = reparse(*old, edited, {{23, 1, 0}}, {"20"}, errors);
+    assert(program->Statements[2] == old->Statements[2] && program->Statements[4] == old->Statements[4]);
+    assert(program->Statements[1] != old->Statements[1]);
+
+    // a program with errors has no spans, and reparsing it parses everything
+    auto broken = reparse(*old, edited, {{4, 1, 0}}, {""}, errors);
+    assert(!errors.empty() && broken->Spans.empty());
+    auto fixed = reparse(*broken, edited, {{4, 0, 0}}, {"a"}, errors);
+    assert(errors.empty() && fixed->String() == program->String() && fixed->Spans.size() == 5);
+
+    std::cout << "TestIncrementalReparse passed!" << std::endl;
+}
+
+void TestLazyFunctionBodies() {
+    std::string input = "let f = fn(x) { let y = {\"}\": x}; fn(z) { if (z) { y } else { [z] } } };\n"
+                        "let broken = fn() { let = ; };\n"
+                        "f(1)";
+
+    Lexer eagerLexer(input);
+    Parser eager(eagerLexer);
+    auto want = eager.ParseProgram();
+
+    Lexer l(input);
+    Parser p(l);
+    p.SetLazyFunctionBodies(true);
+    auto program = p.ParseProgram();
+    // bodies are not looked at, so the broken one goes unnoticed for now
+    checkParserErrors(p);
+    assert(program->Statements.size() == 3);
+
+    auto let = std::dynamic_pointer_cast<LetStatement>(program->Statements[0]);
+    auto fn = std::dynamic_pointer_cast<FunctionLiteral>(let->Value);
+    assert(fn != nullptr && fn->Body == nullptr && fn->DeferredBody);
+
+    // the body parses on first use, and nested functions are deferred too
+    const auto& body = fn->GetBody();
+    assert(body != nullptr && fn->BodyErrors.empty());
+    auto inner = std::dynamic_pointer_cast<ExpressionStatement>(body->Statements[1]);
+    auto innerFn = std::dynamic_pointer_cast<FunctionLiteral>(inner->expr);
+    assert(innerFn != nullptr && innerFn->Body == nullptr);
+    assert(program->String().find(want->Statements[0]->String()) == 0);
+
+    auto broken = std::dynamic_pointer_cast<FunctionLiteral>(std::dynamic_pointer_cast<LetStatement>(program->Statements[1])->Value);
+    broken->GetBody();
+    assert(broken->BodyErrors.size() == 2);
+    assert(broken->BodyErrors[0] == "expected next token to be IDENT, got = instead");
+}
+
+void TestNestingLimit() {
+    // within the limit nesting parses normally
+    std::string shallow = std::string(100, '(') + "1" + std::string(100, ')');
+    Lexer l1(shallow);
+    Parser p1(l1);
+    auto program = p1.ParseProgram();
+    checkParserErrors(p1);
+    assert(program->Statements.size() == 1);
+    assert(program->String() == "1");
+
+    // far past the limit we get a single error instead of a stack overflow
+    std::string deep = std::string(200000, '(') + "1" + std::string(200000, ')');
+    Lexer l2(deep);
+    Parser p2(l2);
+    p2.ParseProgram();
+    assert(p2.Errors().size() == 1);
+    assert(p2.Errors()[0] == "expression nested too deeply (limit 1024)");
+
+    // nested function bodies count too, and the limit is configurable
+    std::string fns;
+    for (int i = 0; i < 20; i++) fns += "fn() { ";
+    fns += "1";
+    for (int i = 0; i < 20; i++) fns += " }";
+    Lexer l3(fns);
+    Parser p3(l3, 10);
+    p3.ParseProgram();
+    assert(p3.Errors().size() == 1);
+    assert(p3.Errors()[0] == "expression nested too deeply (limit 10)");
+}
+
 bool testLetStatement(const std::shared_ptr<Statement>& s, const std::string& name) {
     if (s->TokenLiteral() != "let") {
         std::cerr << "s.TokenLiteral not 'let'. got=" << s->TokenLiteral() << std::endl;
@@ -987,6 +1235,11 @@ int main() {
     TestArrayLiteralExpression();
     TestIndexExpressions();
     TestHashLiteralExpression();
+    TestNestingLimit();
+    TestParallelParsing();
+    TestPackedLiterals();
+    TestLazyFunctionBodies();
+    TestIncrementalReparse();
     
     std::cout << "All parser_test.cpp tests passed!" << std::endl;
     return 0;
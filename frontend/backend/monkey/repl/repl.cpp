@@ -59,12 +59,18 @@ void REPL::Start(std::istream& in, std::ostream& out) {
             continue;
         }
 
-        auto env = std::make_shared<Environment>();
-        Evaluator evaluator;
-        auto evaluated = evaluator.Eval(program, env);
-        if(evaluated) {
-            out << evaluated->Inspect() << "\n";
+        {
+            auto env = MakeEnvironment();
+            Evaluator evaluator;
+            auto evaluated = evaluator.Eval(program, env);
+            if(evaluated) {
+                out << evaluated->Inspect() << "\n";
+            }
         }
+        // frees the line's recursive functions along with its environment,
+        // then hands the emptied slab pages back
+        Heap::Collect();
+        Slab::Trim();
     }
 }
 
@@ -100,7 +106,7 @@ void REPL::StartSingle(std::istream& in, std::ostream& out) {
 
     // Evaluation
     out << "\nStarting Evaluation...\n";
-    auto env = std::make_shared<Environment>();
+    auto env = MakeEnvironment();
     Evaluator evaluator;
     auto evaluated = evaluator.Eval(program, env);
 
@@ -114,6 +120,69 @@ void REPL::StartSingle(std::istream& in, std::ostream& out) {
 
 }
 
+// Runs a whole program from in, evaluating each top-level statement as soon
+// as it has been parsed instead of waiting for the end of the input. Only the
+// lexer's window of unread source is buffered, so arbitrarily long generated
+// scripts start producing output right away.
+void REPL::StartStream(std::istream& in, std::ostream& out) {
+    Lexer l(in);
+    Parser p(l);
+    auto env = MakeEnvironment();
+    ObjectRef result;
+
+    while (!p.AtEnd()) {
+        auto stmt = p.ParseNextStatement();
+        if (!p.Errors().empty()) {
+            printParserErrors(out, p.Errors());
+            return;
+        }
+        if (!stmt) continue;
+
+        result = Evaluator::Eval(stmt, env);
+        if (auto returnValue = DynamicRefCast<ReturnValue>(result)) {
+            result = returnValue->Value;
+            break;
+        }
+        if (Evaluator::isError(result)) break;
+    }
+
+    if (result) {
+        out << result->Inspect() << "\n";
+    }
+    env.reset();
+    result.reset();
+    Heap::Collect();
+    Slab::Trim();
+}
+
+// Runs a whole program in a Region of its own and returns what it printed
+// as its result, or its parse errors. The lexer, the AST, every
+// environment and object come from the region and are never destroyed;
+// only the returned string is copied out before the region is released,
+// so teardown costs the same however big the run's object graph was.
+std::string REPL::RunIsolated(const std::string& source) {
+    Region region;
+    std::string* rendered;
+    {
+        Region::Scope scope(region);
+        // allocated with new so that nothing here runs a destructor
+        rendered = new std::string;
+        auto lexer = new Lexer(source);
+        auto parser = new Parser(*lexer);
+        auto program = new std::shared_ptr<Program>(parser->ParseProgram());
+        if (!parser->Errors().empty()) {
+            *rendered = "Woops! We ran into an error:\n";
+            for (const auto& msg : parser->Errors()) {
+                *rendered += "\t" + msg + "\n";
+            }
+        } else {
+            auto env = new std::shared_ptr<Environment>(MakeEnvironment());
+            auto evaluated = new ObjectRef(Evaluator::Eval(*program, *env));
+            if (*evaluated) *rendered = (*evaluated)->Inspect() + "\n";
+        }
+    }
+    return *rendered;
+}
 
 void REPL::printParserErrors(std::ostream& out, const std::vector<std::string>& errors) {
     out << "Woops! We ran into an error:\n";
@@ -8,6 +8,8 @@
 #include "../parser/parser.hpp"
 #include "../ast/ast.hpp"
 #include "../evaluator/evaluator.hpp"
+#include "../object/heap.hpp"
+#include "../object/region.hpp"
 
 class REPL {
 public:
@@ -15,6 +17,8 @@ public:
     static void parserStart(std::istream& in, std::ostream& out);
     static void Start(std::istream& in, std::ostream& out);
     static void StartSingle(std::istream& in, std::ostream& out);
+    static void StartStream(std::istream& in, std::ostream& out);
+    static std::string RunIsolated(const std::string& source);
     static void printParserErrors(std::ostream& out, const std::vector<std::string>& errors);
 };
 
@@ -11,11 +11,15 @@ void testSimpleExpression();
 void testFunctionDefinition();
 void testLetStatements();
 void testParsingErrors();
+void testStreamREPL();
+void testRunIsolated();
 
 int main() {
     // This stringstream will simulate the in put for the REPL.
     testTokenREPL();
     testParserREPL();
+    testStreamREPL();
+    testRunIsolated();
 
     std::cout << "All repl_test.cpp tests passed!" << std::endl;
     return 0;
@@ -111,4 +115,99 @@ void testParsingErrors() {
     std::cout << "Parsing error tests passed!" << std::endl;
 }
 
-//g++ -std=c++17 -Isrc -o repl_test src/monkey/repl/repl.cpp src/monkey/lexer/lexer.cpp src/monkey/token/token.cpp src/monkey/parser/parser.cpp src/monkey/ast/ast.cpp src/monkey/object/object.cpp src/monkey/evaluator/evaluator.cpp src/monkey/object/environment.cpp src/monkey/repl/repl_test.cpp && ./repl_test
\ No newline at end of file
+void testStreamREPL() {
+    std::istringstream input(
+        "let add = fn(a, b) {\n"
+        "  a + b\n"
+        "};\n"
+        "let x = add(2, 3);\n"
+        "add(x, 10)\n");
+    std::ostringstream output;
+    REPL::StartStream(input, output);
+    assert(output.str() == "15\n");
+
+    // a return at the top level ends the program early
+    std::istringstream early("return 1; 2;");
+    std::ostringstream earlyOut;
+    REPL::StartStream(early, earlyOut);
+    assert(earlyOut.str() == "1\n");
+
+    std::istringstream bad("let x = 1; let y 2;");
+    std::ostringstream badOut;
+    REPL::StartStream(bad, badOut);
+    assert(badOut.str().find("expected next token to be =, got INT instead") != std::string::npos);
+
+    std::cout << "Stream REPL tests passed!" << std::endl;
+}
+
+void testRunIsolated() {
+    {
+        Region region;
+        std::string* inside;
+        std::string outside(100, 'x');
+        {
+            Region::Scope scope(region);
+            inside = new std::string(100, 'y');
+            {
+                Region::Outside escape;
+                auto heap = new int(1);
+                assert(!region.Owns(heap));
+                delete heap;
+            }
+            delete inside; // a no-op: the memory stays the region's
+        }
+        assert(region.Owns(inside->data()));
+        assert(!region.Owns(outside.data()));
+        assert(region.BytesAllocated() >= 100);
+
+        // Owns finds the oldest chunk too, not only the newest
+        {
+            Region::Scope scope(region);
+            for (int i = 0; i < 64; ++i) new std::string(64 * 1024, 'z');
+        }
+        assert(region.Chunks() > 4);
+        assert(region.Owns(inside->data()));
+        assert(!region.Owns(outside.data()));
+    }
+
+    auto trackedBefore = Heap::Stats().Tracked;
+    assert(REPL::RunIsolated(
+        "let fib = fn(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } };"
+        "fib(10)") == "55\n");
+    // recursive closures in a region are not left to the collector
+    assert(Heap::Stats().Tracked == trackedBefore);
+
+    // more arguments than fit inline take the per-thread stack, which must
+    // still be usable once the region that first grew it is gone
+    std::string manyArgs = "let f = fn(a, b, c, d, e, f, g, h, i, j) { a + j }; f(1, 2, 3, 4, 5, 6, 7, 8, 9, 10)";
+    assert(REPL::RunIsolated(manyArgs) == "11\n");
+    assert(REPL::RunIsolated(manyArgs) == "11\n");
+    std::istringstream again(manyArgs);
+    std::ostringstream againOut;
+    REPL::StartStream(again, againOut);
+    assert(againOut.str() == "11\n");
+
+    assert(REPL::RunIsolated("let x = [1, 2, 3]; push(x, \"four\")") == "[1, 2, 3, four]\n");
+
+    // pmap in a region runs on this thread and leaves the shared pool
+    // alone, so the pool it uses afterwards is built from the heap
+    std::string doubled = "sum(pmap(range(2000), fn(x) { x * 2 }))";
+    assert(REPL::RunIsolated("pmap([1, 2, 3], fn(x) { x + 1 })") == "[2, 3, 4]\n");
+    assert(REPL::RunIsolated(doubled) == "3998000\n");
+    std::istringstream parallel(doubled);
+    std::ostringstream parallelOut;
+    REPL::StartStream(parallel, parallelOut);
+    assert(parallelOut.str() == "3998000\n");
+    // the boolean constants stay usable once the region that used them
+    // is gone
+    assert(REPL::RunIsolated("[1 < 2, 2 < 1]") == "[true, false]\n");
+    std::istringstream compared("[1 < 2, true == (2 > 1), !true]");
+    std::ostringstream comparedOut;
+    REPL::StartStream(compared, comparedOut);
+    assert(comparedOut.str() == "[true, true, false]\n");
+    assert(REPL::RunIsolated("let y 2;").find("expected next token to be =, got INT instead") != std::string::npos);
+
+    std::cout << "Isolated run tests passed!" << std::endl;
+}
+
+//g++ -std=c++17 -Isrc -o repl_test src/monkey/repl/repl.cpp src/monkey/lexer/lexer.cpp src/monkey/token/token.cpp src/monkey/parser/parser.cpp src/monkey/ast/ast.cpp src/monkey/object/object.cpp src/monkey/evaluator/evaluator.cpp src/monkey/object/environment.cpp src/monkey/repl/repl_test.cpp && ./repl_test
@@ -53,6 +53,7 @@ class Token {
 public:
     TokenType Type;
     std::string Literal;
+    std::string::size_type Position = 0; // byte offset of the token in the source
     Token() = default;
     Token(TokenType type, const std::string& literal);
 };
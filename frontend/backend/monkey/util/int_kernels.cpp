@@ -0,0 +1,223 @@
+#include "int_kernels.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define INT_KERNELS_AVX2 1
+#endif
+
+namespace {
+
+// 128 bits hold any sum of fewer than 2^63 int64 values exactly
+bool narrow(__int128 wide, int64_t& out) {
+    if (wide < INT64_MIN || wide > INT64_MAX) return false;
+    out = static_cast<int64_t>(wide);
+    return true;
+}
+
+bool sumScalar(const int64_t* a, std::size_t n, int64_t& out) {
+    __int128 sum = 0;
+    for (std::size_t i = 0; i < n; ++i) sum += a[i];
+    return narrow(sum, out);
+}
+
+int64_t minScalar(const int64_t* a, std::size_t n) {
+    int64_t m = a[0];
+    for (std::size_t i = 1; i < n; ++i) m = a[i] < m ? a[i] : m;
+    return m;
+}
+
+int64_t maxScalar(const int64_t* a, std::size_t n) {
+    int64_t m = a[0];
+    for (std::size_t i = 1; i < n; ++i) m = a[i] > m ? a[i] : m;
+    return m;
+}
+
+bool addScalar(const int64_t* a, const int64_t* b, int64_t* out, std::size_t n) {
+    bool overflow = false;
+    for (std::size_t i = 0; i < n; ++i) overflow |= __builtin_add_overflow(a[i], b[i], &out[i]);
+    return !overflow;
+}
+
+#ifdef INT_KERNELS_AVX2
+
+// Four lanes add independently; a lane overflowed when its result has the
+// wrong sign for both operands, which is collected in `overflow` and
+// checked once at the end.
+
+__attribute__((target("avx2"))) bool sumAvx2(const int64_t* a, std::size_t n, int64_t& out) {
+    __m256i sum = _mm256_setzero_si256();
+    __m256i overflow = _mm256_setzero_si256();
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i r = _mm256_add_epi64(sum, x);
+        overflow = _mm256_or_si256(overflow, _mm256_and_si256(_mm256_xor_si256(sum, r), _mm256_xor_si256(x, r)));
+        sum = r;
+    }
+    // a lane that wrapped lost its sum; one that did not holds an exact
+    // partial sum
+    if (_mm256_movemask_pd(_mm256_castsi256_pd(overflow)) != 0) return sumScalar(a, n, out);
+    alignas(32) int64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), sum);
+    __int128 total = 0;
+    for (int lane = 0; lane < 4; ++lane) total += lanes[lane];
+    for (; i < n; ++i) total += a[i];
+    return narrow(total, out);
+}
+
+__attribute__((target("avx2"))) int64_t minAvx2(const int64_t* a, std::size_t n) {
+    if (n < 4) return minScalar(a, n);
+    __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a));
+    std::size_t i = 4;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        m = _mm256_blendv_epi8(m, x, _mm256_cmpgt_epi64(m, x));
+    }
+    alignas(32) int64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), m);
+    int64_t result = minScalar(lanes, 4);
+    for (; i < n; ++i) result = a[i] < result ? a[i] : result;
+    return result;
+}
+
+__attribute__((target("avx2"))) int64_t maxAvx2(const int64_t* a, std::size_t n) {
+    if (n < 4) return maxScalar(a, n);
+    __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a));
+    std::size_t i = 4;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        m = _mm256_blendv_epi8(m, x, _mm256_cmpgt_epi64(x, m));
+    }
+    alignas(32) int64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), m);
+    int64_t result = maxScalar(lanes, 4);
+    for (; i < n; ++i) result = a[i] > result ? a[i] : result;
+    return result;
+}
+
+__attribute__((target("avx2"))) bool addAvx2(const int64_t* a, const int64_t* b, int64_t* out, std::size_t n) {
+    __m256i overflow = _mm256_setzero_si256();
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        __m256i r = _mm256_add_epi64(x, y);
+        overflow = _mm256_or_si256(overflow, _mm256_and_si256(_mm256_xor_si256(x, r), _mm256_xor_si256(y, r)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), r);
+    }
+    bool ok = _mm256_movemask_pd(_mm256_castsi256_pd(overflow)) == 0;
+    return addScalar(a + i, b + i, out + i, n - i) && ok;
+}
+
+#endif // INT_KERNELS_AVX2
+
+struct Dispatch {
+    bool (*sum)(const int64_t*, std::size_t, int64_t&);
+    int64_t (*min)(const int64_t*, std::size_t);
+    int64_t (*max)(const int64_t*, std::size_t);
+    bool (*add)(const int64_t*, const int64_t*, int64_t*, std::size_t);
+    const char* isa;
+};
+
+Dispatch pick() {
+#ifdef INT_KERNELS_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return {sumAvx2, minAvx2, maxAvx2, addAvx2, "avx2"};
+#endif
+    return {sumScalar, minScalar, maxScalar, addScalar, "scalar"};
+}
+
+const Dispatch& kernels() {
+    static const Dispatch dispatch = pick();
+    return dispatch;
+}
+
+} // namespace
+
+bool IntKernels::Sum(const int64_t* a, std::size_t n, int64_t& out) {
+    return kernels().sum(a, n, out);
+}
+
+int64_t IntKernels::Min(const int64_t* a, std::size_t n) {
+    return kernels().min(a, n);
+}
+
+int64_t IntKernels::Max(const int64_t* a, std::size_t n) {
+    return kernels().max(a, n);
+}
+
+bool IntKernels::Add(const int64_t* a, const int64_t* b, int64_t* out, std::size_t n) {
+    return kernels().add(a, b, out, n);
+}
+
+bool IntKernels::Mul(const int64_t* a, const int64_t* b, int64_t* out, std::size_t n) {
+    bool overflow = false;
+    for (std::size_t i = 0; i < n; ++i) overflow |= __builtin_mul_overflow(a[i], b[i], &out[i]);
+    return !overflow;
+}
+
+bool IntKernels::Scale(const int64_t* a, int64_t k, int64_t* out, std::size_t n) {
+    bool overflow = false;
+    for (std::size_t i = 0; i < n; ++i) overflow |= __builtin_mul_overflow(a[i], k, &out[i]);
+    return !overflow;
+}
+
+bool IntKernels::Dot(const int64_t* a, const int64_t* b, std::size_t n, int64_t& out) {
+    __int128 sum = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        int64_t product;
+        if (__builtin_mul_overflow(a[i], b[i], &product)) return false;
+        sum += product;
+    }
+    return narrow(sum, out);
+}
+
+// Each pass scatters by one byte of the key, lowest first, between a and
+// a scratch buffer; the key flips the sign bit so that negative values
+// order before positive ones as unsigned bytes.
+void IntKernels::Sort(int64_t* a, std::size_t n) {
+    if (n < 64) {
+        for (std::size_t i = 1; i < n; ++i) {
+            int64_t value = a[i];
+            std::size_t j = i;
+            for (; j > 0 && a[j - 1] > value; --j) a[j] = a[j - 1];
+            a[j] = value;
+        }
+        return;
+    }
+    constexpr uint64_t SIGN = uint64_t(1) << 63;
+    std::size_t counts[8][256] = {};
+    for (std::size_t i = 0; i < n; ++i) {
+        uint64_t key = uint64_t(a[i]) ^ SIGN;
+        for (int pass = 0; pass < 8; ++pass) counts[pass][(key >> (pass * 8)) & 0xff]++;
+    }
+
+    std::vector<int64_t> scratch(n);
+    int64_t* from = a;
+    int64_t* to = scratch.data();
+    for (int pass = 0; pass < 8; ++pass) {
+        std::size_t* count = counts[pass];
+        unsigned shift = pass * 8;
+        // every value has the same byte here
+        if (count[(uint64_t(a[0]) ^ SIGN) >> shift & 0xff] == n) continue;
+        std::size_t offset = 0;
+        for (int digit = 0; digit < 256; ++digit) {
+            std::size_t c = count[digit];
+            count[digit] = offset;
+            offset += c;
+        }
+        for (std::size_t i = 0; i < n; ++i) {
+            int64_t value = from[i];
+            to[count[(uint64_t(value) ^ SIGN) >> shift & 0xff]++] = value;
+        }
+        std::swap(from, to);
+    }
+    if (from != a) std::copy(from, from + n, a);
+}
+
+const char* IntKernels::Isa() {
+    return kernels().isa;
+}
@@ -0,0 +1,37 @@
+#ifndef INT_KERNELS_H
+#define INT_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Loops over contiguous int64 values, behind the numeric builtins. Each
+// returns false, leaving the result unspecified, if a result does not fit
+// in 64 bits. For Sum and Dot that is the exact total, whatever partial
+// sums on the way would have wrapped; Dot also fails on any product that
+// does not fit.
+//
+// Sum, Min, Max and Add have AVX2 versions, picked once at run time when
+// the CPU has it; x86-64 has no 64-bit vector multiply below AVX-512, so
+// Mul, Scale and Dot are checked scalar loops everywhere.
+class IntKernels {
+public:
+    static bool Sum(const int64_t* a, std::size_t n, int64_t& out);
+    // n must be at least 1
+    static int64_t Min(const int64_t* a, std::size_t n);
+    static int64_t Max(const int64_t* a, std::size_t n);
+    static bool Dot(const int64_t* a, const int64_t* b, std::size_t n, int64_t& out);
+
+    // out may be a or b
+    static bool Add(const int64_t* a, const int64_t* b, int64_t* out, std::size_t n);
+    static bool Mul(const int64_t* a, const int64_t* b, int64_t* out, std::size_t n);
+    static bool Scale(const int64_t* a, int64_t k, int64_t* out, std::size_t n);
+
+    // Sorts in place, ascending: LSD radix sort on bytes, skipping the
+    // bytes every value shares, with insertion sort for short arrays
+    static void Sort(int64_t* a, std::size_t n);
+
+    // "avx2" or "scalar"
+    static const char* Isa();
+};
+
+#endif // INT_KERNELS_H
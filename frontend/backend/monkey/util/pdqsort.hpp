@@ -0,0 +1,209 @@
+#ifndef PDQSORT_H
+#define PDQSORT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <utility>
+
+// Pattern-defeating quicksort: quicksort with a median-of-3 (ninther on
+// large ranges) pivot that notices already sorted runs and runs of equal
+// elements, and breaks up adversarial patterns by shuffling a few
+// elements after an unbalanced partition, falling back to heapsort after
+// too many. Not stable.
+//
+// Unlike std::sort, every scan is bounds checked, so a comparator that is
+// not a strict weak order (one written in Monkey, say) only leaves the
+// range in some order instead of running off its ends.
+namespace pdqsort_detail {
+
+constexpr std::ptrdiff_t INSERTION_SORT_THRESHOLD = 24;
+constexpr std::ptrdiff_t NINTHER_THRESHOLD = 128;
+// moves partialInsertionSort makes before it gives up
+constexpr std::ptrdiff_t PARTIAL_INSERTION_SORT_LIMIT = 8;
+
+template <typename It, typename Compare>
+void insertionSort(It begin, It end, Compare& comp) {
+    if (begin == end) return;
+    for (It cur = begin + 1; cur != end; ++cur) {
+        It sift = cur;
+        It prev = cur - 1;
+        if (comp(*sift, *prev)) {
+            auto tmp = std::move(*sift);
+            do {
+                *sift-- = std::move(*prev);
+            } while (sift != begin && comp(tmp, *--prev));
+            *sift = std::move(tmp);
+        }
+    }
+}
+
+// Insertion sort that gives up, returning false, once it has moved more
+// than a few elements
+template <typename It, typename Compare>
+bool partialInsertionSort(It begin, It end, Compare& comp) {
+    if (begin == end) return true;
+    std::ptrdiff_t moved = 0;
+    for (It cur = begin + 1; cur != end; ++cur) {
+        It sift = cur;
+        It prev = cur - 1;
+        if (comp(*sift, *prev)) {
+            auto tmp = std::move(*sift);
+            do {
+                *sift-- = std::move(*prev);
+            } while (sift != begin && comp(tmp, *--prev));
+            *sift = std::move(tmp);
+            moved += cur - sift;
+        }
+        if (moved > PARTIAL_INSERTION_SORT_LIMIT) return false;
+    }
+    return true;
+}
+
+template <typename It, typename Compare>
+void sort2(It a, It b, Compare& comp) {
+    if (comp(*b, *a)) std::iter_swap(a, b);
+}
+
+// leaves the median of the three in b
+template <typename It, typename Compare>
+void sort3(It a, It b, It c, Compare& comp) {
+    sort2(a, b, comp);
+    sort2(b, c, comp);
+    sort2(a, b, comp);
+}
+
+// Partitions around the pivot in *begin: what is less before it, the rest
+// after. Returns where the pivot ended up, and whether the range already
+// was partitioned.
+template <typename It, typename Compare>
+std::pair<It, bool> partitionRight(It begin, It end, Compare& comp) {
+    auto pivot = std::move(*begin);
+    It first = begin + 1;
+    It last = end;
+    // [begin + 1, first) is less than the pivot, [last, end) is not
+    while (first < last && comp(*first, pivot)) ++first;
+    while (last > first && !comp(*(last - 1), pivot)) --last;
+    bool alreadyPartitioned = first == last;
+    while (first < last) {
+        std::iter_swap(first++, --last);
+        while (first < last && comp(*first, pivot)) ++first;
+        while (last > first && !comp(*(last - 1), pivot)) --last;
+    }
+    It pivotPos = first - 1;
+    *begin = std::move(*pivotPos);
+    *pivotPos = std::move(pivot);
+    return {pivotPos, alreadyPartitioned};
+}
+
+// Like partitionRight, but with the elements equal to the pivot before
+// it; used when the pivot equals the element before the range, so all of
+// those are equal and need no more sorting
+template <typename It, typename Compare>
+It partitionLeft(It begin, It end, Compare& comp) {
+    auto pivot = std::move(*begin);
+    It first = begin + 1;
+    It last = end;
+    while (first < last && !comp(pivot, *first)) ++first;
+    while (last > first && comp(pivot, *(last - 1))) --last;
+    while (first < last) {
+        std::iter_swap(first++, --last);
+        while (first < last && !comp(pivot, *first)) ++first;
+        while (last > first && comp(pivot, *(last - 1))) --last;
+    }
+    It pivotPos = first - 1;
+    *begin = std::move(*pivotPos);
+    *pivotPos = std::move(pivot);
+    return pivotPos;
+}
+
+template <typename It, typename Compare>
+void pdqsortLoop(It begin, It end, Compare& comp, int badAllowed, bool leftmost) {
+    while (true) {
+        std::ptrdiff_t size = end - begin;
+        if (size < INSERTION_SORT_THRESHOLD) {
+            insertionSort(begin, end, comp);
+            return;
+        }
+
+        // the pivot goes to *begin
+        std::ptrdiff_t half = size / 2;
+        if (size > NINTHER_THRESHOLD) {
+            sort3(begin, begin + half, end - 1, comp);
+            sort3(begin + 1, begin + (half - 1), end - 2, comp);
+            sort3(begin + 2, begin + (half + 1), end - 3, comp);
+            sort3(begin + (half - 1), begin + half, begin + (half + 1), comp);
+            std::iter_swap(begin, begin + half);
+        } else {
+            sort3(begin + half, begin, end - 1, comp);
+        }
+
+        // *(begin - 1), the pivot of the partition this range came from,
+        // is no greater than anything in it; if it is not less than this
+        // pivot either, everything equal to the pivot is done
+        if (!leftmost && !comp(*(begin - 1), *begin)) {
+            begin = partitionLeft(begin, end, comp) + 1;
+            continue;
+        }
+
+        auto partitioned = partitionRight(begin, end, comp);
+        It pivotPos = partitioned.first;
+        std::ptrdiff_t left = pivotPos - begin;
+        std::ptrdiff_t right = end - (pivotPos + 1);
+
+        if (left < size / 8 || right < size / 8) {
+            if (--badAllowed == 0) {
+                std::make_heap(begin, end, comp);
+                std::sort_heap(begin, end, comp);
+                return;
+            }
+            if (left >= INSERTION_SORT_THRESHOLD) {
+                std::iter_swap(begin, begin + left / 4);
+                std::iter_swap(pivotPos - 1, pivotPos - left / 4);
+                if (left > NINTHER_THRESHOLD) {
+                    std::iter_swap(begin + 1, begin + (left / 4 + 1));
+                    std::iter_swap(begin + 2, begin + (left / 4 + 2));
+                    std::iter_swap(pivotPos - 2, pivotPos - (left / 4 + 1));
+                    std::iter_swap(pivotPos - 3, pivotPos - (left / 4 + 2));
+                }
+            }
+            if (right >= INSERTION_SORT_THRESHOLD) {
+                std::iter_swap(pivotPos + 1, pivotPos + (1 + right / 4));
+                std::iter_swap(end - 1, end - right / 4);
+                if (right > NINTHER_THRESHOLD) {
+                    std::iter_swap(pivotPos + 2, pivotPos + (2 + right / 4));
+                    std::iter_swap(pivotPos + 3, pivotPos + (3 + right / 4));
+                    std::iter_swap(end - 2, end - (1 + right / 4));
+                    std::iter_swap(end - 3, end - (2 + right / 4));
+                }
+            }
+        } else if (partitioned.second && partialInsertionSort(begin, pivotPos, comp)
+                   && partialInsertionSort(pivotPos + 1, end, comp)) {
+            // no swaps were needed, and both sides turned out (nearly) sorted
+            return;
+        }
+
+        pdqsortLoop(begin, pivotPos, comp, badAllowed, leftmost);
+        begin = pivotPos + 1;
+        leftmost = false;
+    }
+}
+
+} // namespace pdqsort_detail
+
+template <typename It, typename Compare>
+void PdqSort(It begin, It end, Compare comp) {
+    std::ptrdiff_t size = end - begin;
+    if (size < 2) return;
+    int log2 = 0;
+    while (size >>= 1) ++log2;
+    pdqsort_detail::pdqsortLoop(begin, end, comp, log2, true);
+}
+
+template <typename It>
+void PdqSort(It begin, It end) {
+    PdqSort(begin, end, std::less<typename std::iterator_traits<It>::value_type>());
+}
+
+#endif // PDQSORT_H
@@ -0,0 +1,96 @@
+#include "thread_pool.hpp"
+#include "../object/region.hpp"
+#include <algorithm>
+#include <memory>
+
+ThreadPool::ThreadPool(unsigned threads) : stopping(false) {
+    // the caller of ParallelFor is the extra thread
+    for (unsigned i = 1; i < threads; ++i) {
+        workers.emplace_back([this] { workerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& w : workers) w.join();
+}
+
+// The pool lives on after the run that first asks for it, so it never
+// allocates from that run's Region: not when it is built, and not for the
+// tasks queued to its workers.
+ThreadPool& ThreadPool::Shared() {
+    static std::unique_ptr<ThreadPool> pool = [] {
+        YOXS_OBJECT::Region::Outside outside;
+        return std::make_unique<ThreadPool>();
+    }();
+    return *pool;
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::workerLoop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (stopping && queue.empty()) return;
+            task = std::move(queue.front());
+            queue.pop_front();
+        }
+        task();
+    }
+}
+
+void ThreadPool::ParallelFor(std::size_t count, const std::function<void(std::size_t)>& body) {
+    if (count == 0) return;
+    if (count == 1 || workers.empty()) {
+        for (std::size_t i = 0; i < count; ++i) body(i);
+        return;
+    }
+
+    // Indices are claimed from a shared counter, so whichever threads show
+    // up first do the work; helpers that arrive after the loop is drained
+    // simply leave.
+    struct Loop {
+        std::atomic<std::size_t> next{0};
+        std::atomic<std::size_t> done{0};
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    std::shared_ptr<Loop> loop;
+    {
+        YOXS_OBJECT::Region::Outside outside;
+        loop = std::make_shared<Loop>();
+    }
+    auto run = [loop, count, &body] {
+        std::size_t i;
+        while ((i = loop->next.fetch_add(1)) < count) {
+            body(i);
+            if (loop->done.fetch_add(1) + 1 == count) {
+                std::lock_guard<std::mutex> lock(loop->mutex);
+                loop->finished.notify_all();
+            }
+        }
+    };
+
+    std::size_t helpers = std::min<std::size_t>(workers.size(), count - 1);
+    {
+        YOXS_OBJECT::Region::Outside outside;
+        for (std::size_t h = 0; h < helpers; ++h) submit(run);
+    }
+    run();
+
+    std::unique_lock<std::mutex> lock(loop->mutex);
+    loop->finished.wait(lock, [&] { return loop->done.load() == count; });
+}
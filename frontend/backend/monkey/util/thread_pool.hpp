@@ -0,0 +1,46 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads shared by the parallel passes of the
+// interpreter (parsing, builtins). Work is handed out with ParallelFor,
+// whose caller takes part in the loop, so a ParallelFor issued from inside
+// a worker can never deadlock waiting for a free thread.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of threads that can work on a ParallelFor, caller included
+    unsigned Size() const { return static_cast<unsigned>(workers.size()) + 1; }
+
+    // Runs body(0) .. body(count - 1) across the pool and returns once all
+    // of them have finished
+    void ParallelFor(std::size_t count, const std::function<void(std::size_t)>& body);
+
+    // Process-wide pool sized to the machine
+    static ThreadPool& Shared();
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> queue;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+
+    void submit(std::function<void()> task);
+    void workerLoop();
+};
+
+#endif // THREAD_POOL_H
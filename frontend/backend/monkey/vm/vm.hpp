@@ -10,14 +10,14 @@ constexpr int MaxFrames = 1024;
 
 class ObjectConstants {
 public:
-    static std::shared_ptr<NullObject> NULL_OBJ;
-    static std::shared_ptr<BooleanObject> TRUE;
-    static std::shared_ptr<BooleanObject> FALSE;
+    static Ref<NullObject> NULL_OBJ;
+    static Ref<BooleanObject> TRUE;
+    static Ref<BooleanObject> FALSE;
 };
 
-std::shared_ptr<NullObject> ObjectConstants::NULL_OBJ = std::make_shared<NullObject>();
-std::shared_ptr<BooleanObject> ObjectConstants::TRUE = std::make_shared<BooleanObject>(true);
-std::shared_ptr<BooleanObject> ObjectConstants::FALSE = std::make_shared<BooleanObject>(false);
+Ref<NullObject> ObjectConstants::NULL_OBJ = MakeRef<NullObject>();
+Ref<BooleanObject> ObjectConstants::TRUE = MakeRef<BooleanObject>(true);
+Ref<BooleanObject> ObjectConstants::FALSE = MakeRef<BooleanObject>(false);
 
 class VM {
 public:
@@ -28,7 +28,7 @@ public:
     }
 
     // Stack manipulation methods
-    bool push(std::shared_ptr<Object> obj) {
+    bool push(ObjectRef obj) {
         if (sp >= StackSize) {
             // Stack overflow handling
             return false;
@@ -38,7 +38,7 @@ public:
         return true;
     }
 
-        std::shared_ptr<Object> pop() {
+        ObjectRef pop() {
         if (sp == 0) {
             return nullptr; // Stack underflow handling
         }
@@ -46,7 +46,7 @@ public:
         return stack[sp];
     }
 
-    std::shared_ptr<Object> peek(int distance = 0) {
+    ObjectRef peek(int distance = 0) {
         if (sp - distance - 1 < 0) {
             return nullptr; // Invalid peek
         }
@@ -72,12 +72,12 @@ public:
         // Implementation depends on bytecode format and instructions
     }
 private:
-    std::vector<std::shared_ptr<Object>> constants;
-    std::vector<std::shared_ptr<Object>> stack;
+    std::vector<ObjectRef> constants;
+    std::vector<ObjectRef> stack;
     int sp; // stack pointer; always points to next value. 
     //top of stack is stack[sp-1]
 
-    std::vector<std::shared_ptr<Object>> globals;
+    std::vector<ObjectRef> globals;
     std::vector<int> frames;
     int framesIndex;
 };
\ No newline at end of file